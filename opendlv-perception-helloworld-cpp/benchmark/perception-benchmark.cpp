@@ -0,0 +1,520 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+
+#include "allocation-counter.hpp"
+#include "async-log.hpp"
+#include "cone-blobs.hpp"
+#include "cone-segmentation.hpp"
+#include "frame-budget.hpp"
+#include "frame-pyramid.hpp"
+#include "frame-ring.hpp"
+#include "ground-plane.hpp"
+#include "latency-trace.hpp"
+#include "processing-stage.hpp"
+#include "region-of-interest.hpp"
+#include "stage-telemetry.hpp"
+#include "synthetic-camera.hpp"
+#include "undistortion.hpp"
+#include "work-stealing-pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A cone as reported by the perception.
+struct Detection {
+    uint32_t id;
+    uint32_t label;
+    float x;
+    float y;
+};
+
+/**
+ * Lane of cones in front of the vehicle, blue on the left and yellow on the
+ * right; it bends and shifts from frame to frame, and the cones come closer
+ * as if driving at the given speed.
+ */
+static void makeLane(uint32_t frame, float rate, std::vector<SyntheticCone> &cones) noexcept {
+    const float SPACING{0.5f};
+    const float HALF_WIDTH{0.6f};
+    const float SPEED{0.5f};
+    const float PHASE{static_cast<float>(frame) / 200.0f * 2.0f * static_cast<float>(M_PI)};
+    const float CURVATURE{0.3f * std::sin(PHASE)};
+    const float OFFSET{0.1f * std::sin(3.0f * PHASE)};
+    const float SCROLL{std::fmod(static_cast<float>(frame) * SPEED / std::max(1.0f, rate), SPACING)};
+
+    cones.clear();
+    for (float s{0.4f + SPACING - SCROLL}; s < 4.0f; s += SPACING) {
+        // Point and normal on a circular arc through the origin, heading along x.
+        const float A{CURVATURE * s};
+        const float X{(std::fabs(CURVATURE) < 1e-4f) ? s : std::sin(A) / CURVATURE};
+        const float Y{(std::fabs(CURVATURE) < 1e-4f) ? 0.0f : (1.0f - std::cos(A)) / CURVATURE};
+        const float NX{-std::sin(A)};
+        const float NY{std::cos(A)};
+        for (const float SIDE : {1.0f, -1.0f}) {
+            SyntheticCone c;
+            c.x = X + NX * (SIDE * HALF_WIDTH + OFFSET);
+            c.y = Y + NY * (SIDE * HALF_WIDTH + OFFSET);
+            c.label = (0.0f < SIDE) ? CONE_BLUE : CONE_YELLOW;
+            cones.push_back(c);
+        }
+    }
+}
+
+/**
+ * Evaluation matches the detections of each frame to the cones that were
+ * rendered and collects latency and accuracy.
+ */
+class Evaluation {
+   public:
+    void add(const std::vector<SyntheticCone> &truth, const std::vector<Detection> &detections, int64_t latency) noexcept {
+        m_frames++;
+        m_latency.record(latency);
+        m_detections += detections.size();
+
+        // Greedily match every cone, nearest first, to the closest free
+        // detection within 20% of its distance (at least 0.15 m).
+        m_matched.assign(detections.size(), false);
+        for (const SyntheticCone &c : truth) {
+            const float DISTANCE{std::sqrt(c.x * c.x + c.y * c.y)};
+            const float GATE{std::max(0.15f, 0.2f * DISTANCE)};
+            float best{GATE};
+            int32_t index{-1};
+            for (uint32_t i{0}; i < detections.size(); i++) {
+                const float ERROR{std::hypot(detections[i].x - c.x, detections[i].y - c.y)};
+                if (!m_matched[i] && (ERROR < best)) {
+                    best = ERROR;
+                    index = static_cast<int32_t>(i);
+                }
+            }
+            if (c.visible) {
+                m_visible++;
+            }
+            if (0 > index) {
+                continue;
+            }
+            // Cones that are only partly in view may be found, but need not.
+            m_matched[static_cast<uint32_t>(index)] = true;
+            if (c.visible) {
+                m_found++;
+                m_errors.push_back(best);
+                m_relativeErrors.push_back(best / DISTANCE);
+                if (detections[static_cast<uint32_t>(index)].label != c.label) {
+                    m_wrongColour++;
+                }
+            }
+        }
+        m_falsePositives += static_cast<uint64_t>(std::count(m_matched.begin(), m_matched.end(), false));
+    }
+
+    uint64_t frames() const noexcept {
+        return m_frames;
+    }
+
+    std::string report() noexcept {
+        std::stringstream sstr;
+        sstr << std::fixed << std::setprecision(1)
+             << "latency p50/p99/max " << m_latency.summary() << " ms"
+             << ", recall " << 100.0 * static_cast<double>(m_found) / static_cast<double>(std::max<uint64_t>(1, m_visible)) << "%"
+             << " (" << m_found << " of " << m_visible << ")"
+             << ", false positives " << 100.0 * static_cast<double>(m_falsePositives) / static_cast<double>(std::max<uint64_t>(1, m_detections)) << "%"
+             << ", wrong colour " << m_wrongColour;
+        if (!m_errors.empty()) {
+            std::sort(m_errors.begin(), m_errors.end());
+            std::sort(m_relativeErrors.begin(), m_relativeErrors.end());
+            auto percentile = [](const std::vector<float> &v, float p) {
+                return static_cast<double>(v[static_cast<std::size_t>(p * static_cast<float>(v.size() - 1))]);
+            };
+            sstr << std::setprecision(3)
+                 << ", position error p50/p95 " << percentile(m_errors, 0.5f) << "/" << percentile(m_errors, 0.95f) << " m"
+                 << std::setprecision(1)
+                 << " (" << 100.0 * percentile(m_relativeErrors, 0.5f) << "/" << 100.0 * percentile(m_relativeErrors, 0.95f) << "% of distance)";
+        }
+        return sstr.str();
+    }
+
+   private:
+    LatencyHistogram m_latency{};
+    uint64_t m_frames{0};
+    uint64_t m_visible{0};
+    uint64_t m_found{0};
+    uint64_t m_detections{0};
+    uint64_t m_falsePositives{0};
+    uint64_t m_wrongColour{0};
+    std::vector<float> m_errors{};
+    std::vector<float> m_relativeErrors{};
+    std::vector<bool> m_matched{};
+};
+
+/**
+ * Producer renders frames into a frame ring at a fixed rate (or as fast as
+ * possible for rate 0) and keeps the cones of every frame by frame number.
+ */
+class Producer {
+   private:
+    Producer(const Producer &) = delete;
+    Producer(Producer &&)      = delete;
+    Producer &operator=(const Producer &) = delete;
+    Producer &operator=(Producer &&) = delete;
+
+   public:
+    Producer(const std::string &name, const CameraPose &pose, uint32_t width, uint32_t height, uint32_t fourcc, float rate, uint32_t frames) noexcept
+        : m_camera(pose, width, height, fourcc)
+        , m_sharedMemory{name, static_cast<uint32_t>(frameRingLayout::requiredSize(3, m_camera.info().size))}
+        , m_writer{m_sharedMemory, 3}
+        , m_rate(rate)
+        , m_truth(frames + 1) {}
+
+    bool valid() noexcept {
+        return m_writer.valid() && (m_writer.slotSize() >= m_camera.info().size);
+    }
+
+    const FrameInfo &info() const noexcept {
+        return m_camera.info();
+    }
+
+    /**
+     * @return Frames per second; 0 for as fast as possible.
+     */
+    float rate() const noexcept {
+        return m_rate;
+    }
+
+    /**
+     * @return Cones of a frame; valid once the frame was seen in the ring.
+     */
+    const std::vector<SyntheticCone> &truth(uint32_t frameNumber) const noexcept {
+        return m_truth[std::min<std::size_t>(frameNumber, m_truth.size() - 1)];
+    }
+
+    bool finished() const noexcept {
+        return m_finished.load();
+    }
+
+    void run() noexcept {
+        const auto PERIOD{std::chrono::nanoseconds(static_cast<int64_t>(1e9 / std::max(1e-3, static_cast<double>(m_rate))))};
+        auto next{std::chrono::steady_clock::now()};
+        for (uint32_t i{1}; i < m_truth.size(); i++) {
+            if (0.0f < m_rate) {
+                next += PERIOD;
+                std::this_thread::sleep_until(next);
+            }
+            // The ring numbers frames from 1 in the order they are written.
+            makeLane(i, (0.0f < m_rate) ? m_rate : 30.0f, m_truth[i]);
+            m_camera.render(m_truth[i], m_writer.beginWrite());
+            FrameInfo info{m_camera.info()};
+            info.sampleTimeStamp = cluon::time::toMicroseconds(cluon::time::now());
+            m_writer.endWrite(info);
+        }
+        m_finished.store(true);
+    }
+
+   private:
+    SyntheticCamera m_camera;
+    cluon::SharedMemory m_sharedMemory;
+    FrameRingWriter m_writer;
+    const float m_rate;
+    std::vector<std::vector<SyntheticCone>> m_truth;
+    std::atomic<bool> m_finished{false};
+};
+
+// Runs the processing stage of the microservice on the frames in this
+// process; frames are copied out of the ring as its acquisition stage does.
+static void runInProcess(Producer &producer, const std::string &name, ProcessingStage &processingStage, RegionOfInterest &regionOfInterest,
+                         FrameBudget &frameBudget, uint32_t coarseLevels, StageTelemetry &telemetry, Evaluation &evaluation) {
+    // The consumer attaches separately, just like another process.
+    cluon::SharedMemory sharedMemory{name};
+    FrameRingReader reader{sharedMemory};
+    if (!reader.valid()) {
+        std::cerr << "Failed to attach to frame ring '" << name << "'." << std::endl;
+        return;
+    }
+    const std::size_t FRAME_SIZE{reader.slotSize()};
+    FrameBufferPool framePool{1, FRAME_SIZE};
+    FrameBufferPool labelPool{1, FRAME_SIZE};
+    FrameBufferPool pyramidPool{(0 < coarseLevels) ? 1u : 0u, pyramidCapacity(FRAME_SIZE)};
+    std::vector<Detection> detections;
+
+    const auto START{std::chrono::steady_clock::now()};
+    uint32_t lastFrame{0};
+    uint32_t missed{0};
+    uint32_t skipped{0};
+    int64_t busy{0};
+    while (!producer.finished() || (reader.latest() != lastFrame)) {
+        if (!reader.waitFor(std::chrono::milliseconds(100)) && (reader.latest() == lastFrame)) {
+            continue;
+        }
+        const auto ACQUISITION_START{std::chrono::steady_clock::now()};
+        AcquiredFrame frame{framePool.acquire(), FrameInfo{}, regionOfInterest.region()};
+        if ( (0 < coarseLevels) && frameBudget.shedding().coarseDetection ) {
+            frame.pyramid = pyramidPool.acquire();
+        }
+        FrameInfo &info{frame.info};
+        const uint32_t COPIED{frame.pyramid ?
+            reader.readWith(info, [&frame, &FRAME_SIZE, &coarseLevels](const char *src, const FrameInfo &i, std::size_t available) {
+                if (isValidFrameInfo(i, std::min(FRAME_SIZE, available))) {
+                    copyFrameRegionWithPyramid(frame.buffer.get(), frame.pyramid.get(), src, pyramidLayout(i, coarseLevels), frame.region, frame.pyramidTimings);
+                }
+            }) :
+            reader.read(frame.buffer.get(), FRAME_SIZE, info, frame.region)};
+        telemetry.record(Stage::COPY, ACQUISITION_START, std::chrono::steady_clock::now());
+        if ( (0 == COPIED) || (info.frameNumber == lastFrame) ) {
+            continue;
+        }
+        missed += info.frameNumber - lastFrame - 1;
+        lastFrame = info.frameNumber;
+
+        // At full speed, every frame is processed in full to measure the
+        // capacity of the stages; otherwise, load is shed as on the vehicle.
+        frame.times.processingStart = cluon::time::toMicroseconds(cluon::time::now());
+        if ( (0.0f < producer.rate()) && (frameBudget.skip(info.frameNumber) || frameBudget.isStale(info, frame.times.processingStart)) ) {
+            skipped++;
+            continue;
+        }
+        telemetry.record(Stage::ACQUISITION, ACQUISITION_START, std::chrono::steady_clock::now());
+        ProcessedFrame processed{std::move(frame.buffer), labelPool.acquire(), info};
+        processingStage.process(frame, processed);
+        const int64_t DONE{cluon::time::toMicroseconds(cluon::time::now())};
+
+        detections.clear();
+        for (uint32_t i{0}; i < processed.cones.count; i++) {
+            ConeBlob &cone{processed.cones.cones[i]};
+            if (!cone.onGround) {
+                cone.x = cone.distance * std::cos(cone.azimuth);
+                cone.y = cone.distance * std::sin(cone.azimuth);
+            }
+            detections.push_back(Detection{i, cone.label, cone.x, cone.y});
+        }
+        busy += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - ACQUISITION_START).count();
+        evaluation.add(producer.truth(info.frameNumber), detections, DONE - info.sampleTimeStamp);
+    }
+    const double SECONDS{std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - START).count() * 1e-6};
+
+    // Capacity is the frame rate that the stages alone could sustain.
+    std::cout << std::fixed << std::setprecision(1)
+              << "Processed " << evaluation.frames() << " frames (" << static_cast<double>(evaluation.frames()) / SECONDS << " fps, capacity "
+              << static_cast<double>(evaluation.frames()) / std::max(1e-6, static_cast<double>(busy) * 1e-6) << " fps), missed " << missed
+              << ", shed " << skipped << "." << std::endl
+              << frameBudget.report() << std::endl
+              << telemetry.snapshot() << std::endl;
+    if (countsHeapAllocations()) {
+        std::cout << processingStage.allocations() << " heap allocations in " << processingStage.allocationFrames() << " frames; frame arena of "
+                  << processingStage.arenaHighWater() << " bytes." << std::endl;
+    }
+}
+
+// Listens to the results of a running opendlv-perception-helloworld.
+static void runBinary(Producer &producer, uint16_t cid, Evaluation &evaluation) {
+    cluon::OD4Session od4{cid};
+    if (!od4.isRunning()) {
+        std::cerr << "Failed to join OD4 session " << cid << "." << std::endl;
+        return;
+    }
+    std::cout << "Evaluating the cones sent to OD4 session " << cid << "." << std::endl;
+
+    // All callbacks run on the thread receiving from the OD4 session.
+    std::mutex mutex;
+    std::vector<Detection> detections;
+    uint32_t frames{0};
+    auto last = [&detections](uint32_t id) -> Detection* {
+        for (auto it{detections.rbegin()}; it != detections.rend(); it++) {
+            if (id == it->id) {
+                return &(*it);
+            }
+        }
+        return nullptr;
+    };
+    od4.dataTrigger(opendlv::logic::perception::ObjectFrameStart::ID(), [&](cluon::data::Envelope &&) {
+        std::lock_guard<std::mutex> lck(mutex);
+        detections.clear();
+    });
+    od4.dataTrigger(opendlv::logic::perception::ObjectType::ID(), [&](cluon::data::Envelope &&env) {
+        auto msg{cluon::extractMessage<opendlv::logic::perception::ObjectType>(std::move(env))};
+        std::lock_guard<std::mutex> lck(mutex);
+        detections.push_back(Detection{msg.objectId(), msg.type(), 0.0f, 0.0f});
+    });
+    // Without a ground position, the cone is placed by its direction and distance.
+    od4.dataTrigger(opendlv::logic::perception::ObjectDirection::ID(), [&](cluon::data::Envelope &&env) {
+        auto msg{cluon::extractMessage<opendlv::logic::perception::ObjectDirection>(std::move(env))};
+        std::lock_guard<std::mutex> lck(mutex);
+        if (Detection *d{last(msg.objectId())}) {
+            d->x = std::cos(msg.azimuthAngle());
+            d->y = std::sin(msg.azimuthAngle());
+        }
+    });
+    od4.dataTrigger(opendlv::logic::perception::ObjectDistance::ID(), [&](cluon::data::Envelope &&env) {
+        auto msg{cluon::extractMessage<opendlv::logic::perception::ObjectDistance>(std::move(env))};
+        std::lock_guard<std::mutex> lck(mutex);
+        if (Detection *d{last(msg.objectId())}) {
+            d->x *= msg.distance();
+            d->y *= msg.distance();
+        }
+    });
+    od4.dataTrigger(opendlv::logic::perception::ObjectPosition::ID(), [&](cluon::data::Envelope &&env) {
+        auto msg{cluon::extractMessage<opendlv::logic::perception::ObjectPosition>(std::move(env))};
+        std::lock_guard<std::mutex> lck(mutex);
+        if (Detection *d{last(msg.objectId())}) {
+            d->x = msg.x();
+            d->y = msg.y();
+        }
+    });
+    // The frame number of the ring is the object frame's identity.
+    od4.dataTrigger(opendlv::logic::perception::ObjectFrameEnd::ID(), [&](cluon::data::Envelope &&env) {
+        const int64_t RECEIVED{cluon::time::toMicroseconds(cluon::time::now())};
+        const int64_t SAMPLED{cluon::time::toMicroseconds(env.sampleTimeStamp())};
+        auto msg{cluon::extractMessage<opendlv::logic::perception::ObjectFrameEnd>(std::move(env))};
+        std::lock_guard<std::mutex> lck(mutex);
+        evaluation.add(producer.truth(msg.objectFrameId()), detections, RECEIVED - SAMPLED);
+        frames++;
+    });
+
+    const auto START{std::chrono::steady_clock::now()};
+    while (!producer.finished()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    // Give the last frames time to come through.
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    const double SECONDS{std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - START).count() * 1e-6 - 1.0};
+
+    std::lock_guard<std::mutex> lck(mutex);
+    std::cout << std::fixed << std::setprecision(1)
+              << "Received " << frames << " object frames (" << static_cast<double>(frames) / SECONDS << " fps)." << std::endl;
+}
+
+int32_t main(int32_t argc, char **argv) {
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if (commandlineArguments.count("help") != 0) {
+        std::cerr << argv[0] << " renders synthetic frames of a lane of cones into a frame ring and measures the processing stage of the microservice on them." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " [--name=<name of shared memory area>] [--width=<width> --height=<height>] [--format=<argb|i420>] [--rate=<Hz>] [--frames=<n>] [--cid=<OD4 session>] [--simd=<kernel>] [--tile-threads=<n>] [--budget=<ms>] [--no-shedding] [--pyramid=<levels>] [--shed-pyramid=<levels>] [--roi-band=<from,to>] [--roi-follow] [--detect-every=<n>] [--calibration=<file>] [--undistort=<mode>] [--fovy=<deg>] [--camera-height=<m>] [--camera-pitch=<deg>] [--verbose]" << std::endl;
+        std::cerr << "         --name:   name of the shared memory area with the frame ring (default: perception-benchmark)" << std::endl;
+        std::cerr << "         --width:  width of the frames (default: 640)" << std::endl;
+        std::cerr << "         --height: height of the frames (default: 480)" << std::endl;
+        std::cerr << "         --format: pixel format of the frames (default: i420)" << std::endl;
+        std::cerr << "         --rate:   frames per second; 0 produces frames as fast as possible and processes every frame in full (default: 30)" << std::endl;
+        std::cerr << "         --frames: number of frames to produce (default: 600)" << std::endl;
+        std::cerr << "         --cid:    only produce frames and evaluate the cones that a running microservice with this OD4 session and --name sends" << std::endl;
+        std::cerr << "         --simd, --tile-threads, --budget, --no-shedding, --pyramid, --shed-pyramid, --roi-band, --roi-follow, --detect-every, --calibration, --undistort: processing as for the microservice" << std::endl;
+        std::cerr << "         --fovy, --camera-height, --camera-pitch: camera as for the microservice" << std::endl;
+        std::cerr << "         --verbose: log the reports of the processing stage" << std::endl;
+        std::cerr << "Example: " << argv[0] << " --width=640 --height=480 --format=i420 --rate=30 --frames=600" << std::endl;
+        return 1;
+    }
+    const std::string NAME{(commandlineArguments.count("name") != 0) ? commandlineArguments["name"] : "perception-benchmark"};
+    const uint32_t WIDTH{(commandlineArguments.count("width") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["width"])) & ~1u : 640};
+    const uint32_t HEIGHT{(commandlineArguments.count("height") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["height"])) & ~1u : 480};
+    const uint32_t FOURCC{("argb" == commandlineArguments["format"]) ? FOURCC_ARGB : FOURCC_I420};
+    const float RATE{(commandlineArguments.count("rate") != 0) ? std::stof(commandlineArguments["rate"]) : 30.0f};
+    const uint32_t FRAMES{(commandlineArguments.count("frames") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["frames"])) : 600};
+    const uint32_t TILE_THREADS{(commandlineArguments.count("tile-threads") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["tile-threads"])) : 0};
+    CameraPose pose;
+    pose.fovy = (commandlineArguments.count("fovy") != 0) ? std::stof(commandlineArguments["fovy"]) : pose.fovy;
+    pose.height = (commandlineArguments.count("camera-height") != 0) ? std::stof(commandlineArguments["camera-height"]) : pose.height;
+    pose.pitch = (commandlineArguments.count("camera-pitch") != 0) ? std::stof(commandlineArguments["camera-pitch"]) : pose.pitch;
+
+    Producer producer{NAME, pose, WIDTH, HEIGHT, FOURCC, RATE, FRAMES};
+    if (!producer.valid()) {
+        std::cerr << "Failed to create frame ring '" << NAME << "'." << std::endl;
+        return 1;
+    }
+    std::stringstream rate;
+    rate << RATE << " Hz";
+    std::cout << argv[0] << ": " << FRAMES << " synthetic " << ((FOURCC_I420 == FOURCC) ? "I420" : "ARGB") << " frames of " << WIDTH << "x" << HEIGHT
+              << " at " << ((0.0f < RATE) ? rate.str() : std::string{"full speed"}) << " into '" << NAME << "'." << std::endl;
+
+    ConeSegmentation::Path simdPath{ConeSegmentation::Path::SCALAR};
+    if (!ConeSegmentation::parsePath(commandlineArguments["simd"], simdPath) || !ConeSegmentation::supported(simdPath)) {
+        std::cerr << argv[0] << ": The segmentation kernel must be a kernel this CPU supports: scalar, sse2, avx2, or neon." << std::endl;
+        return 1;
+    }
+
+    Evaluation evaluation;
+    if (commandlineArguments.count("cid") != 0) {
+        // Start the perception with --name and --cid of the benchmark while it waits.
+        std::thread producing([&producer]() {
+            std::this_thread::sleep_for(std::chrono::seconds(2));
+            producer.run();
+        });
+        runBinary(producer, static_cast<uint16_t>(std::stoi(commandlineArguments["cid"])), evaluation);
+        producing.join();
+    }
+    else {
+        // The processing stage is set up from the same options as in the microservice.
+        const ConeSegmentation segmentation{SegmentationParameters{}, commandlineArguments["simd"]};
+        ConeGeometry geometry;
+        geometry.fovy = pose.fovy;
+        const std::chrono::microseconds BUDGET{(commandlineArguments.count("budget") != 0) ? static_cast<int64_t>(std::stod(commandlineArguments["budget"]) * 1000.0) : 0};
+        const bool SHEDDING{(commandlineArguments.count("no-shedding") == 0) && (0.0f < RATE)};
+        const uint32_t PYRAMID_LEVELS{(commandlineArguments.count("pyramid") != 0) ? std::min(PyramidLayout::MAX_LEVELS, static_cast<uint32_t>(std::stoi(commandlineArguments["pyramid"]))) : 0};
+        const uint32_t SHED_PYRAMID_LEVELS{(commandlineArguments.count("shed-pyramid") != 0) ? std::min(PyramidLayout::MAX_LEVELS, static_cast<uint32_t>(std::stoi(commandlineArguments["shed-pyramid"]))) : 1};
+        const CoarseDetection COARSE_DETECTION{(0 < PYRAMID_LEVELS) ? CoarseDetection::ALWAYS : (((0 < SHED_PYRAMID_LEVELS) && SHEDDING) ? CoarseDetection::WHEN_SHEDDING : CoarseDetection::NEVER)};
+        const uint32_t COARSE_LEVELS{(0 < PYRAMID_LEVELS) ? PYRAMID_LEVELS : ((CoarseDetection::NEVER != COARSE_DETECTION) ? SHED_PYRAMID_LEVELS : 0)};
+
+        RoiParameters roiParameters;
+        roiParameters.follow = (commandlineArguments.count("roi-follow") != 0) || (commandlineArguments.count("detect-every") != 0);
+        roiParameters.fullScanInterval = (commandlineArguments.count("detect-every") != 0) ? static_cast<uint32_t>(std::max(1, std::stoi(commandlineArguments["detect-every"]))) : roiParameters.fullScanInterval;
+        if ( (commandlineArguments.count("roi-band") != 0) && !parseRoiBand(commandlineArguments["roi-band"], roiParameters) ) {
+            std::cerr << argv[0] << ": The ROI band must be given as 'from,to' in degrees or as none." << std::endl;
+            return 1;
+        }
+        RegionOfInterest regionOfInterest{roiParameters, pose};
+        Undistortion::Mode undistortionMode{Undistortion::Mode::POINTS};
+        if (!Undistortion::parseMode(commandlineArguments["undistort"], undistortionMode)) {
+            std::cerr << argv[0] << ": The lens correction must be one of points, roi, frame, or none." << std::endl;
+            return 1;
+        }
+        Undistortion undistortion{undistortionMode, cv::Rect()};
+        if ( (commandlineArguments.count("calibration") != 0) && !undistortion.load(commandlineArguments["calibration"]) ) {
+            std::cerr << argv[0] << ": Failed to read camera calibration from '" << commandlineArguments["calibration"] << "'." << std::endl;
+            return 1;
+        }
+
+        AsyncLog logger{argv[0], nullptr, std::chrono::milliseconds(100)};
+        logger.setLevel((commandlineArguments.count("verbose") != 0) ? LogLevel::INFO : LogLevel::NOTICE);
+        FrameBudget frameBudget{BUDGET, 0.4f, SHEDDING, COARSE_DETECTION};
+        StageTelemetry telemetry;
+        WorkStealingPool tilePool{TILE_THREADS, std::vector<int32_t>{}};
+        ProcessingStage processingStage{segmentation, geometry, pose, COARSE_LEVELS, std::string{}, regionOfInterest, undistortion, frameBudget, tilePool, telemetry, logger};
+        std::cout << "Processing in process with the " << segmentation.pathName() << " kernel";
+        if (1 < tilePool.size()) {
+            std::cout << ", " << processingStage.tiles() << " tiles per frame on " << tilePool.size() << " threads";
+        }
+        std::cout << "." << std::endl;
+
+        std::thread producing([&producer]() {
+            // Give the consumer a chance to wait before the first frame.
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            producer.run();
+        });
+        runInProcess(producer, NAME, processingStage, regionOfInterest, frameBudget, COARSE_LEVELS, telemetry, evaluation);
+        producing.join();
+    }
+    std::cout << evaluation.report() << std::endl;
+    return (0 < evaluation.frames()) ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYNTHETIC_CAMERA_HPP
+#define SYNTHETIC_CAMERA_HPP
+
+#include "cone-segmentation.hpp"
+#include "frame-ring.hpp"
+#include "ground-plane.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+ * A cone standing on flat ground, given in the vehicle frame like the
+ * results of the perception: x forward and y to the left of the point
+ * below the camera.
+ */
+struct SyntheticCone {
+    float x{0.0f};
+    float y{0.0f};
+    uint8_t label{CONE_NONE};
+    bool visible{false};  // Set by SyntheticCamera::render() if the whole cone is in the frame; nearer cones may still hide it.
+};
+
+/**
+ * SyntheticCamera renders cones as flat-shaded, tapered shapes in front of
+ * a grey ground and a lighter sky, seen by the same pinhole camera that
+ * GroundPlaneTable assumes. The colours are well inside the default
+ * SegmentationParameters, so every miss is caused by the geometry or the
+ * processing and not by the colour ranges.
+ *
+ * Frames are written as ARGB (B, G, R, A in memory) or I420 without any
+ * allocation; far cones are drawn first so that near ones hide them.
+ */
+class SyntheticCamera {
+   private:
+    SyntheticCamera(const SyntheticCamera &) = delete;
+    SyntheticCamera(SyntheticCamera &&)      = delete;
+    SyntheticCamera &operator=(const SyntheticCamera &) = delete;
+    SyntheticCamera &operator=(SyntheticCamera &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param pose Mounting of the camera.
+     * @param width Width of the frame; even for I420.
+     * @param height Height of the frame; even for I420.
+     * @param fourcc FOURCC_ARGB or FOURCC_I420.
+     * @param coneHeight Height of a cone in meters.
+     * @param coneWidth Width of a cone's base in meters.
+     */
+    SyntheticCamera(const CameraPose &pose, uint32_t width, uint32_t height, uint32_t fourcc, float coneHeight = 0.1f, float coneWidth = 0.07f) noexcept
+        : m_pose(pose)
+        , m_coneHeight(coneHeight)
+        , m_coneWidth(coneWidth)
+        , m_f(0.5 * height / std::tan(0.5 * pose.fovy * PI / 180.0))
+        , m_cx(0.5 * width - 0.5)
+        , m_cy(0.5 * height - 0.5)
+        , m_sinPitch(std::sin(pose.pitch * PI / 180.0))
+        , m_cosPitch(std::cos(pose.pitch * PI / 180.0)) {
+        m_info.fourcc = fourcc;
+        m_info.width = width;
+        m_info.height = height;
+        m_info.stride = (FOURCC_I420 == fourcc) ? width : width * 4;
+        m_info.size = (FOURCC_I420 == fourcc) ? width * height * 3 / 2 : width * height * 4;
+
+        m_colours[0] = colour(100, 100, 100);  // Ground.
+        m_colours[1] = colour(180, 180, 185);  // Sky.
+        m_colours[CONE_BLUE + 1] = colour(20, 40, 160);
+        m_colours[CONE_YELLOW + 1] = colour(230, 190, 20);
+    }
+
+    /**
+     * @return Description of the frames; frameNumber and sampleTimeStamp are left to the caller.
+     */
+    const FrameInfo &info() const noexcept {
+        return m_info;
+    }
+
+    /**
+     * This method projects a point given in the vehicle frame (z up from
+     * the ground) to pixel coordinates; pixel (0, 0) is centered at (0.0, 0.0).
+     *
+     * @return false if the point is not in front of the camera.
+     */
+    bool project(double x, double y, double z, double &col, double &row) const noexcept {
+        const double UP{z - m_pose.height};
+        const double DEPTH{x * m_cosPitch - UP * m_sinPitch};
+        if (DEPTH < 0.01) {
+            return false;
+        }
+        col = m_cx - m_f * y / DEPTH;
+        row = m_cy - m_f * (x * m_sinPitch + UP * m_cosPitch) / DEPTH;
+        return true;
+    }
+
+    /**
+     * This method renders a frame and marks the cones that are completely
+     * in view.
+     *
+     * @param cones Cones to draw; their visible flags are updated.
+     * @param dst Frame of info().size bytes.
+     */
+    void render(std::vector<SyntheticCone> &cones, char *dst) noexcept {
+        // Sky above the horizon, ground below.
+        const double HORIZON{m_cy - m_f * m_sinPitch / std::max(1e-6, m_cosPitch)};
+        const uint32_t GROUND_ROW{static_cast<uint32_t>(std::min<double>(m_info.height, std::max(0.0, std::ceil(HORIZON))))};
+        fillRows(dst, 0, GROUND_ROW, m_colours[1]);
+        fillRows(dst, GROUND_ROW, m_info.height, m_colours[0]);
+
+        m_order.resize(cones.size());
+        for (uint32_t i{0}; i < m_order.size(); i++) {
+            m_order[i] = i;
+        }
+        std::sort(m_order.begin(), m_order.end(), [&cones](uint32_t a, uint32_t b) {
+            return (cones[a].x * cones[a].x + cones[a].y * cones[a].y) > (cones[b].x * cones[b].x + cones[b].y * cones[b].y);
+        });
+
+        for (uint32_t i : m_order) {
+            SyntheticCone &cone{cones[i]};
+            cone.visible = false;
+            double col{0.0}, base{0.0}, top{0.0};
+            if ( (CONE_NONE == cone.label) || !project(cone.x, cone.y, 0.0, col, base) || !project(cone.x, cone.y, m_coneHeight, col, top) ) {
+                continue;
+            }
+            const double DEPTH{cone.x * m_cosPitch + m_pose.height * m_sinPitch};
+            const double HALF_WIDTH{0.5 * m_f * m_coneWidth / DEPTH};
+            const int64_t FIRST_ROW{std::lround(top)};
+            const int64_t LAST_ROW{std::lround(base)};
+            cone.visible = (0 <= FIRST_ROW) && (LAST_ROW < static_cast<int64_t>(m_info.height)) && (FIRST_ROW < LAST_ROW)
+                        && (0 <= std::lround(col - HALF_WIDTH)) && (std::lround(col + HALF_WIDTH) < static_cast<int64_t>(m_info.width));
+
+            // The cone tapers to 30% of its width at the top.
+            const Colour &c{m_colours[cone.label + 1]};
+            for (int64_t r{std::max<int64_t>(0, FIRST_ROW)}; r <= std::min<int64_t>(LAST_ROW, m_info.height - 1); r++) {
+                const double T{(LAST_ROW > FIRST_ROW) ? static_cast<double>(LAST_ROW - r) / static_cast<double>(LAST_ROW - FIRST_ROW) : 0.0};
+                const double HALF{std::max(0.5, HALF_WIDTH * (1.0 - 0.7 * T))};
+                const int64_t FROM{std::max<int64_t>(0, std::lround(col - HALF))};
+                const int64_t TO{std::min<int64_t>(static_cast<int64_t>(m_info.width) - 1, std::lround(col + HALF))};
+                if (FROM <= TO) {
+                    paintRow(dst, static_cast<uint32_t>(r), static_cast<uint32_t>(FROM), static_cast<uint32_t>(TO + 1), c);
+                }
+            }
+        }
+    }
+
+   private:
+    struct Colour {
+        uint8_t r, g, b;
+        uint8_t y, u, v;
+    };
+
+    static Colour colour(int32_t r, int32_t g, int32_t b) noexcept {
+        int32_t y{0}, u{0}, v{0};
+        coneSegmentation::rgbToYUV(r, g, b, y, u, v);
+        return Colour{static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b),
+                      static_cast<uint8_t>(y), static_cast<uint8_t>(u), static_cast<uint8_t>(v)};
+    }
+
+    void fillRows(char *dst, uint32_t from, uint32_t to, const Colour &c) const noexcept {
+        for (uint32_t r{from}; r < to; r++) {
+            paintRow(dst, r, 0, m_info.width, c);
+        }
+    }
+
+    // Paints the pixels [from, to) of a row; in I420, the chroma of every 2x2 block touched.
+    void paintRow(char *dst, uint32_t row, uint32_t from, uint32_t to, const Colour &c) const noexcept {
+        if (FOURCC_I420 == m_info.fourcc) {
+            const std::size_t LUMA{static_cast<std::size_t>(m_info.width) * m_info.height};
+            const std::size_t CHROMA{static_cast<std::size_t>(row / 2) * (m_info.width / 2)};
+            std::memset(dst + static_cast<std::size_t>(row) * m_info.stride + from, c.y, to - from);
+            std::memset(dst + LUMA + CHROMA + from / 2, c.u, (to + 1) / 2 - from / 2);
+            std::memset(dst + LUMA + LUMA / 4 + CHROMA + from / 2, c.v, (to + 1) / 2 - from / 2);
+        }
+        else {
+            uint8_t *p{reinterpret_cast<uint8_t*>(dst) + static_cast<std::size_t>(row) * m_info.stride + from * 4};
+            for (uint32_t x{from}; x < to; x++, p += 4) {
+                p[0] = c.b;
+                p[1] = c.g;
+                p[2] = c.r;
+                p[3] = 255;
+            }
+        }
+    }
+
+   private:
+    static constexpr double PI{3.14159265358979323846};
+
+    const CameraPose m_pose;
+    const double m_coneHeight;
+    const double m_coneWidth;
+    const double m_f;
+    const double m_cx;
+    const double m_cy;
+    const double m_sinPitch;
+    const double m_cosPitch;
+    FrameInfo m_info{};
+    Colour m_colours[4]{};
+    std::vector<uint32_t> m_order{};
+};
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "frame-ring.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// Payload written by the producer for every frame.
+struct Stamp {
+    uint32_t frame;
+    int64_t notifiedAt;
+};
+
+static int64_t now() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Result {
+    std::vector<int64_t> latencies{};
+    uint32_t missed{0};
+};
+
+// Producer and consumer use separate SharedMemory instances, just like two processes.
+static Result runSharedMemory(const std::string &name, double freq, uint32_t frames) {
+    Result result;
+    cluon::SharedMemory producer{name, sizeof(Stamp)};
+    cluon::SharedMemory consumer{name};
+    if (!producer.valid() || !consumer.valid()) {
+        std::cerr << "Failed to create shared memory '" << name << "'." << std::endl;
+        return result;
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<bool> finished{false};
+    std::thread consumerThread([&consumer, &result, &done, &finished, frames]() {
+        uint32_t lastFrame{0};
+        while (!done.load()) {
+            consumer.wait();
+            const int64_t WOKEN{now()};
+            Stamp s{0, 0};
+            consumer.lock();
+            std::memcpy(&s, consumer.data(), sizeof(Stamp));
+            consumer.unlock();
+            if ( (0 < s.frame) && (s.frame != lastFrame) && (s.frame <= frames) ) {
+                result.latencies.push_back(WOKEN - s.notifiedAt);
+                result.missed += s.frame - lastFrame - 1;
+                lastFrame = s.frame;
+            }
+        }
+        finished.store(true);
+    });
+
+    // Give the consumer a chance to enter wait() before the first frame.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const auto PERIOD{std::chrono::nanoseconds(static_cast<int64_t>(1e9 / freq))};
+    auto next{std::chrono::steady_clock::now()};
+    for (uint32_t i{1}; i <= frames + 1; i++) {
+        next += PERIOD;
+        std::this_thread::sleep_until(next);
+        if (i > frames) {
+            done.store(true);
+        }
+        producer.lock();
+        Stamp s{i, now()};
+        std::memcpy(producer.data(), &s, sizeof(Stamp));
+        producer.unlock();
+        producer.notifyAll();
+    }
+    // Keep notifying in case the consumer missed the final wakeup.
+    while (!finished.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        producer.notifyAll();
+    }
+    consumerThread.join();
+    return result;
+}
+
+static Result runFutex(const std::string &name, double freq, uint32_t frames) {
+    Result result;
+    cluon::SharedMemory producer{name, static_cast<uint32_t>(frameRingLayout::requiredSize(3, sizeof(Stamp)))};
+    FrameRingWriter writer{producer, 3};
+    cluon::SharedMemory consumer{name};
+    FrameRingReader reader{consumer};
+    if (!writer.valid() || !reader.valid()) {
+        std::cerr << "Failed to create frame ring '" << name << "'." << std::endl;
+        return result;
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<bool> finished{false};
+    std::thread consumerThread([&reader, &result, &done, &finished, frames]() {
+        uint32_t lastFrame{0};
+        while (!done.load()) {
+            reader.wait();
+            const int64_t WOKEN{now()};
+            Stamp s{0, 0};
+            FrameInfo info;
+            if ( (0 != reader.read(reinterpret_cast<char*>(&s), sizeof(Stamp), info)) && (0 < s.frame) && (s.frame != lastFrame) && (s.frame <= frames) ) {
+                result.latencies.push_back(WOKEN - s.notifiedAt);
+                result.missed += s.frame - lastFrame - 1;
+                lastFrame = s.frame;
+            }
+        }
+        finished.store(true);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const auto PERIOD{std::chrono::nanoseconds(static_cast<int64_t>(1e9 / freq))};
+    auto next{std::chrono::steady_clock::now()};
+    for (uint32_t i{1}; i <= frames + 1; i++) {
+        next += PERIOD;
+        std::this_thread::sleep_until(next);
+        if (i > frames) {
+            done.store(true);
+        }
+        char *p{writer.beginWrite()};
+        Stamp s{i, now()};
+        std::memcpy(p, &s, sizeof(Stamp));
+        FrameInfo info;
+        info.size = sizeof(Stamp);
+        writer.endWrite(info);
+    }
+    while (!finished.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        writer.beginWrite();
+        writer.endWrite(FrameInfo{});
+    }
+    consumerThread.join();
+    return result;
+}
+
+static void report(const std::string &implementation, double freq, Result &&r) {
+    std::cout << std::fixed << std::setprecision(1) << std::setw(6) << implementation << std::setw(6) << freq << " Hz: ";
+    if (r.latencies.empty()) {
+        std::cout << "no wakeups, " << r.missed << " missed" << std::endl;
+        return;
+    }
+    std::sort(r.latencies.begin(), r.latencies.end());
+    auto percentile = [&r](double p) {
+        return static_cast<double>(r.latencies[static_cast<std::size_t>(p * static_cast<double>(r.latencies.size() - 1))]) / 1000.0;
+    };
+    std::cout << "min = " << percentile(0.0) << " us, "
+              << "p50 = " << percentile(0.5) << " us, "
+              << "p99 = " << percentile(0.99) << " us, "
+              << "max = " << percentile(1.0) << " us, "
+              << "missed = " << r.missed << " of " << (r.latencies.size() + r.missed) << std::endl;
+}
+
+int32_t main(int32_t argc, char **argv) {
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    const uint32_t FRAMES{(commandlineArguments.count("frames") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["frames"])) : 200};
+    std::vector<double> rates{20.0, 40.0, 60.0};
+    if (commandlineArguments.count("freq") != 0) {
+        rates.clear();
+        std::stringstream sstr{commandlineArguments["freq"]};
+        std::string rate;
+        while (std::getline(sstr, rate, ',')) {
+            rates.push_back(std::stod(rate));
+        }
+    }
+
+    std::cout << argv[0] << ": Measuring wakeup latency from notify to a woken consumer, " << FRAMES << " frames per rate." << std::endl;
+    for (double freq : rates) {
+        // cluon::SharedMemory selects its implementation when being constructed.
+        ::setenv("CLUON_SHAREDMEMORY_POSIX", "0", 1);
+        report("SysV", freq, runSharedMemory("wakeup-benchmark-sysv", freq, FRAMES));
+        ::setenv("CLUON_SHAREDMEMORY_POSIX", "1", 1);
+        report("POSIX", freq, runSharedMemory("wakeup-benchmark-posix", freq, FRAMES));
+        report("futex", freq, runFutex("wakeup-benchmark-futex", freq, FRAMES));
+    }
+    return 0;
+}
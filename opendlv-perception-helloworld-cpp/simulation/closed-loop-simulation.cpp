@@ -0,0 +1,489 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+
+#include "allocation-counter.hpp"
+#include "async-log.hpp"
+#include "cone-blobs.hpp"
+#include "cone-controller.hpp"
+#include "cone-segmentation.hpp"
+#include "cone-track.hpp"
+#include "frame-budget.hpp"
+#include "frame-buffer-pool.hpp"
+#include "frame-pyramid.hpp"
+#include "ground-plane.hpp"
+#include "kiwi-model.hpp"
+#include "processing-stage.hpp"
+#include "region-of-interest.hpp"
+#include "stage-telemetry.hpp"
+#include "synthetic-camera.hpp"
+#include "undistortion.hpp"
+#include "work-stealing-pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Perception hands the rendered frames to the processing stage of the
+ * microservice as its acquisition stage does: only the region of interest
+ * is copied, together with a pyramid when cones are detected on one, and
+ * frames that load shedding leaves out are not processed.
+ */
+class Perception {
+   private:
+    Perception(const Perception &) = delete;
+    Perception(Perception &&)      = delete;
+    Perception &operator=(const Perception &) = delete;
+    Perception &operator=(Perception &&) = delete;
+
+   public:
+    Perception(ProcessingStage &processingStage, RegionOfInterest &regionOfInterest, FrameBudget &frameBudget, uint32_t coarseLevels, const FrameInfo &info) noexcept
+        : m_processingStage(processingStage)
+        , m_regionOfInterest(regionOfInterest)
+        , m_frameBudget(frameBudget)
+        , m_coarseLevels(coarseLevels)
+        , m_framePool{1, info.size}
+        , m_labelPool{1, static_cast<std::size_t>(info.width) * info.height}
+        , m_pyramidPool{(0 < coarseLevels) ? 1u : 0u, pyramidCapacity(info.size)} {}
+
+    /**
+     * @param frame Rendered frame as described by info.
+     * @return false if load shedding left out the frame.
+     */
+    bool process(const char *frame, const FrameInfo &info, ConeDetections &cones) noexcept {
+        if (m_frameBudget.skip(info.frameNumber)) {
+            return false;
+        }
+        AcquiredFrame acquired{m_framePool.acquire(), info, m_regionOfInterest.region()};
+        if ( (0 < m_coarseLevels) && m_frameBudget.shedding().coarseDetection ) {
+            acquired.pyramid = m_pyramidPool.acquire();
+            copyFrameRegionWithPyramid(acquired.buffer.get(), acquired.pyramid.get(), frame, pyramidLayout(info, m_coarseLevels), acquired.region, acquired.pyramidTimings);
+        }
+        else {
+            copyFrameRegion(acquired.buffer.get(), frame, info, acquired.region);
+        }
+        ProcessedFrame processed{std::move(acquired.buffer), m_labelPool.acquire(), info};
+        m_processingStage.process(acquired, processed);
+        cones = processed.cones;
+        return true;
+    }
+
+   private:
+    ProcessingStage &m_processingStage;
+    RegionOfInterest &m_regionOfInterest;
+    FrameBudget &m_frameBudget;
+    const uint32_t m_coarseLevels;
+    FrameBufferPool m_framePool;
+    FrameBufferPool m_labelPool;
+    FrameBufferPool m_pyramidPool;
+};
+
+struct SimulationParameters {
+    uint32_t laps{10};
+    double maxTime{0.0};              // Seconds of simulated time; 0 for 120 s per lap.
+    double physicsRate{200.0};        // Hz.
+    double cameraRate{7.5};           // Hz.
+    double controlRate{50.0};         // Hz.
+    double perceptionLatency{0.05};   // Seconds from a frame's sample time until the controller sees its cones.
+    double frontRate{10.0};           // Hz; 0 for no front distance readings.
+    double frontRange{2.0};           // Meters; farthest front distance reading.
+    double cameraX{0.0};              // Meters forward of the rear axle.
+    uint32_t seed{0};                 // 0 starts on the centerline; otherwise, slightly off it.
+    bool verbose{false};
+};
+
+struct SimulationResult {
+    std::vector<double> lapTimes{};
+    uint32_t cleanLaps{0};
+    uint32_t offTrack{0};
+    uint32_t coneHits{0};
+    uint32_t stuck{0};
+    uint64_t frames{0};
+    uint64_t shedFrames{0};
+    uint64_t stops{0};
+    double simulatedTime{0.0};
+    double lateralSum{0.0};
+    double lateralMax{0.0};
+    uint64_t steps{0};
+};
+
+/**
+ * This function simulates the front distance sensor above the front axle:
+ * it measures the distance to the closest cone within about 15 degrees of
+ * the heading, or its range if there is none.
+ */
+static float frontDistance(const ConeTrack &track, const KiwiState &state, double wheelbase, double range) noexcept {
+    const double HALF_ANGLE{0.26};
+    const double SENSOR_X{state.x + std::cos(state.yaw) * wheelbase};
+    const double SENSOR_Y{state.y + std::sin(state.yaw) * wheelbase};
+    double closest{range};
+    for (const TrackCone &c : track.cones()) {
+        const double DX{c.x - SENSOR_X};
+        const double DY{c.y - SENSOR_Y};
+        const double FORWARD{std::cos(state.yaw) * DX + std::sin(state.yaw) * DY};
+        const double LEFT{-std::sin(state.yaw) * DX + std::cos(state.yaw) * DY};
+        if ( (0.0 < FORWARD) && (std::fabs(LEFT) < FORWARD * std::tan(HALF_ANGLE)) ) {
+            closest = std::min(closest, std::hypot(DX, DY));
+        }
+    }
+    return static_cast<float>(closest);
+}
+
+/**
+ * This function drives laps on a virtual clock in microseconds. Physics,
+ * camera, front distance sensor and controller are stepped in lockstep at
+ * their own rates; the cones of a frame reach the controller after the
+ * perception latency. The controller takes the same step as the control
+ * loop of the microservice, with the sample times of the cones and of the
+ * front distance reading. There are no threads involved, and load is only
+ * shed, depending on the wall clock, when a budget is given; hence, a run
+ * without one is repeatable.
+ */
+static SimulationResult simulate(const ConeTrack &track, SyntheticCamera &camera, Perception &perception, ConeController &controller,
+                                 KiwiModel &kiwi, const SimulationParameters &parameters) {
+    struct PendingCones {
+        int64_t availableAt;
+        int64_t sampleTime;
+        ConeDetections cones;
+    };
+
+    // Sample times of 0 mean that nothing was received; the virtual clock
+    // starts at 0, so sample times are taken a second later.
+    const int64_t EPOCH{1000000};
+
+    SimulationResult result;
+    const int64_t DT{std::llround(1e6 / parameters.physicsRate)};
+    const int64_t CAMERA_PERIOD{std::llround(1e6 / parameters.cameraRate)};
+    const int64_t CONTROL_PERIOD{std::llround(1e6 / parameters.controlRate)};
+    const int64_t FRONT_PERIOD{(0.0 < parameters.frontRate) ? std::llround(1e6 / parameters.frontRate) : 0};
+    const int64_t LATENCY{std::llround(1e6 * parameters.perceptionLatency)};
+    const int64_t MAX_TIME{std::llround(1e6 * ((0.0 < parameters.maxTime) ? parameters.maxTime : 120.0 * parameters.laps))};
+    const double HALF_WIDTH{track.halfWidth()};
+
+    FrameBufferPool frames{1, camera.info().size};
+    FrameBufferPool::Handle frame{frames.acquire()};
+    FrameInfo info{camera.info()};
+    std::vector<SyntheticCone> visible;
+    std::deque<PendingCones> pending;
+    ConeDetections latest;
+    int64_t latestTime{0};
+    float front{0.0f};
+    int64_t frontTime{0};
+    ActuationRequest request;
+    std::vector<uint32_t> lastHitLap(track.cones().size(), UINT32_MAX);
+
+    // Start on the centerline, or a little off it for a seeded run.
+    auto restart = [&](double s, double offset, double heading) {
+        KiwiState state;
+        double yaw{0.0};
+        track.pose(s, state.x, state.y, yaw);
+        state.x -= std::sin(yaw) * offset;
+        state.y += std::cos(yaw) * offset;
+        state.yaw = yaw + heading;
+        kiwi.reset(state);
+    };
+    std::mt19937 random{parameters.seed};
+    std::uniform_real_distribution<double> uniform{-1.0, 1.0};
+    if (0 == parameters.seed) {
+        restart(0.0, 0.0, 0.0);
+    }
+    else {
+        const double OFFSET{0.2 * HALF_WIDTH * uniform(random)};
+        restart(0.0, OFFSET, 0.1 * uniform(random));
+    }
+
+    double s{0.0};
+    double progress{0.0};
+    double progressMark{0.0};
+    int64_t progressMarkTime{0};
+    int64_t lapStart{0};
+    bool lapClean{true};
+    int64_t nextFrame{0};
+    int64_t nextFront{0};
+    int64_t nextControl{0};
+    int64_t t{0};
+    for (; (t < MAX_TIME) && (result.lapTimes.size() < parameters.laps); t += DT) {
+        const KiwiState &state{kiwi.state()};
+
+        // Render what the camera sees and run the perception on it.
+        if (t >= nextFrame) {
+            const double CAMERA_X{state.x + std::cos(state.yaw) * parameters.cameraX};
+            const double CAMERA_Y{state.y + std::sin(state.yaw) * parameters.cameraX};
+            const double COS{std::cos(state.yaw)};
+            const double SIN{std::sin(state.yaw)};
+            visible.clear();
+            for (const TrackCone &c : track.cones()) {
+                const double DX{c.x - CAMERA_X};
+                const double DY{c.y - CAMERA_Y};
+                SyntheticCone cone;
+                cone.x = static_cast<float>(COS * DX + SIN * DY);
+                cone.y = static_cast<float>(-SIN * DX + COS * DY);
+                cone.label = c.label;
+                if ( (0.05f < cone.x) && (cone.x < 6.0f) ) {
+                    visible.push_back(cone);
+                }
+            }
+            camera.render(visible, frame.get());
+            info.frameNumber++;
+            info.sampleTimeStamp = EPOCH + t;
+            PendingCones p{t + LATENCY, info.sampleTimeStamp, ConeDetections{}};
+            if (perception.process(frame.get(), info, p.cones)) {
+                pending.push_back(p);
+                result.frames++;
+            }
+            else {
+                result.shedFrames++;
+            }
+            nextFrame += CAMERA_PERIOD;
+        }
+        while (!pending.empty() && (pending.front().availableAt <= t)) {
+            latest = pending.front().cones;
+            latestTime = pending.front().sampleTime;
+            pending.pop_front();
+        }
+        if ( (0 < FRONT_PERIOD) && (t >= nextFront) ) {
+            front = frontDistance(track, state, controller.parameters().wheelbase, parameters.frontRange);
+            frontTime = EPOCH + t;
+            nextFront += FRONT_PERIOD;
+        }
+
+        if (t >= nextControl) {
+            // Count when the front distance makes a driving Kiwi stop.
+            const bool DRIVING{0.0f < request.pedalPosition};
+            request = controller.step(latest, latestTime, front, frontTime, EPOCH + t);
+            if (DRIVING && !request.frontUnknown && (0.0f < front) && (front < controller.parameters().stopDistance)) {
+                result.stops++;
+                if (parameters.verbose) {
+                    std::cout << std::fixed << std::setprecision(2) << "t = " << static_cast<double>(t) * 1e-6 << " s: stopped " << front << " m in front of a cone." << std::endl;
+                }
+            }
+            nextControl += CONTROL_PERIOD;
+        }
+        kiwi.step(static_cast<double>(DT) * 1e-6, request.groundSteering, request.pedalPosition);
+        result.steps++;
+
+        // Follow the progress along the lane; laps end when passing the start.
+        const double PREVIOUS{s};
+        const double LATERAL{track.locate(kiwi.state().x, kiwi.state().y, s)};
+        double ds{s - PREVIOUS};
+        if (ds < -0.5 * track.length()) {
+            ds += track.length();
+        }
+        else if (ds > 0.5 * track.length()) {
+            ds -= track.length();
+        }
+        progress += ds;
+        result.lateralSum += std::fabs(LATERAL);
+        result.lateralMax = std::max(result.lateralMax, std::fabs(LATERAL));
+
+        // The body is about 0.15 m wide; a cone is hit if it comes closer than that to its center.
+        const uint32_t LAP{static_cast<uint32_t>(result.lapTimes.size())};
+        const double BODY_X{kiwi.state().x + 0.5 * std::cos(kiwi.state().yaw) * controller.parameters().wheelbase};
+        const double BODY_Y{kiwi.state().y + 0.5 * std::sin(kiwi.state().yaw) * controller.parameters().wheelbase};
+        for (std::size_t i{0}; i < track.cones().size(); i++) {
+            const TrackCone &c{track.cones()[i]};
+            if ( (LAP != lastHitLap[i]) && (std::hypot(c.x - BODY_X, c.y - BODY_Y) < 0.1) ) {
+                lastHitLap[i] = LAP;
+                result.coneHits++;
+                lapClean = false;
+                if (parameters.verbose) {
+                    std::cout << std::fixed << std::setprecision(2) << "t = " << static_cast<double>(t) * 1e-6 << " s: hit cone at s = " << c.s << " m." << std::endl;
+                }
+            }
+        }
+
+        if (progress >= static_cast<double>(LAP + 1) * track.length()) {
+            const double LAP_TIME{static_cast<double>(t - lapStart) * 1e-6};
+            result.lapTimes.push_back(LAP_TIME);
+            result.cleanLaps += lapClean ? 1 : 0;
+            if (parameters.verbose) {
+                std::cout << std::fixed << std::setprecision(2) << "Lap " << result.lapTimes.size() << ": " << LAP_TIME << " s" << (lapClean ? "" : ", not clean") << "." << std::endl;
+            }
+            lapStart = t;
+            lapClean = true;
+        }
+
+        // Put the vehicle back on the lane when it left it or got stuck.
+        if (std::fabs(LATERAL) > HALF_WIDTH) {
+            result.offTrack++;
+            lapClean = false;
+            if (parameters.verbose) {
+                std::cout << std::fixed << std::setprecision(2) << "t = " << static_cast<double>(t) * 1e-6 << " s: off track at s = " << s << " m." << std::endl;
+            }
+            restart(s, 0.0, 0.0);
+        }
+        if (progress > progressMark + 0.05) {
+            progressMark = progress;
+            progressMarkTime = t;
+        }
+        else if (t - progressMarkTime > 5000000) {
+            result.stuck++;
+            lapClean = false;
+            if (parameters.verbose) {
+                std::cout << std::fixed << std::setprecision(2) << "t = " << static_cast<double>(t) * 1e-6 << " s: stuck at s = " << s << " m." << std::endl;
+            }
+            restart(s + 0.5, 0.0, 0.0);
+            progressMarkTime = t;
+        }
+    }
+    result.simulatedTime = static_cast<double>(t) * 1e-6;
+    return result;
+}
+
+int32_t main(int32_t argc, char **argv) {
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if (commandlineArguments.count("help") != 0) {
+        std::cerr << argv[0] << " drives Kiwi around a lane of cones with the perception and the controller in the loop, on a virtual clock as fast as the CPU allows." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " [--laps=<n>] [--track=<file>] [--track-width=<m>] [--cone-spacing=<m>] [--max-time=<s>] [--seed=<n>] [--physics-rate=<Hz>] [--camera-rate=<Hz>] [--control-rate=<Hz>] [--perception-latency=<ms>] [--front-rate=<Hz>] [--front-range=<m>] [--width=<width> --height=<height>] [--format=<argb|i420>] [--simd=<kernel>] [--budget=<ms>] [--no-shedding] [--pyramid=<levels>] [--shed-pyramid=<levels>] [--roi-band=<from,to>] [--roi-follow] [--detect-every=<n>] [--fovy=<deg>] [--camera-height=<m>] [--camera-pitch=<deg>] [--camera-x=<m>] [--lookahead=<m>] [--steering-gain=<k>] [--pedal=<p>] [--min-pedal=<p>] [--stop-distance=<m>] [--control-timeout=<ms>] [--verbose]" << std::endl;
+        std::cerr << "         --track:  centerline of a closed lane as one \"x y\" pair in meters per line (default: oval of 4 m straights and 1.5 m radius)" << std::endl;
+        std::cerr << "         --seed:   start slightly off the centerline as drawn from this seed (default: 0, on the centerline)" << std::endl;
+        std::cerr << "         --perception-latency: time from a frame's sample time until the controller gets its cones (default: 50)" << std::endl;
+        std::cerr << "         --front-rate: front distance readings per second, i.e., the distance to the closest cone ahead; 0 simulates a missing sensor, which keeps Kiwi standing (default: 10)" << std::endl;
+        std::cerr << "         --front-range: front distance reading without a cone ahead in m (default: 2)" << std::endl;
+        std::cerr << "         --budget: processing time per frame in ms before shedding load as in the microservice; runs then depend on the speed of the CPU (default: no load shedding)" << std::endl;
+        std::cerr << "         --verbose: print every lap, cone hit and departure from the lane" << std::endl;
+        std::cerr << "Example: " << argv[0] << " --laps=1000 --camera-rate=7.5 --control-rate=50 --lookahead=0.8" << std::endl;
+        return 1;
+    }
+
+    SimulationParameters parameters;
+    parameters.laps = (commandlineArguments.count("laps") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["laps"])) : parameters.laps;
+    parameters.maxTime = (commandlineArguments.count("max-time") != 0) ? std::stod(commandlineArguments["max-time"]) : parameters.maxTime;
+    parameters.physicsRate = (commandlineArguments.count("physics-rate") != 0) ? std::stod(commandlineArguments["physics-rate"]) : parameters.physicsRate;
+    parameters.cameraRate = (commandlineArguments.count("camera-rate") != 0) ? std::stod(commandlineArguments["camera-rate"]) : parameters.cameraRate;
+    parameters.controlRate = (commandlineArguments.count("control-rate") != 0) ? std::stod(commandlineArguments["control-rate"]) : parameters.controlRate;
+    parameters.perceptionLatency = (commandlineArguments.count("perception-latency") != 0) ? std::stod(commandlineArguments["perception-latency"]) * 1e-3 : parameters.perceptionLatency;
+    parameters.frontRate = (commandlineArguments.count("front-rate") != 0) ? std::stod(commandlineArguments["front-rate"]) : parameters.frontRate;
+    parameters.frontRange = (commandlineArguments.count("front-range") != 0) ? std::stod(commandlineArguments["front-range"]) : parameters.frontRange;
+    parameters.cameraX = (commandlineArguments.count("camera-x") != 0) ? std::stod(commandlineArguments["camera-x"]) : parameters.cameraX;
+    parameters.seed = (commandlineArguments.count("seed") != 0) ? static_cast<uint32_t>(std::stoul(commandlineArguments["seed"])) : parameters.seed;
+    parameters.verbose = (commandlineArguments.count("verbose") != 0);
+
+    std::vector<ConeTrack::Point> centerline{ConeTrack::oval(4.0, 1.5)};
+    if ( (commandlineArguments.count("track") != 0) && !ConeTrack::load(commandlineArguments["track"], centerline) ) {
+        std::cerr << argv[0] << ": Failed to read a centerline from '" << commandlineArguments["track"] << "'." << std::endl;
+        return 1;
+    }
+    const double TRACK_WIDTH{(commandlineArguments.count("track-width") != 0) ? std::stod(commandlineArguments["track-width"]) : 1.2};
+    const double CONE_SPACING{(commandlineArguments.count("cone-spacing") != 0) ? std::stod(commandlineArguments["cone-spacing"]) : 0.5};
+    const ConeTrack track{centerline, 0.5 * TRACK_WIDTH, CONE_SPACING};
+
+    const uint32_t WIDTH{(commandlineArguments.count("width") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["width"])) & ~1u : 640};
+    const uint32_t HEIGHT{(commandlineArguments.count("height") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["height"])) & ~1u : 480};
+    const uint32_t FOURCC{("argb" == commandlineArguments["format"]) ? FOURCC_ARGB : FOURCC_I420};
+    CameraPose pose;
+    pose.fovy = (commandlineArguments.count("fovy") != 0) ? std::stof(commandlineArguments["fovy"]) : pose.fovy;
+    pose.height = (commandlineArguments.count("camera-height") != 0) ? std::stof(commandlineArguments["camera-height"]) : pose.height;
+    pose.pitch = (commandlineArguments.count("camera-pitch") != 0) ? std::stof(commandlineArguments["camera-pitch"]) : pose.pitch;
+
+    ControllerParameters controllerParameters;
+    controllerParameters.lookahead = (commandlineArguments.count("lookahead") != 0) ? std::stof(commandlineArguments["lookahead"]) : controllerParameters.lookahead;
+    controllerParameters.steeringGain = (commandlineArguments.count("steering-gain") != 0) ? std::stof(commandlineArguments["steering-gain"]) : controllerParameters.steeringGain;
+    controllerParameters.pedal = (commandlineArguments.count("pedal") != 0) ? std::stof(commandlineArguments["pedal"]) : controllerParameters.pedal;
+    controllerParameters.minPedal = (commandlineArguments.count("min-pedal") != 0) ? std::stof(commandlineArguments["min-pedal"]) : controllerParameters.minPedal;
+    controllerParameters.stopDistance = (commandlineArguments.count("stop-distance") != 0) ? std::stof(commandlineArguments["stop-distance"]) : controllerParameters.stopDistance;
+    controllerParameters.timeout = (commandlineArguments.count("control-timeout") != 0) ? std::stof(commandlineArguments["control-timeout"]) / 1000.0f : controllerParameters.timeout;
+    controllerParameters.halfLaneWidth = static_cast<float>(0.5 * TRACK_WIDTH);
+
+    // The processing stage is set up from the same options as in the microservice.
+    const std::chrono::microseconds BUDGET{(commandlineArguments.count("budget") != 0) ? static_cast<int64_t>(std::stod(commandlineArguments["budget"]) * 1000.0) : 0};
+    // Load shedding follows the wall clock; only with an explicit budget may
+    // the result of a run depend on the speed of the CPU.
+    const bool SHEDDING{(commandlineArguments.count("budget") != 0) && (commandlineArguments.count("no-shedding") == 0)};
+    const uint32_t PYRAMID_LEVELS{(commandlineArguments.count("pyramid") != 0) ? std::min(PyramidLayout::MAX_LEVELS, static_cast<uint32_t>(std::stoi(commandlineArguments["pyramid"]))) : 0};
+    const uint32_t SHED_PYRAMID_LEVELS{(commandlineArguments.count("shed-pyramid") != 0) ? std::min(PyramidLayout::MAX_LEVELS, static_cast<uint32_t>(std::stoi(commandlineArguments["shed-pyramid"]))) : 1};
+    const CoarseDetection COARSE_DETECTION{(0 < PYRAMID_LEVELS) ? CoarseDetection::ALWAYS : (((0 < SHED_PYRAMID_LEVELS) && SHEDDING) ? CoarseDetection::WHEN_SHEDDING : CoarseDetection::NEVER)};
+    const uint32_t COARSE_LEVELS{(0 < PYRAMID_LEVELS) ? PYRAMID_LEVELS : ((CoarseDetection::NEVER != COARSE_DETECTION) ? SHED_PYRAMID_LEVELS : 0)};
+    RoiParameters roiParameters;
+    roiParameters.follow = (commandlineArguments.count("roi-follow") != 0) || (commandlineArguments.count("detect-every") != 0);
+    roiParameters.fullScanInterval = (commandlineArguments.count("detect-every") != 0) ? static_cast<uint32_t>(std::max(1, std::stoi(commandlineArguments["detect-every"]))) : roiParameters.fullScanInterval;
+    if ( (commandlineArguments.count("roi-band") != 0) && !parseRoiBand(commandlineArguments["roi-band"], roiParameters) ) {
+        std::cerr << argv[0] << ": The ROI band must be given as 'from,to' in degrees or as none." << std::endl;
+        return 1;
+    }
+
+    if (!track.valid() || (0.0 >= parameters.physicsRate) || (0.0 >= parameters.cameraRate) || (0.0 >= parameters.controlRate) || (0.0 > parameters.frontRate)) {
+        std::cerr << argv[0] << ": Invalid track or rates." << std::endl;
+        return 1;
+    }
+    ConeSegmentation::Path simdPath{ConeSegmentation::Path::SCALAR};
+    if (!ConeSegmentation::parsePath(commandlineArguments["simd"], simdPath) || !ConeSegmentation::supported(simdPath)) {
+        std::cerr << argv[0] << ": The segmentation kernel must be a kernel this CPU supports: scalar, sse2, avx2, or neon." << std::endl;
+        return 1;
+    }
+
+    SyntheticCamera camera{pose, WIDTH, HEIGHT, FOURCC};
+    const ConeSegmentation segmentation{SegmentationParameters{}, commandlineArguments["simd"]};
+    ConeGeometry geometry;
+    geometry.fovy = pose.fovy;
+    RegionOfInterest regionOfInterest{roiParameters, pose};
+    Undistortion undistortion{Undistortion::Mode::NONE, cv::Rect()};
+    AsyncLog logger{argv[0], nullptr, std::chrono::milliseconds(100)};
+    logger.setLevel(parameters.verbose ? LogLevel::INFO : LogLevel::WARNING);
+    FrameBudget frameBudget{BUDGET, 0.4f, SHEDDING, COARSE_DETECTION};
+    StageTelemetry telemetry;
+    WorkStealingPool tilePool{0, std::vector<int32_t>{}};
+    ProcessingStage processingStage{segmentation, geometry, pose, COARSE_LEVELS, std::string{}, regionOfInterest, undistortion, frameBudget, tilePool, telemetry, logger};
+    Perception perception{processingStage, regionOfInterest, frameBudget, COARSE_LEVELS, camera.info()};
+    ConeController controller{controllerParameters};
+    KiwiParameters kiwiParameters;
+    kiwiParameters.wheelbase = static_cast<double>(controllerParameters.wheelbase);
+    KiwiModel kiwi{kiwiParameters};
+
+    std::cout << argv[0] << ": " << parameters.laps << " laps of " << std::fixed << std::setprecision(1) << track.length() << " m with "
+              << track.cones().size() << " cones; camera " << WIDTH << "x" << HEIGHT << " at " << parameters.cameraRate << " Hz, control at "
+              << parameters.controlRate << " Hz, perception latency " << parameters.perceptionLatency * 1e3 << " ms." << std::endl;
+
+    const auto START{std::chrono::steady_clock::now()};
+    SimulationResult result{simulate(track, camera, perception, controller, kiwi, parameters)};
+    const double SECONDS{std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - START).count() * 1e-6};
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "Simulated " << result.simulatedTime << " s in " << SECONDS << " s (" << std::setprecision(1) << result.simulatedTime / std::max(1e-6, SECONDS)
+              << "x real time, " << static_cast<double>(result.frames) / std::max(1e-6, SECONDS) << " frames/s, " << result.shedFrames << " frames shed)." << std::endl;
+    if (parameters.verbose) {
+        std::cout << frameBudget.report() << std::endl << telemetry.snapshot() << std::endl;
+        if (countsHeapAllocations()) {
+            std::cout << processingStage.allocations() << " heap allocations in " << processingStage.allocationFrames() << " frames; frame arena of "
+                      << processingStage.arenaHighWater() << " bytes." << std::endl;
+        }
+    }
+    std::cout << std::setprecision(2) << "Laps " << result.lapTimes.size() << " of " << parameters.laps << ", clean " << result.cleanLaps;
+    if (!result.lapTimes.empty()) {
+        double sum{0.0};
+        for (double lapTime : result.lapTimes) {
+            sum += lapTime;
+        }
+        std::cout << ", lap time mean/min/max " << sum / static_cast<double>(result.lapTimes.size())
+                  << "/" << *std::min_element(result.lapTimes.begin(), result.lapTimes.end())
+                  << "/" << *std::max_element(result.lapTimes.begin(), result.lapTimes.end()) << " s";
+    }
+    std::cout << ", off track " << result.offTrack << ", cone hits " << result.coneHits << ", stops " << result.stops << ", stuck " << result.stuck
+              << std::setprecision(3) << ", lateral offset mean/max " << result.lateralSum / static_cast<double>(std::max<uint64_t>(1, result.steps))
+              << "/" << result.lateralMax << " m." << std::endl;
+    return (result.lapTimes.size() == parameters.laps) ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONE_TRACK_HPP
+#define CONE_TRACK_HPP
+
+#include "cone-segmentation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * A cone in the world frame; s is the arc length along the centerline
+ * where it was placed.
+ */
+struct TrackCone {
+    double x{0.0};
+    double y{0.0};
+    double s{0.0};
+    uint8_t label{CONE_NONE};
+};
+
+/**
+ * ConeTrack is a closed lane given by its centerline, with blue cones on
+ * the left and yellow cones on the right placed at a fixed spacing. It
+ * locates the vehicle on the lane as arc length and lateral offset so that
+ * laps and departures from the lane can be counted.
+ *
+ * The centerline is resampled to a few centimeters between points.
+ */
+class ConeTrack {
+   public:
+    struct Point {
+        double x;
+        double y;
+    };
+
+    static constexpr double RESOLUTION{0.05};
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param centerline Points of the closed centerline in driving direction; the first point is the start.
+     * @param halfWidth Meters from the centerline to the cones.
+     * @param spacing Meters between cones along the centerline.
+     */
+    ConeTrack(const std::vector<Point> &centerline, double halfWidth, double spacing) noexcept
+        : m_halfWidth(halfWidth) {
+        if (3 > centerline.size()) {
+            return;
+        }
+        std::vector<double> s{0.0};
+        for (std::size_t i{1}; i <= centerline.size(); i++) {
+            const Point &a{centerline[i - 1]};
+            const Point &b{centerline[i % centerline.size()]};
+            s.push_back(s.back() + std::hypot(b.x - a.x, b.y - a.y));
+        }
+        m_length = s.back();
+        std::size_t k{0};
+        for (double d{0.0}; d < m_length; d += RESOLUTION) {
+            while ( (k + 2 < s.size()) && (s[k + 1] <= d) ) {
+                k++;
+            }
+            const Point &a{centerline[k % centerline.size()]};
+            const Point &b{centerline[(k + 1) % centerline.size()]};
+            const double T{(s[k + 1] > s[k]) ? (d - s[k]) / (s[k + 1] - s[k]) : 0.0};
+            m_points.push_back(Point{a.x + T * (b.x - a.x), a.y + T * (b.y - a.y)});
+        }
+
+        for (double d{0.0}; d < m_length - 0.5 * spacing; d += spacing) {
+            const std::size_t I{static_cast<std::size_t>(d / RESOLUTION) % m_points.size()};
+            const double HEADING{heading(I)};
+            const Point &p{m_points[I]};
+            m_cones.push_back(TrackCone{p.x - std::sin(HEADING) * halfWidth, p.y + std::cos(HEADING) * halfWidth, d, CONE_BLUE});
+            m_cones.push_back(TrackCone{p.x + std::sin(HEADING) * halfWidth, p.y - std::cos(HEADING) * halfWidth, d, CONE_YELLOW});
+        }
+    }
+
+    /**
+     * This method makes an oval of two straights joined by half circles.
+     */
+    static std::vector<Point> oval(double straight, double radius) noexcept {
+        std::vector<Point> points;
+        const double STEP{RESOLUTION};
+        for (double d{0.0}; d < straight; d += STEP) {
+            points.push_back(Point{d, -radius});
+        }
+        for (double a{0.0}; a < M_PI; a += STEP / radius) {
+            points.push_back(Point{straight + radius * std::sin(a), -radius * std::cos(a)});
+        }
+        for (double d{straight}; d > 0.0; d -= STEP) {
+            points.push_back(Point{d, radius});
+        }
+        for (double a{0.0}; a < M_PI; a += STEP / radius) {
+            points.push_back(Point{-radius * std::sin(a), radius * std::cos(a)});
+        }
+        return points;
+    }
+
+    /**
+     * This method reads a centerline as one "x y" pair in meters per line;
+     * empty lines and lines starting with # are skipped.
+     *
+     * @return false if the file could not be read or has fewer than three points.
+     */
+    static bool load(const std::string &filename, std::vector<Point> &centerline) noexcept {
+        std::ifstream in(filename);
+        std::string line;
+        centerline.clear();
+        while (std::getline(in, line)) {
+            if (line.empty() || ('#' == line[0])) {
+                continue;
+            }
+            std::replace(line.begin(), line.end(), ',', ' ');
+            std::stringstream sstr{line};
+            Point p{0.0, 0.0};
+            if (sstr >> p.x >> p.y) {
+                centerline.push_back(p);
+            }
+        }
+        return (3 <= centerline.size());
+    }
+
+    bool valid() const noexcept {
+        return !m_points.empty();
+    }
+
+    double length() const noexcept {
+        return m_length;
+    }
+
+    double halfWidth() const noexcept {
+        return m_halfWidth;
+    }
+
+    const std::vector<TrackCone> &cones() const noexcept {
+        return m_cones;
+    }
+
+    /**
+     * @return Position and heading of the centerline at arc length s.
+     */
+    void pose(double s, double &x, double &y, double &yaw) const noexcept {
+        const std::size_t I{index(s)};
+        x = m_points[I].x;
+        y = m_points[I].y;
+        yaw = heading(I);
+    }
+
+    /**
+     * This method finds the point of the centerline closest to (x, y),
+     * searching near a hint first as the vehicle moves only a little between
+     * two calls.
+     *
+     * @param hint Arc length found by the previous call; updated.
+     * @return Signed lateral offset; positive to the left of the centerline.
+     */
+    double locate(double x, double y, double &hint) const noexcept {
+        const std::size_t N{m_points.size()};
+        const std::size_t START{index(hint)};
+        std::size_t best{START};
+        double bestDistance{distance(START, x, y)};
+        const std::size_t WINDOW{static_cast<std::size_t>(1.0 / RESOLUTION)};
+        for (std::size_t k{1}; k <= WINDOW; k++) {
+            for (const std::size_t I : {(START + k) % N, (START + N - k) % N}) {
+                const double D{distance(I, x, y)};
+                if (D < bestDistance) {
+                    bestDistance = D;
+                    best = I;
+                }
+            }
+        }
+        hint = static_cast<double>(best) * RESOLUTION;
+        const double HEADING{heading(best)};
+        return -std::sin(HEADING) * (x - m_points[best].x) + std::cos(HEADING) * (y - m_points[best].y);
+    }
+
+   private:
+    std::size_t index(double s) const noexcept {
+        const double WRAPPED{std::fmod(std::fmod(s, m_length) + m_length, m_length)};
+        return static_cast<std::size_t>(WRAPPED / RESOLUTION) % m_points.size();
+    }
+
+    double heading(std::size_t i) const noexcept {
+        const Point &a{m_points[(i + m_points.size() - 1) % m_points.size()]};
+        const Point &b{m_points[(i + 1) % m_points.size()]};
+        return std::atan2(b.y - a.y, b.x - a.x);
+    }
+
+    double distance(std::size_t i, double x, double y) const noexcept {
+        return std::hypot(m_points[i].x - x, m_points[i].y - y);
+    }
+
+   private:
+    double m_halfWidth{0.0};
+    double m_length{0.0};
+    std::vector<Point> m_points{};
+    std::vector<TrackCone> m_cones{};
+};
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KIWI_MODEL_HPP
+#define KIWI_MODEL_HPP
+
+#include <algorithm>
+#include <cmath>
+
+struct KiwiParameters {
+    double wheelbase{0.12};        // Meters between front and rear axle.
+    double maxSteering{0.6632};    // Radians; 38 degrees to either side.
+    double speedPerPedal{5.0};     // Meters per second at steady state per unit of pedal position.
+    double speedTimeConstant{0.3}; // Seconds for the speed to reach 63% of a change.
+    double steeringTimeConstant{0.05};
+};
+
+struct KiwiState {
+    double x{0.0};        // Meters in the world frame.
+    double y{0.0};
+    double yaw{0.0};      // Radians; counter-clockwise from the x axis.
+    double speed{0.0};    // Meters per second.
+    double steering{0.0}; // Radians at the front wheels.
+};
+
+/**
+ * KiwiModel is a kinematic bicycle model of Kiwi with its reference point
+ * at the rear axle. Steering and speed follow their requests with first
+ * order lags, as the servo and the motor controller do. The model is
+ * stepped with a fixed time step and is fully deterministic.
+ */
+class KiwiModel {
+   public:
+    explicit KiwiModel(const KiwiParameters &parameters) noexcept
+        : m_parameters(parameters) {}
+
+    const KiwiState &state() const noexcept {
+        return m_state;
+    }
+
+    void reset(const KiwiState &state) noexcept {
+        m_state = state;
+    }
+
+    /**
+     * This method advances the model.
+     *
+     * @param dt Time step in seconds.
+     * @param groundSteering Requested steering angle in radians; positive to the left.
+     * @param pedalPosition Requested pedal position; +0.25 (forward) .. -1.0 (backwards).
+     */
+    void step(double dt, double groundSteering, double pedalPosition) noexcept {
+        const double STEERING{std::max(-m_parameters.maxSteering, std::min(m_parameters.maxSteering, groundSteering))};
+        m_state.steering += (STEERING - m_state.steering) * std::min(1.0, dt / m_parameters.steeringTimeConstant);
+        m_state.speed += (pedalPosition * m_parameters.speedPerPedal - m_state.speed) * std::min(1.0, dt / m_parameters.speedTimeConstant);
+
+        // Integrate at the middle of the step for the heading.
+        const double YAW_RATE{m_state.speed * std::tan(m_state.steering) / m_parameters.wheelbase};
+        const double YAW{m_state.yaw + 0.5 * YAW_RATE * dt};
+        m_state.x += m_state.speed * std::cos(YAW) * dt;
+        m_state.y += m_state.speed * std::sin(YAW) * dt;
+        m_state.yaw = std::remainder(m_state.yaw + YAW_RATE * dt, 2.0 * M_PI);
+    }
+
+   private:
+    const KiwiParameters m_parameters;
+    KiwiState m_state{};
+};
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "allocation-counter.hpp"
+
+#include <cerrno>
+#include <cstddef>
+
+#if defined(COUNT_ALLOCATIONS) && defined(__GLIBC__)
+
+// The allocation functions of the program replace glibc's; they count and
+// forward to glibc's implementation. The counter is thread-local with the
+// initial-exec model so that counting never allocates itself.
+extern "C" {
+void *__libc_malloc(std::size_t);
+void *__libc_calloc(std::size_t, std::size_t);
+void *__libc_realloc(void*, std::size_t);
+void *__libc_memalign(std::size_t, std::size_t);
+void *__libc_valloc(std::size_t);
+void *__libc_pvalloc(std::size_t);
+void __libc_free(void*);
+}
+
+static __thread uint64_t g_heapAllocations __attribute__((tls_model("initial-exec"))) = 0;
+
+extern "C" {
+void *malloc(std::size_t size) {
+    g_heapAllocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(std::size_t number, std::size_t size) {
+    g_heapAllocations++;
+    return __libc_calloc(number, size);
+}
+
+void *realloc(void *ptr, std::size_t size) {
+    g_heapAllocations++;
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(std::size_t alignment, std::size_t size) {
+    g_heapAllocations++;
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(std::size_t alignment, std::size_t size) {
+    g_heapAllocations++;
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, std::size_t alignment, std::size_t size) {
+    if ( (0 == alignment) || (0 != (alignment & (alignment - 1))) || (0 != (alignment % sizeof(void*))) ) {
+        return EINVAL;
+    }
+    g_heapAllocations++;
+    void *memory{__libc_memalign(alignment, size)};
+    if (nullptr == memory) {
+        return ENOMEM;
+    }
+    *ptr = memory;
+    return 0;
+}
+
+void *valloc(std::size_t size) {
+    g_heapAllocations++;
+    return __libc_valloc(size);
+}
+
+void *pvalloc(std::size_t size) {
+    g_heapAllocations++;
+    return __libc_pvalloc(size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+}
+
+uint64_t heapAllocations() noexcept {
+    return g_heapAllocations;
+}
+
+bool countsHeapAllocations() noexcept {
+    return true;
+}
+
+#endif
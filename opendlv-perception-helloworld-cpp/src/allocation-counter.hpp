@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALLOCATION_COUNTER_HPP
+#define ALLOCATION_COUNTER_HPP
+
+#include <cstdint>
+
+/**
+ * This function tells how often the calling thread has allocated memory
+ * from the heap (malloc and friends, and thus also operator new) since it
+ * started. The difference over a frame proves whether the frame loop
+ * allocates at all.
+ *
+ * Counting replaces the allocation functions of glibc for the whole
+ * process; hence, it is only built into the benchmark and the simulation
+ * with the CMake option COUNT_ALLOCATIONS. Otherwise, and in the
+ * microservice, this function always returns 0.
+ *
+ * @return Number of heap allocations of the calling thread.
+ */
+#if defined(COUNT_ALLOCATIONS) && defined(__GLIBC__)
+uint64_t heapAllocations() noexcept;
+#else
+inline uint64_t heapAllocations() noexcept {
+    return 0;
+}
+#endif
+
+/**
+ * @return True if heapAllocations() actually counts.
+ */
+#if defined(COUNT_ALLOCATIONS) && defined(__GLIBC__)
+bool countsHeapAllocations() noexcept;
+#else
+inline bool countsHeapAllocations() noexcept {
+    return false;
+}
+#endif
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASYNC_LOG_HPP
+#define ASYNC_LOG_HPP
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Severities as in opendlv.system.LogMessage (syslog); smaller is more severe.
+enum class LogLevel : uint8_t {
+    ERROR   = 3,
+    WARNING = 4,
+    NOTICE  = 5,
+    INFO    = 6,
+    DEBUG   = 7,
+};
+
+// Each part of the program logs in its own category with its own level.
+enum class LogCategory : uint8_t {
+    GENERAL     = 0,
+    ACQUISITION = 1,
+    PROCESSING  = 2,
+    PUBLISHING  = 3,
+    SENSORS     = 4,
+    CONTROL     = 5,
+};
+
+/**
+ * AsyncLog takes log messages from any thread without blocking it and
+ * writes them in batches from a thread of its own.
+ *
+ * A message is formatted into a fixed-size slot of a lock-free ring with
+ * vsnprintf; neither memory is allocated nor I/O is done by the caller.
+ * Every few milliseconds, the writer prefixes all messages in the ring
+ * with their time and category and writes them with a single write to
+ * stderr, or publishes them as one opendlv.system.LogMessage over OD4.
+ * Errors and warnings wake the writer right away.
+ *
+ * Messages above the level of their category are dropped before they are
+ * formatted. Each category may log at most a number of messages per
+ * second; the writer reports how many were suppressed. If the ring is
+ * full, messages are dropped and counted as well.
+ */
+class AsyncLog {
+   public:
+    static constexpr uint32_t CAPACITY{256};  // Messages; a power of two.
+    static constexpr uint32_t MAX_LENGTH{200};
+    static constexpr uint32_t NUMBER_OF_CATEGORIES{6};
+
+   private:
+    AsyncLog(const AsyncLog &) = delete;
+    AsyncLog(AsyncLog &&)      = delete;
+    AsyncLog &operator=(const AsyncLog &) = delete;
+    AsyncLog &operator=(AsyncLog &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param program Name to prefix every line with.
+     * @param od4 Session to publish messages as LogMessage on; nullptr writes them to stderr.
+     * @param interval Time between two batches.
+     */
+    AsyncLog(const std::string &program, cluon::OD4Session *od4, std::chrono::milliseconds interval) noexcept
+        : m_program(program)
+        , m_od4(od4)
+        , m_interval(interval) {
+        for (uint32_t i{0}; i < CAPACITY; i++) {
+            m_ring[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        for (auto &c : m_categories) {
+            c.level.store(static_cast<uint8_t>(LogLevel::NOTICE), std::memory_order_relaxed);
+        }
+        m_batch.reserve(CAPACITY * (MAX_LENGTH + 64));
+        m_writer = std::thread([this]() { write(); });
+    }
+
+    ~AsyncLog() noexcept {
+        {
+            std::lock_guard<std::mutex> lck(m_mutex);
+            m_running = false;
+        }
+        m_condition.notify_one();
+        m_writer.join();
+    }
+
+    /**
+     * This method sets the most verbose level that is logged in a category.
+     */
+    void setLevel(LogCategory category, LogLevel level) noexcept {
+        m_categories[static_cast<uint8_t>(category)].level.store(static_cast<uint8_t>(level), std::memory_order_relaxed);
+    }
+
+    /**
+     * This method sets the most verbose level for all categories.
+     */
+    void setLevel(LogLevel level) noexcept {
+        for (uint8_t c{0}; c < NUMBER_OF_CATEGORIES; c++) {
+            setLevel(static_cast<LogCategory>(c), level);
+        }
+    }
+
+    /**
+     * This method sets how many messages per second a category may log at most.
+     */
+    void setRate(uint32_t messagesPerSecond) noexcept {
+        m_rate.store(messagesPerSecond, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return True if messages of this level are logged in category.
+     */
+    bool enabled(LogCategory category, LogLevel level) const noexcept {
+        return static_cast<uint8_t>(level) <= m_categories[static_cast<uint8_t>(category)].level.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * This method queues a message in printf style; it never blocks.
+     */
+    __attribute__((format(printf, 4, 5))) void log(LogCategory category, LogLevel level, const char *format, ...) noexcept {
+        if (!enabled(category, level) || !withinRate(category)) {
+            return;
+        }
+
+        // Claim the next slot unless the writer has not yet emptied it.
+        uint64_t position{m_tail.load(std::memory_order_relaxed)};
+        Slot *slot{nullptr};
+        while (true) {
+            slot = &m_ring[position & (CAPACITY - 1)];
+            const int64_t DIFFERENCE{static_cast<int64_t>(slot->sequence.load(std::memory_order_acquire) - position)};
+            if (0 == DIFFERENCE) {
+                if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (0 > DIFFERENCE) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            else {
+                position = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->timeStamp = cluon::time::toMicroseconds(cluon::time::now());
+        slot->category = category;
+        slot->level = level;
+        va_list arguments;
+        va_start(arguments, format);
+        std::vsnprintf(slot->text.data(), MAX_LENGTH, format, arguments);
+        va_end(arguments);
+        slot->sequence.store(position + 1, std::memory_order_release);
+
+        if (LogLevel::WARNING >= level) {
+            m_condition.notify_one();
+        }
+    }
+
+   private:
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};
+        int64_t timeStamp{0};
+        LogCategory category{LogCategory::GENERAL};
+        LogLevel level{LogLevel::INFO};
+        std::array<char, MAX_LENGTH> text{};
+    };
+
+    struct Category {
+        std::atomic<uint8_t> level{0};
+        std::atomic<int64_t> second{0};
+        std::atomic<uint32_t> count{0};
+        std::atomic<uint32_t> suppressed{0};
+    };
+
+    bool withinRate(LogCategory category) noexcept {
+        Category &c{m_categories[static_cast<uint8_t>(category)]};
+        const int64_t SECOND{std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count()};
+        int64_t current{c.second.load(std::memory_order_relaxed)};
+        if ( (current != SECOND) && c.second.compare_exchange_strong(current, SECOND, std::memory_order_relaxed) ) {
+            c.count.store(0, std::memory_order_relaxed);
+        }
+        if (c.count.fetch_add(1, std::memory_order_relaxed) >= m_rate.load(std::memory_order_relaxed)) {
+            c.suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void write() noexcept {
+        bool running{true};
+        while (running) {
+            {
+                std::unique_lock<std::mutex> lck(m_mutex);
+                m_condition.wait_for(lck, m_interval);
+                running = m_running;
+            }
+            flush();
+        }
+    }
+
+    void flush() noexcept {
+        static const char *CATEGORIES[NUMBER_OF_CATEGORIES]{"", "acquisition: ", "processing: ", "publishing: ", "sensors: ", "control: "};
+        m_batch.clear();
+        uint8_t mostSevere{static_cast<uint8_t>(LogLevel::DEBUG)};
+        while (true) {
+            Slot &slot{m_ring[m_head & (CAPACITY - 1)]};
+            if (slot.sequence.load(std::memory_order_acquire) != m_head + 1) {
+                break;
+            }
+            const std::time_t SECONDS{static_cast<std::time_t>(slot.timeStamp / 1000000)};
+            std::tm local{};
+            ::localtime_r(&SECONDS, &local);
+            char prefix[32];
+            std::snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%03d ", local.tm_hour, local.tm_min, local.tm_sec, static_cast<int>((slot.timeStamp / 1000) % 1000));
+            append(prefix, slot.category, CATEGORIES, slot.text.data());
+            mostSevere = std::min(mostSevere, static_cast<uint8_t>(slot.level));
+
+            slot.sequence.store(m_head + CAPACITY, std::memory_order_release);
+            m_head++;
+        }
+
+        // Tell what got lost since the last batch.
+        for (uint8_t i{0}; i < NUMBER_OF_CATEGORIES; i++) {
+            const uint32_t SUPPRESSED{m_categories[i].suppressed.exchange(0, std::memory_order_relaxed)};
+            if (0 < SUPPRESSED) {
+                append("", static_cast<LogCategory>(i), CATEGORIES, (std::to_string(SUPPRESSED) + " message(s) suppressed by rate limit.").c_str());
+            }
+        }
+        const uint64_t DROPPED{m_dropped.exchange(0, std::memory_order_relaxed)};
+        if (0 < DROPPED) {
+            append("", LogCategory::GENERAL, CATEGORIES, (std::to_string(DROPPED) + " message(s) dropped; log ring was full.").c_str());
+        }
+
+        if (m_batch.empty()) {
+            return;
+        }
+        if (nullptr != m_od4) {
+            m_batch.pop_back();  // The final newline.
+            opendlv::system::LogMessage message;
+            message.level(mostSevere).description(m_batch);
+            m_od4->send(message);
+        }
+        else {
+            std::fwrite(m_batch.data(), 1, m_batch.size(), stderr);
+            std::fflush(stderr);
+        }
+    }
+
+    void append(const char *prefix, LogCategory category, const char * const *categories, const char *text) noexcept {
+        m_batch.append(prefix).append(m_program).append(": ").append(categories[static_cast<uint8_t>(category)]).append(text).push_back('\n');
+    }
+
+   private:
+    const std::string m_program;
+    cluon::OD4Session *m_od4;
+    const std::chrono::milliseconds m_interval;
+
+    std::array<Slot, CAPACITY> m_ring{};
+    alignas(64) std::atomic<uint64_t> m_tail{0};
+    alignas(64) uint64_t m_head{0};  // Only used by the writer.
+    std::array<Category, NUMBER_OF_CATEGORIES> m_categories{};
+    std::atomic<uint32_t> m_rate{20};
+    std::atomic<uint64_t> m_dropped{0};
+
+    std::string m_batch{};
+    std::mutex m_mutex{};
+    std::condition_variable m_condition{};
+    bool m_running{true};
+    std::thread m_writer{};
+};
+
+/**
+ * This function parses log levels given as "level" for all categories or
+ * as "category:level,..." with categories acquisition, processing,
+ * publishing, sensors, control, and general, and levels 3 (errors) to 7 (debug).
+ *
+ * @return false if the levels could not be parsed.
+ */
+inline bool parseLogLevels(const std::string &str, AsyncLog &log) noexcept {
+    static const char *NAMES[AsyncLog::NUMBER_OF_CATEGORIES]{"general", "acquisition", "processing", "publishing", "sensors", "control"};
+    std::stringstream sstr{str};
+    std::string entry;
+    while (std::getline(sstr, entry, ',')) {
+        const std::size_t COLON{entry.find(':')};
+        const std::string LEVEL{(std::string::npos == COLON) ? entry : entry.substr(COLON + 1)};
+        if ( (1 != LEVEL.size()) || (LEVEL[0] < '3') || (LEVEL[0] > '7') ) {
+            return false;
+        }
+        const LogLevel L{static_cast<LogLevel>(LEVEL[0] - '0')};
+        if (std::string::npos == COLON) {
+            log.setLevel(L);
+            continue;
+        }
+        bool found{false};
+        for (uint8_t c{0}; c < AsyncLog::NUMBER_OF_CATEGORIES; c++) {
+            if (entry.substr(0, COLON) == NAMES[c]) {
+                log.setLevel(static_cast<LogCategory>(c), L);
+                found = true;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONE_BLOBS_HPP
+#define CONE_BLOBS_HPP
+
+#include "cone-segmentation.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+ * Connected components of the segmentation labels.
+ *
+ * Every row of the label image is split into runs of equal, non-zero
+ * labels. A run is merged (union-find) with every run of the same label in
+ * the previous row that touches it, including diagonally. Position, extent
+ * and area are summed per run and gathered at the root of each component
+ * afterwards; hence, the labels are read exactly once and no per-pixel
+ * component image is written.
+ */
+
+/**
+ * One cone candidate; pixel coordinates are inclusive.
+ */
+struct ConeBlob {
+    uint32_t id{0};        // Identity kept across frames by a tracker; 0 if not tracked.
+    uint32_t label{CONE_NONE};
+    uint32_t area{0};
+    uint32_t left{0};
+    uint32_t right{0};
+    uint32_t top{0};
+    uint32_t bottom{0};
+    float centerX{0.0f};
+    float centerY{0.0f};
+    float azimuth{0.0f};   // Radians; positive to the left of the optical axis.
+    float zenith{0.0f};    // Radians from the optical axis to the cone's base; positive upwards.
+    float distance{0.0f};  // Meters from the camera; on the ground if known, otherwise from the blob's height.
+    bool onGround{false};  // True if x and y below are known.
+    float x{0.0f};         // Meters forward of the camera on the ground.
+    float y{0.0f};         // Meters to the left of the camera on the ground.
+};
+
+/**
+ * Cone candidates of one frame; fixed capacity so that they can be handed
+ * between stages without allocating.
+ */
+struct ConeDetections {
+    static constexpr uint32_t MAX_CONES{32};
+    std::array<ConeBlob, MAX_CONES> cones{};
+    uint32_t count{0};
+};
+
+/**
+ * Camera and cone model to turn blob geometry into bearing and distance.
+ */
+struct ConeGeometry {
+    float fovy{48.8f};        // Vertical field of view in degrees.
+    float coneHeight{0.1f};   // Meters.
+    uint32_t minArea{20};     // Smaller blobs are treated as noise.
+};
+
+class ConeBlobExtractor {
+   private:
+    ConeBlobExtractor(const ConeBlobExtractor &) = delete;
+    ConeBlobExtractor(ConeBlobExtractor &&)      = delete;
+    ConeBlobExtractor &operator=(const ConeBlobExtractor &) = delete;
+    ConeBlobExtractor &operator=(ConeBlobExtractor &&) = delete;
+
+   public:
+    explicit ConeBlobExtractor(const ConeGeometry &geometry) noexcept
+        : m_geometry(geometry) {}
+
+    const ConeGeometry &geometry() const noexcept {
+        return m_geometry;
+    }
+
+    /**
+     * This method finds the cone blobs in a label image and estimates their
+     * bearing and distance; the largest ones are kept if there are more than
+     * ConeDetections::MAX_CONES. The internal buffers grow to the largest
+     * frame seen so far and are reused afterwards.
+     */
+    void extract(const uint8_t *labels, uint32_t stride, uint32_t width, uint32_t height, ConeDetections &detections) noexcept {
+        extract(labels, stride, width, height, 1, [](uint32_t count, auto &&f) {
+            for (uint32_t i{0}; i < count; i++) {
+                f(i);
+            }
+        }, detections);
+    }
+
+    /**
+     * This method finds the cone blobs like the one above, but splits the
+     * label image into horizontal tiles whose runs are found in parallel;
+     * components that cross a tile border are merged afterwards.
+     *
+     * @param tiles Number of tiles.
+     * @param parallelFor Called as parallelFor(count, function) to call function(i) for i in [0, count).
+     */
+    template <typename ParallelFor>
+    void extract(const uint8_t *labels, uint32_t stride, uint32_t width, uint32_t height, uint32_t tiles, ParallelFor &&parallelFor, ConeDetections &detections) noexcept {
+        tiles = std::max(1u, std::min(tiles, height));
+        if (m_tiles.size() < tiles) {
+            m_tiles.resize(tiles);
+        }
+        parallelFor(tiles, [this, labels, stride, width, height, tiles](uint32_t t) {
+            findRuns(labels, stride, width, height * t / tiles, height * (t + 1) / tiles, m_tiles[t]);
+        });
+
+        // Put the tiles' runs one after another and merge the runs touching
+        // across each border; every tile's roots stay its oldest runs.
+        m_runs.clear();
+        m_parents.clear();
+        if (1 == tiles) {
+            m_runs.swap(m_tiles[0].runs);
+            m_parents.swap(m_tiles[0].parents);
+        }
+        else {
+            std::size_t previousBegin{0};
+            std::size_t previousEnd{0};
+            for (uint32_t t{0}; t < tiles; t++) {
+                const Tile &tile{m_tiles[t]};
+                const uint32_t OFFSET{static_cast<uint32_t>(m_runs.size())};
+                m_runs.insert(m_runs.end(), tile.runs.begin(), tile.runs.end());
+                for (uint32_t parent : tile.parents) {
+                    m_parents.push_back(OFFSET + parent);
+                }
+                for (std::size_t i{0}; i < tile.firstRowEnd; i++) {
+                    connect(m_runs, m_parents, static_cast<uint32_t>(OFFSET + i), previousBegin, previousEnd);
+                }
+                previousBegin = OFFSET + tile.lastRowBegin;
+                previousEnd = m_runs.size();
+            }
+        }
+        gather(width, height, detections);
+    }
+
+    /**
+     * This method estimates bearing and distance of a blob from its geometry
+     * in the image; extract() calls it for every blob, and it needs to be
+     * called again when the blob's pixel coordinates are corrected.
+     */
+    void estimate(ConeBlob &blob, uint32_t width, uint32_t height) const noexcept {
+        // Pinhole camera with square pixels and the principal point in the
+        // image center; pixel (0, 0) is centered at (0.0, 0.0).
+        const float F{0.5f * static_cast<float>(height) / std::tan(0.5f * m_geometry.fovy * static_cast<float>(M_PI) / 180.0f)};
+        const float CX{0.5f * static_cast<float>(width) - 0.5f};
+        const float CY{0.5f * static_cast<float>(height) - 0.5f};
+        blob.azimuth = std::atan2(CX - blob.centerX, F);
+        blob.zenith = std::atan2(CY - (static_cast<float>(blob.bottom) + 0.5f), F);
+
+        // The cone's height in pixels gives its depth along the optical axis.
+        const float PIXELS{static_cast<float>(blob.bottom - blob.top + 1)};
+        const float DEPTH{F * m_geometry.coneHeight / PIXELS};
+        blob.distance = DEPTH / std::cos(blob.azimuth);
+    }
+
+   private:
+    struct Run {
+        uint32_t label;
+        uint32_t row;
+        uint32_t start;
+        uint32_t end;   // Exclusive.
+        uint32_t blob;  // Index into m_blobs; valid for roots only.
+    };
+
+    struct Sums {
+        uint64_t twiceX{0};  // Twice the sum of column indices; keeps the center of every run integral.
+        uint64_t y{0};
+    };
+
+    // Runs of a band of rows; parents are indices into the tile's runs.
+    struct Tile {
+        std::vector<Run> runs{};
+        std::vector<uint32_t> parents{};
+        std::size_t firstRowEnd{0};   // Runs of the first row are [0, firstRowEnd).
+        std::size_t lastRowBegin{0};  // Runs of the last row are [lastRowBegin, runs.size()).
+    };
+
+    // Finds runs in rows [firstRow, lastRow) and merges them with touching runs of the previous row.
+    static void findRuns(const uint8_t *labels, uint32_t stride, uint32_t width, uint32_t firstRow, uint32_t lastRow, Tile &tile) noexcept {
+        tile.runs.clear();
+        tile.parents.clear();
+        tile.firstRowEnd = 0;
+        tile.lastRowBegin = 0;
+
+        std::size_t previousBegin{0};
+        std::size_t previousEnd{0};
+        for (uint32_t y{firstRow}; y < lastRow; y++) {
+            const uint8_t *row{labels + static_cast<std::size_t>(y) * stride};
+            const std::size_t currentBegin{tile.runs.size()};
+            uint32_t x{0};
+            while (x < width) {
+                // Skip background eight labels at a time.
+                while (x + 8 <= width) {
+                    uint64_t eight{0};
+                    std::memcpy(&eight, row + x, sizeof(eight));
+                    if (0 != eight) {
+                        break;
+                    }
+                    x += 8;
+                }
+                while ( (x < width) && (CONE_NONE == row[x]) ) {
+                    x++;
+                }
+                if (x >= width) {
+                    break;
+                }
+                const uint8_t LABEL{row[x]};
+                const uint32_t START{x};
+                while ( (x < width) && (LABEL == row[x]) ) {
+                    x++;
+                }
+                const uint32_t INDEX{static_cast<uint32_t>(tile.runs.size())};
+                tile.runs.push_back(Run{LABEL, y, START, x, 0});
+                tile.parents.push_back(INDEX);
+                connect(tile.runs, tile.parents, INDEX, previousBegin, previousEnd);
+            }
+            if (y == firstRow) {
+                tile.firstRowEnd = tile.runs.size();
+            }
+            tile.lastRowBegin = currentBegin;
+            previousBegin = currentBegin;
+            previousEnd = tile.runs.size();
+        }
+    }
+
+    // Merges a run with the runs [previousBegin, previousEnd) of the row above that touch it.
+    static void connect(const std::vector<Run> &runs, std::vector<uint32_t> &parents, uint32_t index, std::size_t previousBegin, std::size_t previousEnd) noexcept {
+        // Runs of the previous row are sorted; 8-connectivity lets a run
+        // touch the one ending right before its start.
+        const Run &run{runs[index]};
+        for (std::size_t i{previousBegin}; i < previousEnd; i++) {
+            const Run &above{runs[i]};
+            if (above.end + 1 <= run.start) {
+                continue;
+            }
+            if (above.start >= run.end + 1) {
+                break;
+            }
+            if (above.label == run.label) {
+                merge(parents, index, static_cast<uint32_t>(i));
+            }
+        }
+    }
+
+    static uint32_t find(std::vector<uint32_t> &parents, uint32_t i) noexcept {
+        while (parents[i] != i) {
+            parents[i] = parents[parents[i]];
+            i = parents[i];
+        }
+        return i;
+    }
+
+    static void merge(std::vector<uint32_t> &parents, uint32_t a, uint32_t b) noexcept {
+        a = find(parents, a);
+        b = find(parents, b);
+        // The older run stays the root so that roots come first in m_runs.
+        if (a < b) {
+            parents[b] = a;
+        }
+        else if (b < a) {
+            parents[a] = b;
+        }
+    }
+
+    // Gathers the runs' statistics at the roots of their components.
+    void gather(uint32_t width, uint32_t height, ConeDetections &detections) noexcept {
+        m_blobs.clear();
+        m_sums.clear();
+        for (std::size_t i{0}; i < m_runs.size(); i++) {
+            const Run &run{m_runs[i]};
+            const uint32_t ROOT{find(m_parents, static_cast<uint32_t>(i))};
+            if (ROOT == i) {
+                m_runs[i].blob = static_cast<uint32_t>(m_blobs.size());
+                ConeBlob blob;
+                blob.label = run.label;
+                blob.left = run.start;
+                blob.right = run.end - 1;
+                blob.top = run.row;
+                blob.bottom = run.row;
+                m_blobs.push_back(blob);
+                m_sums.push_back(Sums{});
+            }
+            ConeBlob &blob{m_blobs[m_runs[ROOT].blob]};
+            Sums &sums{m_sums[m_runs[ROOT].blob]};
+            const uint64_t LENGTH{run.end - run.start};
+            blob.area += static_cast<uint32_t>(LENGTH);
+            blob.left = std::min(blob.left, run.start);
+            blob.right = std::max(blob.right, run.end - 1);
+            blob.top = std::min(blob.top, run.row);
+            blob.bottom = std::max(blob.bottom, run.row);
+            sums.twiceX += LENGTH * (run.start + run.end - 1);
+            sums.y += LENGTH * run.row;
+        }
+
+        // Drop noise and keep the largest blobs.
+        std::size_t kept{0};
+        for (std::size_t i{0}; i < m_blobs.size(); i++) {
+            if (m_blobs[i].area >= m_geometry.minArea) {
+                m_blobs[i].centerX = static_cast<float>(static_cast<double>(m_sums[i].twiceX) / (2.0 * m_blobs[i].area));
+                m_blobs[i].centerY = static_cast<float>(static_cast<double>(m_sums[i].y) / m_blobs[i].area);
+                m_blobs[kept++] = m_blobs[i];
+            }
+        }
+        m_blobs.resize(kept);
+        if (ConeDetections::MAX_CONES < kept) {
+            std::partial_sort(m_blobs.begin(), m_blobs.begin() + ConeDetections::MAX_CONES, m_blobs.end(),
+                              [](const ConeBlob &a, const ConeBlob &b) { return a.area > b.area; });
+            kept = ConeDetections::MAX_CONES;
+        }
+
+        detections.count = static_cast<uint32_t>(kept);
+        for (std::size_t i{0}; i < kept; i++) {
+            detections.cones[i] = m_blobs[i];
+            estimate(detections.cones[i], width, height);
+        }
+    }
+
+   private:
+    const ConeGeometry m_geometry;
+    std::vector<Tile> m_tiles{};
+    std::vector<Run> m_runs{};
+    std::vector<uint32_t> m_parents{};
+    std::vector<ConeBlob> m_blobs{};
+    std::vector<Sums> m_sums{};
+};
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONE_CONTROLLER_HPP
+#define CONE_CONTROLLER_HPP
+
+#include "cone-blobs.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+struct ControllerParameters {
+    float wheelbase{0.12f};       // Meters between front and rear axle.
+    float lookahead{0.7f};        // Meters; cones closest to this distance are followed.
+    float maxRange{2.5f};         // Meters; cones farther away are ignored.
+    float halfLaneWidth{0.6f};    // Meters; offset from a cone if only one side is seen.
+    float steeringGain{1.0f};     // Factor on the pure pursuit steering angle.
+    float maxSteering{0.6632f};   // Radians; 38 degrees to either side.
+    float pedal{0.15f};           // Pedal position on straights.
+    float minPedal{0.08f};        // Pedal position at full steering and when no cone is seen.
+    float stopDistance{0.25f};    // Meters; stop if the front distance reading is closer.
+    float timeout{0.5f};          // Seconds; older cones and front distance readings are not used.
+};
+
+/**
+ * Requests to the actuators; ranges as for opendlv.proxy.GroundSteeringRequest
+ * (radians, positive to the left) and opendlv.proxy.PedalPositionRequest.
+ */
+struct ActuationRequest {
+    float groundSteering{0.0f};
+    float pedalPosition{0.0f};
+    bool conesSeen{false};     // False if the request only holds the previous steering.
+    bool stale{false};         // True if there were no cones newer than the timeout.
+    bool frontUnknown{false};  // True if there was no front distance reading newer than the timeout.
+};
+
+/**
+ * ConeController steers along a lane of blue cones on the left and yellow
+ * cones on the right. It aims at the middle between the blue and the yellow
+ * cone that are closest to the lookahead distance, or half a lane beside
+ * the only side that is seen, and steers towards that point by pure
+ * pursuit. The pedal is eased off with the steering angle, and released if
+ * something is closer in front than the stop distance.
+ *
+ * Cones are taken in the vehicle frame (x forward, y to the left) from their
+ * ground position, or from distance and azimuth if the ground is unknown.
+ */
+class ConeController {
+   private:
+    ConeController(const ConeController &) = delete;
+    ConeController(ConeController &&)      = delete;
+    ConeController &operator=(const ConeController &) = delete;
+    ConeController &operator=(ConeController &&) = delete;
+
+   public:
+    explicit ConeController(const ControllerParameters &parameters) noexcept
+        : m_parameters(parameters) {}
+
+    const ControllerParameters &parameters() const noexcept {
+        return m_parameters;
+    }
+
+    /**
+     * This method computes the next requests.
+     *
+     * @param cones Latest cones.
+     * @param frontDistance Latest front distance reading in meters; 0 if unknown.
+     * @return Requests for steering and pedal.
+     */
+    ActuationRequest update(const ConeDetections &cones, float frontDistance) noexcept {
+        float blueX{0.0f}, blueY{0.0f}, yellowX{0.0f}, yellowY{0.0f};
+        const bool BLUE{closest(cones, CONE_BLUE, blueX, blueY)};
+        const bool YELLOW{closest(cones, CONE_YELLOW, yellowX, yellowY)};
+
+        ActuationRequest request;
+        request.conesSeen = BLUE || YELLOW;
+        if (request.conesSeen) {
+            float aimX{0.5f * (blueX + yellowX)};
+            float aimY{0.5f * (blueY + yellowY)};
+            if (!YELLOW) {
+                aimX = blueX;
+                aimY = blueY - m_parameters.halfLaneWidth;
+            }
+            else if (!BLUE) {
+                aimX = yellowX;
+                aimY = yellowY + m_parameters.halfLaneWidth;
+            }
+            // Pure pursuit: the arc through the rear axle and the aim point.
+            const float ALPHA{std::atan2(aimY, aimX)};
+            const float DISTANCE{std::max(0.1f, std::sqrt(aimX * aimX + aimY * aimY))};
+            m_steering = m_parameters.steeringGain * std::atan(2.0f * m_parameters.wheelbase * std::sin(ALPHA) / DISTANCE);
+            m_steering = std::max(-m_parameters.maxSteering, std::min(m_parameters.maxSteering, m_steering));
+        }
+        request.groundSteering = m_steering;
+
+        const float TURN{std::fabs(m_steering) / std::max(1e-3f, m_parameters.maxSteering)};
+        request.pedalPosition = request.conesSeen ? m_parameters.pedal - (m_parameters.pedal - m_parameters.minPedal) * TURN : m_parameters.minPedal;
+        if ( (0.0f < frontDistance) && (frontDistance < m_parameters.stopDistance) ) {
+            request.pedalPosition = 0.0f;
+        }
+        return request;
+    }
+
+    /**
+     * This method computes the requests of one step of a control loop that
+     * runs at its own rate, independent of the camera's frame rate. Times
+     * are in microseconds; a sample time of 0 means nothing was received.
+     *
+     * Without cones newer than the timeout, the vehicle must not drive
+     * blind: the steering is centered and the pedal released until newer
+     * cones arrive. A front distance reading that is missing or older than
+     * the timeout cannot rule out an obstacle and releases the pedal, too.
+     *
+     * @param cones Latest cones.
+     * @param conesTime Sample time of the frame the cones were found in.
+     * @param frontDistance Latest front distance reading in meters.
+     * @param frontTime Sample time of the front distance reading.
+     * @param now Current time.
+     * @return Requests for steering and pedal.
+     */
+    ActuationRequest step(const ConeDetections &cones, int64_t conesTime, float frontDistance, int64_t frontTime, int64_t now) noexcept {
+        const int64_t TIMEOUT{static_cast<int64_t>(m_parameters.timeout * 1000000.0f)};
+        const bool STALE{(0 == conesTime) || (now - conesTime > TIMEOUT)};
+        const bool FRONT_UNKNOWN{(0 == frontTime) || (now - frontTime > TIMEOUT)};
+        if (STALE) {
+            m_steering = 0.0f;
+        }
+        ActuationRequest request{STALE ? ActuationRequest{} : update(cones, frontDistance)};
+        request.stale = STALE;
+        request.frontUnknown = FRONT_UNKNOWN;
+        if (FRONT_UNKNOWN) {
+            request.pedalPosition = 0.0f;
+        }
+        return request;
+    }
+
+   private:
+    // Finds the cone of a colour ahead whose distance is closest to the lookahead.
+    bool closest(const ConeDetections &cones, uint32_t label, float &x, float &y) const noexcept {
+        float best{m_parameters.maxRange};
+        for (uint32_t i{0}; i < cones.count; i++) {
+            const ConeBlob &cone{cones.cones[i]};
+            const float CX{cone.onGround ? cone.x : cone.distance * std::cos(cone.azimuth)};
+            const float CY{cone.onGround ? cone.y : cone.distance * std::sin(cone.azimuth)};
+            const float DISTANCE{std::sqrt(CX * CX + CY * CY)};
+            if ( (label != cone.label) || (CX < 0.05f) || (DISTANCE > m_parameters.maxRange) ) {
+                continue;
+            }
+            const float DEVIATION{std::fabs(DISTANCE - m_parameters.lookahead)};
+            if (DEVIATION < best) {
+                best = DEVIATION;
+                x = CX;
+                y = CY;
+            }
+        }
+        return (best < m_parameters.maxRange);
+    }
+
+   private:
+    const ControllerParameters m_parameters;
+    float m_steering{0.0f};
+};
+
+#endif
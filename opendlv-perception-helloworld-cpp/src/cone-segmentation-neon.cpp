@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The NEON kernels of cone-segmentation.hpp. This file is compiled with
+// NEON enabled on 32-bit ARM; to not leak NEON instructions into code that
+// runs on CPUs without it, nothing but the kernels may be defined here.
+
+#include "cone-segmentation.hpp"
+
+#ifdef CONE_SEGMENTATION_NEON
+#include <arm_neon.h>
+
+namespace coneSegmentation {
+
+static inline uint8x16_t inRangeNEON(uint8x16_t x, uint8x16_t lo, uint8x16_t hi) noexcept {
+    return vandq_u8(vcgeq_u8(x, lo), vcleq_u8(x, hi));
+}
+
+static inline uint8x16_t labelsNEON(uint8x16_t isBlue, uint8x16_t isYellow) noexcept {
+    return vbslq_u8(isBlue, vdupq_n_u8(CONE_BLUE), vandq_u8(isYellow, vdupq_n_u8(CONE_YELLOW)));
+}
+
+// Converts 8 pixels into Y, U, V.
+static inline void rgbToYUVNEON(uint8x8_t r, uint8x8_t g, uint8x8_t b, uint8x8_t &y, uint8x8_t &u, uint8x8_t &v) noexcept {
+    const int16x8_t ROUND{vdupq_n_s16(128)};
+    uint16x8_t t{vmull_u8(r, vdup_n_u8(66))};
+    t = vmlal_u8(t, g, vdup_n_u8(129));
+    t = vmlal_u8(t, b, vdup_n_u8(25));
+    y = vadd_u8(vshrn_n_u16(vaddq_u16(t, vdupq_n_u16(128)), 8), vdup_n_u8(16));
+
+    // The differences fit into int16; compute them with wrapping unsigned arithmetic.
+    t = vmull_u8(b, vdup_n_u8(112));
+    t = vmlsl_u8(t, r, vdup_n_u8(38));
+    t = vmlsl_u8(t, g, vdup_n_u8(74));
+    u = vqmovun_s16(vaddq_s16(vshrq_n_s16(vaddq_s16(vreinterpretq_s16_u16(t), ROUND), 8), ROUND));
+
+    t = vmull_u8(r, vdup_n_u8(112));
+    t = vmlsl_u8(t, g, vdup_n_u8(94));
+    t = vmlsl_u8(t, b, vdup_n_u8(18));
+    v = vqmovun_s16(vaddq_s16(vshrq_n_s16(vaddq_s16(vreinterpretq_s16_u16(t), ROUND), 8), ROUND));
+}
+
+uint32_t segmentBGRARowNEON(const uint8_t *src, uint8_t *mask, uint32_t width, const SegmentationParameters &p) noexcept {
+    uint32_t x{0};
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16x4_t BGRA{vld4q_u8(src + 4 * x)};
+        uint8x8_t yLow, uLow, vLow, yHigh, uHigh, vHigh;
+        rgbToYUVNEON(vget_low_u8(BGRA.val[2]), vget_low_u8(BGRA.val[1]), vget_low_u8(BGRA.val[0]), yLow, uLow, vLow);
+        rgbToYUVNEON(vget_high_u8(BGRA.val[2]), vget_high_u8(BGRA.val[1]), vget_high_u8(BGRA.val[0]), yHigh, uHigh, vHigh);
+        const uint8x16_t Y{vcombine_u8(yLow, yHigh)};
+        const uint8x16_t U{vcombine_u8(uLow, uHigh)};
+        const uint8x16_t V{vcombine_u8(vLow, vHigh)};
+
+        const uint8x16_t IS_BLUE{vandq_u8(vandq_u8(inRangeNEON(Y, vdupq_n_u8(p.blue.minY), vdupq_n_u8(p.blue.maxY)),
+                                                   inRangeNEON(U, vdupq_n_u8(p.blue.minU), vdupq_n_u8(p.blue.maxU))),
+                                          inRangeNEON(V, vdupq_n_u8(p.blue.minV), vdupq_n_u8(p.blue.maxV)))};
+        const uint8x16_t IS_YELLOW{vandq_u8(vandq_u8(inRangeNEON(Y, vdupq_n_u8(p.yellow.minY), vdupq_n_u8(p.yellow.maxY)),
+                                                     inRangeNEON(U, vdupq_n_u8(p.yellow.minU), vdupq_n_u8(p.yellow.maxU))),
+                                            inRangeNEON(V, vdupq_n_u8(p.yellow.minV), vdupq_n_u8(p.yellow.maxV)))};
+        vst1q_u8(mask + x, labelsNEON(IS_BLUE, IS_YELLOW));
+    }
+    return x;
+}
+
+uint32_t segmentI420RowPairNEON(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+                                uint8_t *mask0, uint8_t *mask1, uint32_t width, const SegmentationParameters &p) noexcept {
+    uint32_t x{0};
+    for (; x + 16 <= width; x += 16) {
+        // 8 chroma samples cover 16 luma samples; duplicate each.
+        const uint8x8_t U8{vld1_u8(u + x / 2)};
+        const uint8x8_t V8{vld1_u8(v + x / 2)};
+        const uint8x8x2_t U_ZIPPED{vzip_u8(U8, U8)};
+        const uint8x8x2_t V_ZIPPED{vzip_u8(V8, V8)};
+        const uint8x16_t U{vcombine_u8(U_ZIPPED.val[0], U_ZIPPED.val[1])};
+        const uint8x16_t V{vcombine_u8(V_ZIPPED.val[0], V_ZIPPED.val[1])};
+        const uint8x16_t BLUE_UV{vandq_u8(inRangeNEON(U, vdupq_n_u8(p.blue.minU), vdupq_n_u8(p.blue.maxU)),
+                                          inRangeNEON(V, vdupq_n_u8(p.blue.minV), vdupq_n_u8(p.blue.maxV)))};
+        const uint8x16_t YELLOW_UV{vandq_u8(inRangeNEON(U, vdupq_n_u8(p.yellow.minU), vdupq_n_u8(p.yellow.maxU)),
+                                            inRangeNEON(V, vdupq_n_u8(p.yellow.minV), vdupq_n_u8(p.yellow.maxV)))};
+
+        const uint8x16_t Y0{vld1q_u8(y0 + x)};
+        vst1q_u8(mask0 + x, labelsNEON(vandq_u8(BLUE_UV, inRangeNEON(Y0, vdupq_n_u8(p.blue.minY), vdupq_n_u8(p.blue.maxY))),
+                                       vandq_u8(YELLOW_UV, inRangeNEON(Y0, vdupq_n_u8(p.yellow.minY), vdupq_n_u8(p.yellow.maxY)))));
+        if (nullptr != y1) {
+            const uint8x16_t Y1{vld1q_u8(y1 + x)};
+            vst1q_u8(mask1 + x, labelsNEON(vandq_u8(BLUE_UV, inRangeNEON(Y1, vdupq_n_u8(p.blue.minY), vdupq_n_u8(p.blue.maxY))),
+                                           vandq_u8(YELLOW_UV, inRangeNEON(Y1, vdupq_n_u8(p.yellow.minY), vdupq_n_u8(p.yellow.maxY)))));
+        }
+    }
+    return x;
+}
+
+} // namespace coneSegmentation
+
+#endif
@@ -0,0 +1,495 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONE_SEGMENTATION_HPP
+#define CONE_SEGMENTATION_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONE_SEGMENTATION_X86
+#include <immintrin.h>
+#endif
+#if defined(__arm__) || defined(__aarch64__)
+#define CONE_SEGMENTATION_NEON
+#if defined(__arm__) && defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#endif
+
+/*
+ * Single-pass colour segmentation for blue and yellow cones.
+ *
+ * Every pixel is classified by thresholding its Y, U and V values (BT.601,
+ * limited range as delivered by the camera) against one range per cone
+ * colour. For ARGB frames, the conversion to YUV is fused into the same
+ * pass; for I420 frames, the planes are thresholded directly with every
+ * chroma sample covering 2x2 luma samples. The output is one label per
+ * pixel (CONE_NONE, CONE_BLUE or CONE_YELLOW).
+ *
+ * The kernels exist as scalar, SSE2, AVX2 and NEON code; the fastest one
+ * supported by the CPU is selected at runtime. 32-bit ARM toolchains do
+ * not enable NEON by default, so the NEON kernels are compiled separately
+ * with NEON enabled; they run only if the CPU reports NEON.
+ */
+
+enum ConeLabel : uint8_t {
+    CONE_NONE = 0,
+    CONE_BLUE = 1,
+    CONE_YELLOW = 2,
+};
+
+struct ColourRange {
+    uint8_t minY{0};
+    uint8_t maxY{255};
+    uint8_t minU{0};
+    uint8_t maxU{255};
+    uint8_t minV{0};
+    uint8_t maxV{255};
+};
+
+struct SegmentationParameters {
+    ColourRange blue{20, 200, 140, 255, 0, 125};
+    ColourRange yellow{90, 255, 0, 110, 130, 180};
+};
+
+/**
+ * This function parses a colour range given as "minY,maxY,minU,maxU,minV,maxV".
+ *
+ * @return true if six values in [0, 255] were found.
+ */
+inline bool parseColourRange(const std::string &str, ColourRange &range) noexcept {
+    int values[6]{0, 0, 0, 0, 0, 0};
+    std::stringstream sstr{str};
+    std::string value;
+    int i{0};
+    while ( std::getline(sstr, value, ',') && (i < 6) ) {
+        values[i] = std::atoi(value.c_str());
+        if ( (0 > values[i]) || (255 < values[i]) ) {
+            return false;
+        }
+        i++;
+    }
+    if (6 == i) {
+        range.minY = static_cast<uint8_t>(values[0]);
+        range.maxY = static_cast<uint8_t>(values[1]);
+        range.minU = static_cast<uint8_t>(values[2]);
+        range.maxU = static_cast<uint8_t>(values[3]);
+        range.minV = static_cast<uint8_t>(values[4]);
+        range.maxV = static_cast<uint8_t>(values[5]);
+    }
+    return (6 == i);
+}
+
+namespace coneSegmentation {
+
+////////////////////////////////////////////////////////////////////////////////
+// Scalar reference; all vectorised kernels produce identical labels.
+
+inline void rgbToYUV(int32_t r, int32_t g, int32_t b, int32_t &y, int32_t &u, int32_t &v) noexcept {
+    y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+inline bool inRange(int32_t x, uint8_t lo, uint8_t hi) noexcept {
+    return (lo <= x) && (x <= hi);
+}
+
+inline uint8_t classify(int32_t y, int32_t u, int32_t v, const SegmentationParameters &p) noexcept {
+    if (inRange(y, p.blue.minY, p.blue.maxY) && inRange(u, p.blue.minU, p.blue.maxU) && inRange(v, p.blue.minV, p.blue.maxV)) {
+        return CONE_BLUE;
+    }
+    if (inRange(y, p.yellow.minY, p.yellow.maxY) && inRange(u, p.yellow.minU, p.yellow.maxU) && inRange(v, p.yellow.minV, p.yellow.maxV)) {
+        return CONE_YELLOW;
+    }
+    return CONE_NONE;
+}
+
+inline void segmentBGRARowScalar(const uint8_t *src, uint8_t *mask, uint32_t from, uint32_t to, const SegmentationParameters &p) noexcept {
+    for (uint32_t x{from}; x < to; x++) {
+        int32_t y, u, v;
+        rgbToYUV(src[4 * x + 2], src[4 * x + 1], src[4 * x + 0], y, u, v);
+        mask[x] = classify(y, u, v, p);
+    }
+}
+
+// Processes the two luma rows y0, y1 that share one chroma row.
+inline void segmentI420RowPairScalar(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+                                     uint8_t *mask0, uint8_t *mask1, uint32_t from, uint32_t to, const SegmentationParameters &p) noexcept {
+    for (uint32_t x{from}; x < to; x++) {
+        mask0[x] = classify(y0[x], u[x / 2], v[x / 2], p);
+        if (nullptr != y1) {
+            mask1[x] = classify(y1[x], u[x / 2], v[x / 2], p);
+        }
+    }
+}
+
+#ifdef CONE_SEGMENTATION_X86
+////////////////////////////////////////////////////////////////////////////////
+// SSE2 (baseline on x86-64).
+
+// lo <= x <= hi for unsigned bytes.
+inline __m128i inRangeSSE2(__m128i x, __m128i lo, __m128i hi) noexcept {
+    return _mm_cmpeq_epi8(_mm_min_epu8(_mm_max_epu8(x, lo), hi), x);
+}
+
+inline __m128i labelsSSE2(__m128i isBlue, __m128i isYellow) noexcept {
+    return _mm_or_si128(_mm_and_si128(isBlue, _mm_set1_epi8(CONE_BLUE)),
+                        _mm_andnot_si128(isBlue, _mm_and_si128(isYellow, _mm_set1_epi8(CONE_YELLOW))));
+}
+
+// Converts 8 pixels given as 16-bit B, G, R into 16-bit Y, U, V.
+inline void rgbToYUVSSE2(__m128i r, __m128i g, __m128i b, __m128i &y, __m128i &u, __m128i &v) noexcept {
+    const __m128i ROUND{_mm_set1_epi16(128)};
+    // Y does not fit into int16; its sum is treated as unsigned.
+    __m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129))),
+                              _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)), ROUND));
+    y = _mm_add_epi16(_mm_srli_epi16(t, 8), _mm_set1_epi16(16));
+    t = _mm_add_epi16(_mm_sub_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(112)), _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(38)), _mm_mullo_epi16(g, _mm_set1_epi16(74)))), ROUND);
+    u = _mm_add_epi16(_mm_srai_epi16(t, 8), _mm_set1_epi16(128));
+    t = _mm_add_epi16(_mm_sub_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(112)), _mm_add_epi16(_mm_mullo_epi16(g, _mm_set1_epi16(94)), _mm_mullo_epi16(b, _mm_set1_epi16(18)))), ROUND);
+    v = _mm_add_epi16(_mm_srai_epi16(t, 8), _mm_set1_epi16(128));
+}
+
+inline uint32_t segmentBGRARowSSE2(const uint8_t *src, uint8_t *mask, uint32_t width, const SegmentationParameters &p) noexcept {
+    const __m128i LOW_BYTE{_mm_set1_epi32(0xff)};
+    const __m128i BLUE_Y_MIN{_mm_set1_epi8(static_cast<char>(p.blue.minY))}, BLUE_Y_MAX{_mm_set1_epi8(static_cast<char>(p.blue.maxY))};
+    const __m128i BLUE_U_MIN{_mm_set1_epi8(static_cast<char>(p.blue.minU))}, BLUE_U_MAX{_mm_set1_epi8(static_cast<char>(p.blue.maxU))};
+    const __m128i BLUE_V_MIN{_mm_set1_epi8(static_cast<char>(p.blue.minV))}, BLUE_V_MAX{_mm_set1_epi8(static_cast<char>(p.blue.maxV))};
+    const __m128i YELLOW_Y_MIN{_mm_set1_epi8(static_cast<char>(p.yellow.minY))}, YELLOW_Y_MAX{_mm_set1_epi8(static_cast<char>(p.yellow.maxY))};
+    const __m128i YELLOW_U_MIN{_mm_set1_epi8(static_cast<char>(p.yellow.minU))}, YELLOW_U_MAX{_mm_set1_epi8(static_cast<char>(p.yellow.maxU))};
+    const __m128i YELLOW_V_MIN{_mm_set1_epi8(static_cast<char>(p.yellow.minV))}, YELLOW_V_MAX{_mm_set1_epi8(static_cast<char>(p.yellow.maxV))};
+
+    uint32_t x{0};
+    for (; x + 16 <= width; x += 16) {
+        const __m128i *s = reinterpret_cast<const __m128i*>(src + 4 * x);
+        const __m128i P0{_mm_loadu_si128(s + 0)}, P1{_mm_loadu_si128(s + 1)}, P2{_mm_loadu_si128(s + 2)}, P3{_mm_loadu_si128(s + 3)};
+
+        // Deinterleave B, G, R into 16-bit lanes: pixels 0..7 and 8..15.
+        const __m128i B0{_mm_packs_epi32(_mm_and_si128(P0, LOW_BYTE), _mm_and_si128(P1, LOW_BYTE))};
+        const __m128i B1{_mm_packs_epi32(_mm_and_si128(P2, LOW_BYTE), _mm_and_si128(P3, LOW_BYTE))};
+        const __m128i G0{_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(P0, 8), LOW_BYTE), _mm_and_si128(_mm_srli_epi32(P1, 8), LOW_BYTE))};
+        const __m128i G1{_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(P2, 8), LOW_BYTE), _mm_and_si128(_mm_srli_epi32(P3, 8), LOW_BYTE))};
+        const __m128i R0{_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(P0, 16), LOW_BYTE), _mm_and_si128(_mm_srli_epi32(P1, 16), LOW_BYTE))};
+        const __m128i R1{_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(P2, 16), LOW_BYTE), _mm_and_si128(_mm_srli_epi32(P3, 16), LOW_BYTE))};
+
+        __m128i y0, u0, v0, y1, u1, v1;
+        rgbToYUVSSE2(R0, G0, B0, y0, u0, v0);
+        rgbToYUVSSE2(R1, G1, B1, y1, u1, v1);
+        const __m128i Y{_mm_packus_epi16(y0, y1)};
+        const __m128i U{_mm_packus_epi16(u0, u1)};
+        const __m128i V{_mm_packus_epi16(v0, v1)};
+
+        const __m128i IS_BLUE{_mm_and_si128(_mm_and_si128(inRangeSSE2(Y, BLUE_Y_MIN, BLUE_Y_MAX), inRangeSSE2(U, BLUE_U_MIN, BLUE_U_MAX)), inRangeSSE2(V, BLUE_V_MIN, BLUE_V_MAX))};
+        const __m128i IS_YELLOW{_mm_and_si128(_mm_and_si128(inRangeSSE2(Y, YELLOW_Y_MIN, YELLOW_Y_MAX), inRangeSSE2(U, YELLOW_U_MIN, YELLOW_U_MAX)), inRangeSSE2(V, YELLOW_V_MIN, YELLOW_V_MAX))};
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(mask + x), labelsSSE2(IS_BLUE, IS_YELLOW));
+    }
+    return x;
+}
+
+inline uint32_t segmentI420RowPairSSE2(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+                                       uint8_t *mask0, uint8_t *mask1, uint32_t width, const SegmentationParameters &p) noexcept {
+    const __m128i BLUE_Y_MIN{_mm_set1_epi8(static_cast<char>(p.blue.minY))}, BLUE_Y_MAX{_mm_set1_epi8(static_cast<char>(p.blue.maxY))};
+    const __m128i BLUE_U_MIN{_mm_set1_epi8(static_cast<char>(p.blue.minU))}, BLUE_U_MAX{_mm_set1_epi8(static_cast<char>(p.blue.maxU))};
+    const __m128i BLUE_V_MIN{_mm_set1_epi8(static_cast<char>(p.blue.minV))}, BLUE_V_MAX{_mm_set1_epi8(static_cast<char>(p.blue.maxV))};
+    const __m128i YELLOW_Y_MIN{_mm_set1_epi8(static_cast<char>(p.yellow.minY))}, YELLOW_Y_MAX{_mm_set1_epi8(static_cast<char>(p.yellow.maxY))};
+    const __m128i YELLOW_U_MIN{_mm_set1_epi8(static_cast<char>(p.yellow.minU))}, YELLOW_U_MAX{_mm_set1_epi8(static_cast<char>(p.yellow.maxU))};
+    const __m128i YELLOW_V_MIN{_mm_set1_epi8(static_cast<char>(p.yellow.minV))}, YELLOW_V_MAX{_mm_set1_epi8(static_cast<char>(p.yellow.maxV))};
+
+    uint32_t x{0};
+    for (; x + 16 <= width; x += 16) {
+        // 8 chroma samples cover 16 luma samples; duplicate each.
+        const __m128i U8{_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x / 2))};
+        const __m128i V8{_mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + x / 2))};
+        const __m128i U{_mm_unpacklo_epi8(U8, U8)};
+        const __m128i V{_mm_unpacklo_epi8(V8, V8)};
+        const __m128i BLUE_UV{_mm_and_si128(inRangeSSE2(U, BLUE_U_MIN, BLUE_U_MAX), inRangeSSE2(V, BLUE_V_MIN, BLUE_V_MAX))};
+        const __m128i YELLOW_UV{_mm_and_si128(inRangeSSE2(U, YELLOW_U_MIN, YELLOW_U_MAX), inRangeSSE2(V, YELLOW_V_MIN, YELLOW_V_MAX))};
+
+        const __m128i Y0{_mm_loadu_si128(reinterpret_cast<const __m128i*>(y0 + x))};
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(mask0 + x), labelsSSE2(_mm_and_si128(BLUE_UV, inRangeSSE2(Y0, BLUE_Y_MIN, BLUE_Y_MAX)),
+                                                                          _mm_and_si128(YELLOW_UV, inRangeSSE2(Y0, YELLOW_Y_MIN, YELLOW_Y_MAX))));
+        if (nullptr != y1) {
+            const __m128i Y1{_mm_loadu_si128(reinterpret_cast<const __m128i*>(y1 + x))};
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(mask1 + x), labelsSSE2(_mm_and_si128(BLUE_UV, inRangeSSE2(Y1, BLUE_Y_MIN, BLUE_Y_MAX)),
+                                                                              _mm_and_si128(YELLOW_UV, inRangeSSE2(Y1, YELLOW_Y_MIN, YELLOW_Y_MAX))));
+        }
+    }
+    return x;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// AVX2; compiled for this target only and used after checking the CPU.
+
+__attribute__((target("avx2"))) inline __m256i inRangeAVX2(__m256i x, __m256i lo, __m256i hi) noexcept {
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_max_epu8(x, lo), hi), x);
+}
+
+__attribute__((target("avx2"))) inline __m256i labelsAVX2(__m256i isBlue, __m256i isYellow) noexcept {
+    return _mm256_or_si256(_mm256_and_si256(isBlue, _mm256_set1_epi8(CONE_BLUE)),
+                           _mm256_andnot_si256(isBlue, _mm256_and_si256(isYellow, _mm256_set1_epi8(CONE_YELLOW))));
+}
+
+__attribute__((target("avx2"))) inline void rgbToYUVAVX2(__m256i r, __m256i g, __m256i b, __m256i &y, __m256i &u, __m256i &v) noexcept {
+    const __m256i ROUND{_mm256_set1_epi16(128)};
+    __m256i t = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(66)), _mm256_mullo_epi16(g, _mm256_set1_epi16(129))),
+                                 _mm256_add_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16(25)), ROUND));
+    y = _mm256_add_epi16(_mm256_srli_epi16(t, 8), _mm256_set1_epi16(16));
+    t = _mm256_add_epi16(_mm256_sub_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16(112)), _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(38)), _mm256_mullo_epi16(g, _mm256_set1_epi16(74)))), ROUND);
+    u = _mm256_add_epi16(_mm256_srai_epi16(t, 8), _mm256_set1_epi16(128));
+    t = _mm256_add_epi16(_mm256_sub_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(112)), _mm256_add_epi16(_mm256_mullo_epi16(g, _mm256_set1_epi16(94)), _mm256_mullo_epi16(b, _mm256_set1_epi16(18)))), ROUND);
+    v = _mm256_add_epi16(_mm256_srai_epi16(t, 8), _mm256_set1_epi16(128));
+}
+
+__attribute__((target("avx2"))) inline uint32_t segmentBGRARowAVX2(const uint8_t *src, uint8_t *mask, uint32_t width, const SegmentationParameters &p) noexcept {
+    const __m256i LOW_BYTE{_mm256_set1_epi32(0xff)};
+    // The in-lane packs below leave groups of four pixels in the order 0,2,4,6,1,3,5,7.
+    const __m256i UNSCRAMBLE{_mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)};
+    const __m256i BLUE_Y_MIN{_mm256_set1_epi8(static_cast<char>(p.blue.minY))}, BLUE_Y_MAX{_mm256_set1_epi8(static_cast<char>(p.blue.maxY))};
+    const __m256i BLUE_U_MIN{_mm256_set1_epi8(static_cast<char>(p.blue.minU))}, BLUE_U_MAX{_mm256_set1_epi8(static_cast<char>(p.blue.maxU))};
+    const __m256i BLUE_V_MIN{_mm256_set1_epi8(static_cast<char>(p.blue.minV))}, BLUE_V_MAX{_mm256_set1_epi8(static_cast<char>(p.blue.maxV))};
+    const __m256i YELLOW_Y_MIN{_mm256_set1_epi8(static_cast<char>(p.yellow.minY))}, YELLOW_Y_MAX{_mm256_set1_epi8(static_cast<char>(p.yellow.maxY))};
+    const __m256i YELLOW_U_MIN{_mm256_set1_epi8(static_cast<char>(p.yellow.minU))}, YELLOW_U_MAX{_mm256_set1_epi8(static_cast<char>(p.yellow.maxU))};
+    const __m256i YELLOW_V_MIN{_mm256_set1_epi8(static_cast<char>(p.yellow.minV))}, YELLOW_V_MAX{_mm256_set1_epi8(static_cast<char>(p.yellow.maxV))};
+
+    uint32_t x{0};
+    for (; x + 32 <= width; x += 32) {
+        const __m256i *s = reinterpret_cast<const __m256i*>(src + 4 * x);
+        const __m256i P0{_mm256_loadu_si256(s + 0)}, P1{_mm256_loadu_si256(s + 1)}, P2{_mm256_loadu_si256(s + 2)}, P3{_mm256_loadu_si256(s + 3)};
+
+        const __m256i B0{_mm256_packs_epi32(_mm256_and_si256(P0, LOW_BYTE), _mm256_and_si256(P1, LOW_BYTE))};
+        const __m256i B1{_mm256_packs_epi32(_mm256_and_si256(P2, LOW_BYTE), _mm256_and_si256(P3, LOW_BYTE))};
+        const __m256i G0{_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(P0, 8), LOW_BYTE), _mm256_and_si256(_mm256_srli_epi32(P1, 8), LOW_BYTE))};
+        const __m256i G1{_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(P2, 8), LOW_BYTE), _mm256_and_si256(_mm256_srli_epi32(P3, 8), LOW_BYTE))};
+        const __m256i R0{_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(P0, 16), LOW_BYTE), _mm256_and_si256(_mm256_srli_epi32(P1, 16), LOW_BYTE))};
+        const __m256i R1{_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(P2, 16), LOW_BYTE), _mm256_and_si256(_mm256_srli_epi32(P3, 16), LOW_BYTE))};
+
+        __m256i y0, u0, v0, y1, u1, v1;
+        rgbToYUVAVX2(R0, G0, B0, y0, u0, v0);
+        rgbToYUVAVX2(R1, G1, B1, y1, u1, v1);
+        const __m256i Y{_mm256_packus_epi16(y0, y1)};
+        const __m256i U{_mm256_packus_epi16(u0, u1)};
+        const __m256i V{_mm256_packus_epi16(v0, v1)};
+
+        const __m256i IS_BLUE{_mm256_and_si256(_mm256_and_si256(inRangeAVX2(Y, BLUE_Y_MIN, BLUE_Y_MAX), inRangeAVX2(U, BLUE_U_MIN, BLUE_U_MAX)), inRangeAVX2(V, BLUE_V_MIN, BLUE_V_MAX))};
+        const __m256i IS_YELLOW{_mm256_and_si256(_mm256_and_si256(inRangeAVX2(Y, YELLOW_Y_MIN, YELLOW_Y_MAX), inRangeAVX2(U, YELLOW_U_MIN, YELLOW_U_MAX)), inRangeAVX2(V, YELLOW_V_MIN, YELLOW_V_MAX))};
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(mask + x), _mm256_permutevar8x32_epi32(labelsAVX2(IS_BLUE, IS_YELLOW), UNSCRAMBLE));
+    }
+    return x;
+}
+
+__attribute__((target("avx2"))) inline uint32_t segmentI420RowPairAVX2(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+                                                                       uint8_t *mask0, uint8_t *mask1, uint32_t width, const SegmentationParameters &p) noexcept {
+    const __m256i BLUE_Y_MIN{_mm256_set1_epi8(static_cast<char>(p.blue.minY))}, BLUE_Y_MAX{_mm256_set1_epi8(static_cast<char>(p.blue.maxY))};
+    const __m256i BLUE_U_MIN{_mm256_set1_epi8(static_cast<char>(p.blue.minU))}, BLUE_U_MAX{_mm256_set1_epi8(static_cast<char>(p.blue.maxU))};
+    const __m256i BLUE_V_MIN{_mm256_set1_epi8(static_cast<char>(p.blue.minV))}, BLUE_V_MAX{_mm256_set1_epi8(static_cast<char>(p.blue.maxV))};
+    const __m256i YELLOW_Y_MIN{_mm256_set1_epi8(static_cast<char>(p.yellow.minY))}, YELLOW_Y_MAX{_mm256_set1_epi8(static_cast<char>(p.yellow.maxY))};
+    const __m256i YELLOW_U_MIN{_mm256_set1_epi8(static_cast<char>(p.yellow.minU))}, YELLOW_U_MAX{_mm256_set1_epi8(static_cast<char>(p.yellow.maxU))};
+    const __m256i YELLOW_V_MIN{_mm256_set1_epi8(static_cast<char>(p.yellow.minV))}, YELLOW_V_MAX{_mm256_set1_epi8(static_cast<char>(p.yellow.maxV))};
+
+    uint32_t x{0};
+    for (; x + 32 <= width; x += 32) {
+        // 16 chroma samples cover 32 luma samples; duplicate each.
+        const __m128i U16{_mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x / 2))};
+        const __m128i V16{_mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x / 2))};
+        const __m256i U{_mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(U16, U16)), _mm_unpackhi_epi8(U16, U16), 1)};
+        const __m256i V{_mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(V16, V16)), _mm_unpackhi_epi8(V16, V16), 1)};
+        const __m256i BLUE_UV{_mm256_and_si256(inRangeAVX2(U, BLUE_U_MIN, BLUE_U_MAX), inRangeAVX2(V, BLUE_V_MIN, BLUE_V_MAX))};
+        const __m256i YELLOW_UV{_mm256_and_si256(inRangeAVX2(U, YELLOW_U_MIN, YELLOW_U_MAX), inRangeAVX2(V, YELLOW_V_MIN, YELLOW_V_MAX))};
+
+        const __m256i Y0{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(y0 + x))};
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(mask0 + x), labelsAVX2(_mm256_and_si256(BLUE_UV, inRangeAVX2(Y0, BLUE_Y_MIN, BLUE_Y_MAX)),
+                                                                             _mm256_and_si256(YELLOW_UV, inRangeAVX2(Y0, YELLOW_Y_MIN, YELLOW_Y_MAX))));
+        if (nullptr != y1) {
+            const __m256i Y1{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(y1 + x))};
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(mask1 + x), labelsAVX2(_mm256_and_si256(BLUE_UV, inRangeAVX2(Y1, BLUE_Y_MIN, BLUE_Y_MAX)),
+                                                                                 _mm256_and_si256(YELLOW_UV, inRangeAVX2(Y1, YELLOW_Y_MIN, YELLOW_Y_MAX))));
+        }
+    }
+    return x;
+}
+#endif
+
+#ifdef CONE_SEGMENTATION_NEON
+////////////////////////////////////////////////////////////////////////////////
+// NEON; compiled with NEON enabled in cone-segmentation-neon.cpp and used
+// after checking the CPU.
+
+uint32_t segmentBGRARowNEON(const uint8_t *src, uint8_t *mask, uint32_t width, const SegmentationParameters &p) noexcept;
+uint32_t segmentI420RowPairNEON(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+                                uint8_t *mask0, uint8_t *mask1, uint32_t width, const SegmentationParameters &p) noexcept;
+#endif
+
+} // namespace coneSegmentation
+
+/**
+ * ConeSegmentation selects the fastest available kernel once and applies
+ * it to whole frames or bands of rows.
+ */
+class ConeSegmentation {
+   public:
+    enum class Path { SCALAR, SSE2, AVX2, NEON };
+
+    /**
+     * Constructor.
+     *
+     * @param parameters Colour ranges for blue and yellow cones.
+     * @param preferred Name of the kernel to use ("scalar", "sse2", "avx2",
+     *        "neon"); empty, unknown, or unsupported names select the fastest
+     *        one. Check names with parsePath() and supported() to reject them.
+     */
+    explicit ConeSegmentation(const SegmentationParameters &parameters, const std::string &preferred = "") noexcept
+        : m_parameters(parameters)
+        , m_path(fastestPath()) {
+        Path path{Path::SCALAR};
+        if (parsePath(preferred, path) && supported(path)) {
+            m_path = path;
+        }
+    }
+
+    /**
+     * This method parses the name of a kernel; an empty name selects the fastest one.
+     *
+     * @return false if the name is none of "scalar", "sse2", "avx2", "neon".
+     */
+    static bool parsePath(const std::string &name, Path &path) noexcept {
+        if (name.empty()) {
+            path = fastestPath();
+        }
+        else if ("scalar" == name) {
+            path = Path::SCALAR;
+        }
+        else if ("sse2" == name) {
+            path = Path::SSE2;
+        }
+        else if ("avx2" == name) {
+            path = Path::AVX2;
+        }
+        else if ("neon" == name) {
+            path = Path::NEON;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @return true if the kernel is compiled in and the CPU supports it.
+     */
+    static bool supported(Path path) noexcept {
+        switch (path) {
+            case Path::SCALAR: return true;
+#ifdef CONE_SEGMENTATION_X86
+            case Path::SSE2: __builtin_cpu_init(); return __builtin_cpu_supports("sse2");
+            case Path::AVX2: __builtin_cpu_init(); return __builtin_cpu_supports("avx2");
+#endif
+#if defined(CONE_SEGMENTATION_NEON) && defined(__aarch64__)
+            case Path::NEON: return true;
+#elif defined(CONE_SEGMENTATION_NEON) && defined(__linux__)
+            case Path::NEON: return (0 != (::getauxval(AT_HWCAP) & HWCAP_NEON));
+#endif
+            default: return false;
+        }
+    }
+
+    static Path fastestPath() noexcept {
+        for (const Path path : {Path::AVX2, Path::SSE2, Path::NEON}) {
+            if (supported(path)) {
+                return path;
+            }
+        }
+        return Path::SCALAR;
+    }
+
+    Path path() const noexcept {
+        return m_path;
+    }
+
+    std::string pathName() const noexcept {
+        switch (m_path) {
+            case Path::SSE2: return "SSE2";
+            case Path::AVX2: return "AVX2";
+            case Path::NEON: return "NEON";
+            default: return "scalar";
+        }
+    }
+
+    const SegmentationParameters &parameters() const noexcept {
+        return m_parameters;
+    }
+
+    /**
+     * This method labels the rows [firstRow, lastRow) of an ARGB (B, G, R, A in memory) image.
+     */
+    void segmentBGRA(const uint8_t *src, uint32_t srcStride, uint32_t width, uint32_t firstRow, uint32_t lastRow, uint8_t *mask, uint32_t maskStride) const noexcept {
+        for (uint32_t r{firstRow}; r < lastRow; r++) {
+            const uint8_t *s{src + static_cast<std::size_t>(r) * srcStride};
+            uint8_t *m{mask + static_cast<std::size_t>(r) * maskStride};
+            uint32_t x{0};
+            switch (m_path) {
+#ifdef CONE_SEGMENTATION_X86
+                case Path::AVX2: x = coneSegmentation::segmentBGRARowAVX2(s, m, width, m_parameters); break;
+                case Path::SSE2: x = coneSegmentation::segmentBGRARowSSE2(s, m, width, m_parameters); break;
+#endif
+#ifdef CONE_SEGMENTATION_NEON
+                case Path::NEON: x = coneSegmentation::segmentBGRARowNEON(s, m, width, m_parameters); break;
+#endif
+                default: break;
+            }
+            coneSegmentation::segmentBGRARowScalar(s, m, x, width, m_parameters);
+        }
+    }
+
+    /**
+     * This method labels the rows [firstRow, lastRow) of an I420 image; firstRow must be even.
+     */
+    void segmentI420(const uint8_t *y, uint32_t yStride, const uint8_t *u, const uint8_t *v, uint32_t uvStride,
+                     uint32_t width, uint32_t firstRow, uint32_t lastRow, uint8_t *mask, uint32_t maskStride) const noexcept {
+        for (uint32_t r{firstRow}; r < lastRow; r += 2) {
+            const uint8_t *y0{y + static_cast<std::size_t>(r) * yStride};
+            const uint8_t *y1{(r + 1 < lastRow) ? y0 + yStride : nullptr};
+            const uint8_t *uRow{u + static_cast<std::size_t>(r / 2) * uvStride};
+            const uint8_t *vRow{v + static_cast<std::size_t>(r / 2) * uvStride};
+            uint8_t *m0{mask + static_cast<std::size_t>(r) * maskStride};
+            uint8_t *m1{m0 + maskStride};
+            uint32_t x{0};
+            switch (m_path) {
+#ifdef CONE_SEGMENTATION_X86
+                case Path::AVX2: x = coneSegmentation::segmentI420RowPairAVX2(y0, y1, uRow, vRow, m0, m1, width, m_parameters); break;
+                case Path::SSE2: x = coneSegmentation::segmentI420RowPairSSE2(y0, y1, uRow, vRow, m0, m1, width, m_parameters); break;
+#endif
+#ifdef CONE_SEGMENTATION_NEON
+                case Path::NEON: x = coneSegmentation::segmentI420RowPairNEON(y0, y1, uRow, vRow, m0, m1, width, m_parameters); break;
+#endif
+                default: break;
+            }
+            coneSegmentation::segmentI420RowPairScalar(y0, y1, uRow, vRow, m0, m1, x, width, m_parameters);
+        }
+    }
+
+   private:
+    SegmentationParameters m_parameters;
+    Path m_path;
+};
+
+#endif
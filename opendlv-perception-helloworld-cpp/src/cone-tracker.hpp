@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONE_TRACKER_HPP
+#define CONE_TRACKER_HPP
+
+#include "cone-blobs.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+struct TrackerParameters {
+    float processNoise{2000.0f};     // Pixels/s^2; how quickly a cone may change its image velocity.
+    float measurementNoise{2.0f};    // Pixels; standard deviation of a detected cone's position.
+    float gate{9.21f};               // Squared Mahalanobis distance for an association (99% for 2 DOF).
+    uint32_t minHits{2};             // Detections before a track is published.
+    uint32_t maxMisses{5};           // Frames a track is predicted without detection before it is dropped.
+};
+
+/**
+ * ConeTracker follows cones from frame to frame in image coordinates.
+ *
+ * Every track is a constant-velocity Kalman filter on the base point of a
+ * cone (column of its centroid and its bottom row); both axes are filtered
+ * independently. Detections are associated greedily to the nearest
+ * predicted track of the same colour within a gate on the Mahalanobis
+ * distance. Unassociated detections start new tracks; tracks that miss
+ * detections are predicted for a few frames before they are dropped.
+ *
+ * Each track keeps its identity for its whole life; hence, consumers get
+ * stable object identifiers, and the detector may look only around the
+ * predicted cones for most of the frames.
+ */
+class ConeTracker {
+   public:
+    static constexpr uint32_t MAX_TRACKS{2 * ConeDetections::MAX_CONES};
+
+   private:
+    ConeTracker(const ConeTracker &) = delete;
+    ConeTracker(ConeTracker &&)      = delete;
+    ConeTracker &operator=(const ConeTracker &) = delete;
+    ConeTracker &operator=(ConeTracker &&) = delete;
+
+   public:
+    explicit ConeTracker(const TrackerParameters &parameters) noexcept
+        : m_parameters(parameters) {}
+
+    /**
+     * This method updates the tracks with the detections of a frame and
+     * replaces the detections by the published tracks: detected cones with
+     * their track's identity, and recently missed cones at their predicted
+     * position.
+     *
+     * @param detections Cones found in the frame; replaced by the tracked cones.
+     * @param timeStamp Sample time of the frame in microseconds.
+     */
+    void update(ConeDetections &detections, int64_t timeStamp) noexcept {
+        // Time since the last frame; assume 30 Hz if the time stamps do not tell.
+        float dt{1.0f / 30.0f};
+        if ( (0 < m_lastTimeStamp) && (timeStamp > m_lastTimeStamp) ) {
+            dt = std::min(1.0f, static_cast<float>(timeStamp - m_lastTimeStamp) * 1e-6f);
+        }
+        m_lastTimeStamp = timeStamp;
+
+        for (uint32_t t{0}; t < m_count; t++) {
+            predict(m_tracks[t], dt);
+        }
+
+        // Gather all candidate pairs within the gate and associate the closest first.
+        m_pairCount = 0;
+        for (uint32_t t{0}; t < m_count; t++) {
+            for (uint32_t d{0}; d < detections.count; d++) {
+                const ConeBlob &cone{detections.cones[d]};
+                if (m_tracks[t].blob.label != cone.label) {
+                    continue;
+                }
+                const float DISTANCE{mahalanobis(m_tracks[t], cone.centerX, static_cast<float>(cone.bottom))};
+                if ( (DISTANCE <= m_parameters.gate) && (m_pairCount < m_pairs.size()) ) {
+                    m_pairs[m_pairCount++] = Pair{DISTANCE, t, d};
+                }
+            }
+        }
+        std::sort(m_pairs.begin(), m_pairs.begin() + m_pairCount, [](const Pair &a, const Pair &b) { return a.distance < b.distance; });
+
+        std::array<bool, MAX_TRACKS> trackUsed{};
+        std::array<bool, ConeDetections::MAX_CONES> detectionUsed{};
+        for (uint32_t i{0}; i < m_pairCount; i++) {
+            const Pair &p{m_pairs[i]};
+            if (trackUsed[p.track] || detectionUsed[p.detection]) {
+                continue;
+            }
+            trackUsed[p.track] = true;
+            detectionUsed[p.detection] = true;
+            correct(m_tracks[p.track], detections.cones[p.detection]);
+        }
+
+        // Tracks without detection coast on their prediction for a while.
+        for (uint32_t t{0}; t < m_count; t++) {
+            if (!trackUsed[t]) {
+                Track &track{m_tracks[t]};
+                track.misses++;
+                shift(track.blob, track.u[0] - track.blob.centerX, track.v[0] - static_cast<float>(track.blob.bottom));
+            }
+        }
+        uint32_t kept{0};
+        for (uint32_t t{0}; t < m_count; t++) {
+            if (m_tracks[t].misses <= m_parameters.maxMisses) {
+                m_tracks[kept++] = m_tracks[t];
+            }
+        }
+        m_count = kept;
+
+        // Everything else starts a new track.
+        for (uint32_t d{0}; (d < detections.count) && (m_count < MAX_TRACKS); d++) {
+            if (!detectionUsed[d]) {
+                start(m_tracks[m_count++], detections.cones[d]);
+            }
+        }
+
+        // Publish the confirmed tracks.
+        detections.count = 0;
+        for (uint32_t t{0}; (t < m_count) && (detections.count < ConeDetections::MAX_CONES); t++) {
+            if (m_tracks[t].hits >= m_parameters.minHits) {
+                detections.cones[detections.count++] = m_tracks[t].blob;
+            }
+        }
+    }
+
+   private:
+    struct Track {
+        ConeBlob blob{};       // Latest detection, or prediction while coasting; blob.id is the track's identity.
+        float u[2]{0, 0};      // Column and its velocity.
+        float v[2]{0, 0};      // Row and its velocity.
+        float pu[3]{0, 0, 0};  // Covariance of u as p00, p01, p11.
+        float pv[3]{0, 0, 0};  // Covariance of v as p00, p01, p11.
+        uint32_t hits{0};
+        uint32_t misses{0};
+    };
+
+    struct Pair {
+        float distance;
+        uint32_t track;
+        uint32_t detection;
+    };
+
+    void start(Track &track, const ConeBlob &cone) noexcept {
+        track = Track{};
+        track.blob = cone;
+        track.blob.id = ++m_nextId;
+        track.u[0] = cone.centerX;
+        track.v[0] = static_cast<float>(cone.bottom);
+        // The velocity is unknown; allow about 1000 pixels/s.
+        const float R{m_parameters.measurementNoise * m_parameters.measurementNoise};
+        track.pu[0] = track.pv[0] = R;
+        track.pu[2] = track.pv[2] = 1e6f;
+        track.hits = 1;
+    }
+
+    void predict(Track &track, float dt) const noexcept {
+        const float Q{m_parameters.processNoise * m_parameters.processNoise};
+        auto predictAxis = [dt, Q](float *x, float *p) {
+            x[0] += dt * x[1];
+            // P = F P F' + G Q G' with F = [1 dt; 0 1] and G = [dt^2/2; dt].
+            const float P00{p[0] + dt * (2.0f * p[1] + dt * p[2]) + 0.25f * dt * dt * dt * dt * Q};
+            const float P01{p[1] + dt * p[2] + 0.5f * dt * dt * dt * Q};
+            const float P11{p[2] + dt * dt * Q};
+            p[0] = P00;
+            p[1] = P01;
+            p[2] = P11;
+        };
+        predictAxis(track.u, track.pu);
+        predictAxis(track.v, track.pv);
+    }
+
+    float mahalanobis(const Track &track, float u, float v) const noexcept {
+        const float R{m_parameters.measurementNoise * m_parameters.measurementNoise};
+        const float DU{u - track.u[0]};
+        const float DV{v - track.v[0]};
+        return DU * DU / (track.pu[0] + R) + DV * DV / (track.pv[0] + R);
+    }
+
+    void correct(Track &track, const ConeBlob &cone) noexcept {
+        const float R{m_parameters.measurementNoise * m_parameters.measurementNoise};
+        auto correctAxis = [R](float *x, float *p, float z) {
+            const float S{p[0] + R};
+            const float K0{p[0] / S};
+            const float K1{p[1] / S};
+            const float INNOVATION{z - x[0]};
+            x[0] += K0 * INNOVATION;
+            x[1] += K1 * INNOVATION;
+            const float P00{(1.0f - K0) * p[0]};
+            const float P01{(1.0f - K0) * p[1]};
+            const float P11{p[2] - K1 * p[1]};
+            p[0] = P00;
+            p[1] = P01;
+            p[2] = P11;
+        };
+        correctAxis(track.u, track.pu, cone.centerX);
+        correctAxis(track.v, track.pv, static_cast<float>(cone.bottom));
+
+        const uint32_t ID{track.blob.id};
+        track.blob = cone;
+        track.blob.id = ID;
+        track.hits++;
+        track.misses = 0;
+    }
+
+    static void shift(ConeBlob &blob, float du, float dv) noexcept {
+        auto move = [](uint32_t x, float d) {
+            return static_cast<uint32_t>(std::max(0.0f, std::round(static_cast<float>(x) + d)));
+        };
+        blob.left = move(blob.left, du);
+        blob.right = move(blob.right, du);
+        blob.top = move(blob.top, dv);
+        blob.bottom = move(blob.bottom, dv);
+        blob.centerX += du;
+        blob.centerY += dv;
+    }
+
+   private:
+    const TrackerParameters m_parameters;
+    std::array<Track, MAX_TRACKS> m_tracks{};
+    uint32_t m_count{0};
+    std::array<Pair, MAX_TRACKS * ConeDetections::MAX_CONES> m_pairs{};
+    uint32_t m_pairCount{0};
+    uint32_t m_nextId{0};
+    int64_t m_lastTimeStamp{0};
+};
+
+#endif
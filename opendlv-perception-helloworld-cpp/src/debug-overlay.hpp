@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEBUG_OVERLAY_HPP
+#define DEBUG_OVERLAY_HPP
+
+#include "cluon-complete.hpp"
+#include "cone-blobs.hpp"
+#include "cone-segmentation.hpp"
+#include "frame-buffer-pool.hpp"
+#include "frame-ring.hpp"
+#include "frame-view.hpp"
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * DebugOverlay writes annotated frames into a shared memory area of their
+ * own instead of showing them in a window; hence, no display is needed,
+ * and a video encoder or viewer can attach to the area like to a camera.
+ *
+ * Each frame shows the labelled cone pixels in their colour, the processed
+ * region, every cone with its identity and distance, and a caption. The
+ * area holds a plain I420 or ARGB frame and is updated with lock/unlock
+ * and notifyAll() as a camera does.
+ *
+ * due() is meant for the stage that hands over frames, to limit the rate
+ * before anything is copied; write() is meant for a thread of its own.
+ */
+class DebugOverlay {
+   private:
+    DebugOverlay(const DebugOverlay &) = delete;
+    DebugOverlay(DebugOverlay &&)      = delete;
+    DebugOverlay &operator=(const DebugOverlay &) = delete;
+    DebugOverlay &operator=(DebugOverlay &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param name Name of the shared memory area to create.
+     * @param fourcc Pixel format to write (FOURCC_I420 or FOURCC_ARGB).
+     * @param rate Frames per second to write at most.
+     */
+    DebugOverlay(const std::string &name, uint32_t fourcc, float rate) noexcept
+        : m_name(name)
+        , m_fourcc(fourcc)
+        , m_period(std::chrono::microseconds(static_cast<int64_t>(1e6f / std::max(0.1f, rate)))) {}
+
+    /**
+     * This method decides whether the next frame should be written.
+     *
+     * @return True at most once per period.
+     */
+    bool due() noexcept {
+        const auto NOW{std::chrono::steady_clock::now()};
+        if (NOW - m_lastDue < m_period) {
+            return false;
+        }
+        m_lastDue = NOW;
+        return true;
+    }
+
+    /**
+     * @return Name of the shared memory area.
+     */
+    const std::string &name() const noexcept {
+        return m_name;
+    }
+
+    /**
+     * This method draws the overlay on a copy of the frame and writes it
+     * to the shared memory area, which is created for the first frame and
+     * whenever the frame size changes.
+     *
+     * @param info Description of the frame.
+     * @param pixels The frame.
+     * @param labels One label per pixel, info.width bytes per row.
+     * @param region Part of the frame that was processed.
+     * @param cones Cones found in the frame.
+     * @param caption Text to show at the top left.
+     * @return false if the shared memory area could not be created.
+     */
+    bool write(const FrameInfo &info, char *pixels, const uint8_t *labels, const FrameRegion &region, const ConeDetections &cones, const std::string &caption) noexcept {
+        if (!prepare(info.width, info.height)) {
+            return false;
+        }
+
+        // Bring the frame into the format of the area.
+        char *canvas{m_canvas.get()};
+        if (info.fourcc == m_info.fourcc) {
+            if (FOURCC_I420 == info.fourcc) {
+                wrapI420(info, pixels).yuv.copyTo(wrapI420(m_info, canvas).yuv);
+            }
+            else {
+                wrapARGB(info, pixels).copyTo(wrapARGB(m_info, canvas));
+            }
+        }
+        else if (FOURCC_I420 == info.fourcc) {
+            cv::Mat bgra{wrapARGB(m_info, canvas)};
+            cv::cvtColor(wrapI420(info, pixels).yuv, bgra, cv::COLOR_YUV2BGRA_I420);
+        }
+        else {
+            cv::Mat yuv{wrapI420(m_info, canvas).yuv};
+            cv::cvtColor(wrapARGB(info, pixels), yuv, cv::COLOR_BGRA2YUV_I420);
+        }
+
+        // Paint the labelled pixels, then the boxes and text on top.
+        const cv::Scalar BLUE{255, 0, 0};
+        const cv::Scalar YELLOW{0, 255, 255};
+        const cv::Scalar WHITE{255, 255, 255};
+        for (uint32_t y{0}; y < info.height; y++) {
+            const uint8_t *row{labels + static_cast<std::size_t>(y) * info.width};
+            for (uint32_t x{0}; x < info.width; x++) {
+                if (CONE_NONE != row[x]) {
+                    paint(canvas, x, y, (CONE_BLUE == row[x]) ? BLUE : YELLOW);
+                }
+            }
+        }
+        rectangle(canvas, cv::Rect(static_cast<int>(region.left), static_cast<int>(region.top),
+                                   static_cast<int>(region.right - region.left), static_cast<int>(region.bottom - region.top)), WHITE);
+        for (uint32_t i{0}; i < cones.count; i++) {
+            const ConeBlob &cone{cones.cones[i]};
+            const cv::Rect BOX{static_cast<int>(cone.left), static_cast<int>(cone.top),
+                               static_cast<int>(cone.right - cone.left + 1), static_cast<int>(cone.bottom - cone.top + 1)};
+            rectangle(canvas, BOX, (CONE_BLUE == cone.label) ? BLUE : YELLOW);
+            char label[32];
+            std::snprintf(label, sizeof(label), "%u %.2fm", cone.id, static_cast<double>(cone.distance));
+            text(canvas, label, cv::Point(BOX.x, std::max(10, BOX.y - 3)), WHITE);
+        }
+        text(canvas, caption, cv::Point(4, 14), WHITE);
+
+        m_sharedMemory->lock();
+        {
+            copyFrame(m_sharedMemory->data(), canvas, m_info.size);
+            m_sharedMemory->setTimeStamp(cluon::time::fromMicroseconds(info.sampleTimeStamp));
+        }
+        m_sharedMemory->unlock();
+        m_sharedMemory->notifyAll();
+        return true;
+    }
+
+   private:
+    bool prepare(uint32_t width, uint32_t height) noexcept {
+        if ( m_canvas && (width == m_info.width) && (height == m_info.height) ) {
+            return true;
+        }
+        m_info.fourcc = m_fourcc;
+        m_info.width = width;
+        m_info.height = height;
+        m_info.stride = (FOURCC_I420 == m_fourcc) ? width : width * 4;
+        m_info.size = (FOURCC_I420 == m_fourcc) ? width * height * 3 / 2 : width * height * 4;
+        m_canvas.reset();
+        m_sharedMemory.reset(new cluon::SharedMemory{m_name, m_info.size});
+        if (!m_sharedMemory->valid()) {
+            m_sharedMemory.reset();
+            return false;
+        }
+        m_pool.reset(new FrameBufferPool{1, m_info.size});
+        m_canvas = m_pool->acquire();
+        return static_cast<bool>(m_canvas);
+    }
+
+    // Colours are given as B, G, R; in I420, they are drawn into all three planes.
+    static cv::Scalar toYUV(const cv::Scalar &bgr) noexcept {
+        const double B{bgr[0]}, G{bgr[1]}, R{bgr[2]};
+        return cv::Scalar(0.299 * R + 0.587 * G + 0.114 * B,
+                          128.0 - 0.169 * R - 0.331 * G + 0.5 * B,
+                          128.0 + 0.5 * R - 0.419 * G - 0.081 * B);
+    }
+
+    void paint(char *canvas, uint32_t x, uint32_t y, const cv::Scalar &bgr) const noexcept {
+        if (FOURCC_I420 == m_info.fourcc) {
+            const cv::Scalar YUV{toYUV(bgr)};
+            const std::size_t LUMA{static_cast<std::size_t>(m_info.width) * m_info.height};
+            const std::size_t CHROMA{static_cast<std::size_t>(y / 2) * (m_info.width / 2) + x / 2};
+            canvas[static_cast<std::size_t>(y) * m_info.width + x] = static_cast<char>(YUV[0]);
+            canvas[LUMA + CHROMA] = static_cast<char>(YUV[1]);
+            canvas[LUMA + LUMA / 4 + CHROMA] = static_cast<char>(YUV[2]);
+        }
+        else {
+            char *pixel{canvas + static_cast<std::size_t>(y) * m_info.stride + x * 4};
+            pixel[0] = static_cast<char>(bgr[0]);
+            pixel[1] = static_cast<char>(bgr[1]);
+            pixel[2] = static_cast<char>(bgr[2]);
+        }
+    }
+
+    void rectangle(char *canvas, const cv::Rect &rect, const cv::Scalar &bgr) const noexcept {
+        if (FOURCC_I420 == m_info.fourcc) {
+            const cv::Scalar YUV{toYUV(bgr)};
+            I420View view{wrapI420(m_info, canvas)};
+            const cv::Rect HALF{rect.x / 2, rect.y / 2, std::max(1, rect.width / 2), std::max(1, rect.height / 2)};
+            cv::rectangle(view.y, rect, cv::Scalar(YUV[0]));
+            cv::rectangle(view.u, HALF, cv::Scalar(YUV[1]));
+            cv::rectangle(view.v, HALF, cv::Scalar(YUV[2]));
+        }
+        else {
+            cv::Mat bgra{wrapARGB(m_info, canvas)};
+            cv::rectangle(bgra, rect, cv::Scalar(bgr[0], bgr[1], bgr[2], 255));
+        }
+    }
+
+    void text(char *canvas, const std::string &str, const cv::Point &origin, const cv::Scalar &bgr) const noexcept {
+        if (FOURCC_I420 == m_info.fourcc) {
+            // Text is drawn into the luma plane only.
+            cv::Mat y{wrapI420(m_info, canvas).y};
+            cv::putText(y, str, origin, cv::FONT_HERSHEY_PLAIN, 1.0, cv::Scalar(toYUV(bgr)[0]));
+        }
+        else {
+            cv::Mat bgra{wrapARGB(m_info, canvas)};
+            cv::putText(bgra, str, origin, cv::FONT_HERSHEY_PLAIN, 1.0, cv::Scalar(bgr[0], bgr[1], bgr[2], 255));
+        }
+    }
+
+   private:
+    const std::string m_name;
+    const uint32_t m_fourcc;
+    const std::chrono::steady_clock::duration m_period;
+    std::chrono::steady_clock::time_point m_lastDue{};
+
+    FrameInfo m_info{};
+    std::unique_ptr<cluon::SharedMemory> m_sharedMemory{};
+    std::unique_ptr<FrameBufferPool> m_pool{};
+    FrameBufferPool::Handle m_canvas{nullptr, FrameBufferPool::Releaser{}};
+};
+
+#endif
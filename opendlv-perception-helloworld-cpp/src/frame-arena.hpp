@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_ARENA_HPP
+#define FRAME_ARENA_HPP
+
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * A FrameArena hands out the temporaries of one frame from a single block
+ * of memory by bumping a pointer; reset() at the end of the frame releases
+ * all of them at once.
+ *
+ * Requests that do not fit into the block are served from the heap and
+ * counted; at the next reset(), those blocks are freed and the block grows
+ * to the largest amount of memory a frame has needed so far. Thus, after
+ * the first frames, a frame never allocates.
+ *
+ * An arena belongs to one thread.
+ */
+class FrameArena {
+   public:
+    static constexpr std::size_t ALIGNMENT{64};
+    static constexpr uint32_t MAX_OVERFLOWS{32};
+
+   private:
+    FrameArena(const FrameArena &) = delete;
+    FrameArena(FrameArena &&)      = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+    FrameArena &operator=(FrameArena &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param capacity Initial size of the block in bytes.
+     */
+    explicit FrameArena(std::size_t capacity) noexcept {
+        grow(capacity);
+    }
+
+    ~FrameArena() noexcept {
+        release();
+        ::free(m_memory);
+    }
+
+    /**
+     * This method returns uninitialized memory that stays valid until the next reset().
+     *
+     * @param size Number of bytes.
+     * @param alignment Power of two up to ALIGNMENT.
+     * @return Pointer to the memory or nullptr if not even the heap has any left.
+     */
+    char *allocate(std::size_t size, std::size_t alignment = ALIGNMENT) noexcept {
+        const std::size_t BEGIN{(m_used + alignment - 1) & ~(alignment - 1)};
+        m_demand = ((m_demand + alignment - 1) & ~(alignment - 1)) + size;
+        m_highWater = std::max(m_highWater, m_demand);
+        if (BEGIN + size <= m_capacity) {
+            m_used = BEGIN + size;
+            return m_memory + BEGIN;
+        }
+
+        // Does not fit; borrow from the heap for this frame.
+        m_overflows++;
+        void *memory{nullptr};
+        if ( (m_numberOfOverflows < MAX_OVERFLOWS) && (0 == ::posix_memalign(&memory, ALIGNMENT, std::max<std::size_t>(size, 1))) ) {
+            m_overflow[m_numberOfOverflows++] = memory;
+            return static_cast<char*>(memory);
+        }
+        return nullptr;
+    }
+
+    /**
+     * This method wraps arena memory as matrix that stays valid until the
+     * next reset(); the matrix neither owns nor frees it.
+     *
+     * @return Matrix of rows x cols elements of type, or an empty matrix if no memory is left.
+     */
+    cv::Mat mat(int32_t rows, int32_t cols, int32_t type) noexcept {
+        const std::size_t STEP{(static_cast<std::size_t>(cols) * CV_ELEM_SIZE(type) + 15) & ~static_cast<std::size_t>(15)};
+        char *data{allocate(STEP * static_cast<std::size_t>(rows))};
+        return (nullptr == data) ? cv::Mat() : cv::Mat(rows, cols, type, data, STEP);
+    }
+
+    /**
+     * This method releases everything handed out since the last reset(), and
+     * grows the block if the frame needed more than it holds.
+     */
+    void reset() noexcept {
+        release();
+        if (m_demand > m_capacity) {
+            grow(m_demand);
+        }
+        m_used = 0;
+        m_demand = 0;
+    }
+
+    /**
+     * @return Bytes handed out from the block since the last reset().
+     */
+    std::size_t used() const noexcept {
+        return m_used;
+    }
+
+    /**
+     * @return Most bytes that one frame has asked for.
+     */
+    std::size_t highWater() const noexcept {
+        return m_highWater;
+    }
+
+    /**
+     * @return Number of requests that had to be served from the heap.
+     */
+    uint64_t overflows() const noexcept {
+        return m_overflows;
+    }
+
+   private:
+    void grow(std::size_t capacity) noexcept {
+        // Round up generously so that a frame that needs a little more
+        // than the last one does not make us grow again.
+        const std::size_t CAPACITY{(capacity + capacity / 4 + ALIGNMENT - 1) & ~(ALIGNMENT - 1)};
+        void *memory{nullptr};
+        if ( (0 < CAPACITY) && (0 == ::posix_memalign(&memory, ALIGNMENT, CAPACITY)) ) {
+            ::free(m_memory);
+            m_memory = static_cast<char*>(memory);
+            m_capacity = CAPACITY;
+            // Touch all pages once so that no page faults occur in the frame loop.
+            std::memset(m_memory, 0, m_capacity);
+        }
+    }
+
+    void release() noexcept {
+        for (uint32_t i{0}; i < m_numberOfOverflows; i++) {
+            ::free(m_overflow[i]);
+        }
+        m_numberOfOverflows = 0;
+    }
+
+   private:
+    char *m_memory{nullptr};
+    std::size_t m_capacity{0};
+    std::size_t m_used{0};
+    std::size_t m_demand{0};  // What this frame would have needed without overflows.
+    std::size_t m_highWater{0};
+    std::array<void*, MAX_OVERFLOWS> m_overflow{};
+    uint32_t m_numberOfOverflows{0};
+    uint64_t m_overflows{0};
+};
+
+#endif
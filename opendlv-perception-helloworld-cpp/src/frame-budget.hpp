@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_BUDGET_HPP
+#define FRAME_BUDGET_HPP
+
+#include "frame-ring.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+/**
+ * When cones are searched for on a downsampled level of the frame pyramid
+ * instead of the full frame.
+ */
+enum class CoarseDetection : uint8_t {
+    NEVER         = 0,
+    WHEN_SHEDDING = 1,  // From the first load shedding level on.
+    ALWAYS        = 2,
+};
+
+/**
+ * What the processing stage leaves out at a given load shedding level.
+ */
+struct LoadShedding {
+    uint32_t level{0};
+    uint32_t frameStride{1};      // Process only every frameStride-th frame.
+    float roiTop{0.0f};           // Fraction of rows at the top of the region of interest that is not processed.
+    uint32_t rowStep{1};          // Process only every rowStep-th row (row pair for I420).
+    bool coarseDetection{false};  // Detect cones on the pyramid and label only their surroundings.
+};
+
+/**
+ * FrameBudget compares the time needed to process a frame with the period
+ * of the producer. When processing overruns the period for several frames
+ * in a row, it sheds load one level at a time:
+ *
+ *   level 1: skip the upper rows of the region of interest,
+ *   level 2: additionally process only every second row,
+ *   level 3+: additionally process only every (level - 1)-th frame.
+ *
+ * If a frame pyramid can be built while shedding, detecting cones on its
+ * coarse level comes first instead; as only the surroundings of these
+ * cones are labelled, leaving out rows would not save anything then:
+ *
+ *   level 1: detect cones on the pyramid,
+ *   level 2: additionally skip the upper rows of the region of interest,
+ *   level 3+: additionally process only every (level - 1)-th frame.
+ *
+ * If cones are always detected on the pyramid, level 1 skips the upper
+ * rows and level 2+ processes only every level-th frame.
+ *
+ * It returns to a lower level once processing has been well within
+ * budget for a while. Frames that are older than two budgets by the time
+ * they are processed are dropped, so results always describe the present.
+ *
+ * update() and isStale() are called by the processing stage; skip() may be
+ * called concurrently by the acquisition stage.
+ */
+class FrameBudget {
+   public:
+    static constexpr uint32_t MAX_LEVEL{5};
+
+   private:
+    FrameBudget(const FrameBudget &) = delete;
+    FrameBudget(FrameBudget &&)      = delete;
+    FrameBudget &operator=(const FrameBudget &) = delete;
+    FrameBudget &operator=(FrameBudget &&) = delete;
+
+   public:
+    /**
+     * @param budget Time available per frame; zero derives it from the producer's frame period.
+     * @param roiTop Fraction of rows at the top that is dropped from level 1 on.
+     * @param enabled If false, the level stays at zero and only statistics are collected.
+     * @param coarseDetection When cones are detected on the frame pyramid.
+     */
+    FrameBudget(const std::chrono::microseconds &budget, float roiTop, bool enabled, CoarseDetection coarseDetection = CoarseDetection::NEVER) noexcept
+        : m_fixedBudget(budget.count())
+        , m_roiTop(roiTop)
+        , m_enabled(enabled)
+        , m_coarseDetection(coarseDetection) {}
+
+    LoadShedding shedding() const noexcept {
+        return sheddingFor(m_level.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * This method decides whether the acquisition stage should leave out a frame.
+     */
+    bool skip(uint32_t frameNumber) noexcept {
+        const uint32_t STRIDE{shedding().frameStride};
+        if ( (1 < STRIDE) && (0 != (frameNumber % STRIDE)) ) {
+            m_skippedFrames.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * This method decides whether a frame is too old to be worth processing.
+     *
+     * @param now Current time in microseconds on the clock of FrameInfo::sampleTimeStamp.
+     */
+    bool isStale(const FrameInfo &info, int64_t now) noexcept {
+        const int64_t BUDGET{budget()};
+        if ( (0 == info.sampleTimeStamp) || (0 == BUDGET) || (now - info.sampleTimeStamp <= 2 * BUDGET) ) {
+            return false;
+        }
+        m_staleFrames++;
+        return true;
+    }
+
+    /**
+     * This method accounts for a processed frame.
+     *
+     * @return true if the load shedding level changed.
+     */
+    bool update(const FrameInfo &info, const std::chrono::microseconds &processing) noexcept {
+        // Frame period of the producer, independent of frames that we left out.
+        if ( (0 < m_lastSampleTimeStamp) && (info.frameNumber > m_lastFrameNumber) && (info.sampleTimeStamp > m_lastSampleTimeStamp) ) {
+            const double PERIOD{static_cast<double>(info.sampleTimeStamp - m_lastSampleTimeStamp) / (info.frameNumber - m_lastFrameNumber)};
+            m_period = (0.0 < m_period) ? (1.0 - ALPHA) * m_period + ALPHA * PERIOD : PERIOD;
+        }
+        m_lastSampleTimeStamp = info.sampleTimeStamp;
+        m_lastFrameNumber = info.frameNumber;
+
+        const double PROCESSING{static_cast<double>(processing.count())};
+        m_lastProcessing = PROCESSING;
+        m_processing = (0.0 < m_processing) ? (1.0 - ALPHA) * m_processing + ALPHA * PROCESSING : PROCESSING;
+        m_processedFrames++;
+
+        const double BUDGET{static_cast<double>(budget())};
+        if (!m_enabled || (0.0 >= BUDGET)) {
+            return false;
+        }
+
+        // Hysteresis: escalate quickly, relax slowly.
+        const uint32_t LEVEL{m_level.load(std::memory_order_relaxed)};
+        m_overruns = (m_processing > BUDGET) ? m_overruns + 1 : 0;
+        m_underruns = (m_processing < 0.5 * BUDGET) ? m_underruns + 1 : 0;
+        uint32_t next{LEVEL};
+        if ( (OVERRUN_FRAMES <= m_overruns) && (MAX_LEVEL > LEVEL) ) {
+            next = LEVEL + 1;
+        }
+        else if ( (UNDERRUN_FRAMES <= m_underruns) && (0 < LEVEL) ) {
+            next = LEVEL - 1;
+        }
+        if (next == LEVEL) {
+            return false;
+        }
+        m_level.store(next, std::memory_order_relaxed);
+        m_overruns = 0;
+        m_underruns = 0;
+        m_processing = 0.0;
+        return true;
+    }
+
+    /**
+     * @return Time available per processed frame in microseconds; zero while unknown.
+     */
+    int64_t budget() const noexcept {
+        const int64_t PER_FRAME{(0 < m_fixedBudget) ? m_fixedBudget : static_cast<int64_t>(m_period * HEADROOM)};
+        return PER_FRAME * shedding().frameStride;
+    }
+
+    /**
+     * @return Human readable summary of what is shed and why; to be called by the processing stage.
+     */
+    std::string report() const noexcept {
+        const LoadShedding SHED{shedding()};
+        std::stringstream sstr;
+        sstr << "Load shedding level " << SHED.level;
+        if (0 == SHED.level) {
+            sstr << " (full frames)";
+        }
+        else {
+            const char *separator{" ("};
+            if (SHED.coarseDetection && (CoarseDetection::WHEN_SHEDDING == m_coarseDetection)) {
+                sstr << separator << "cones detected on the pyramid";
+                separator = ", ";
+            }
+            if (0.0f < SHED.roiTop) {
+                sstr << separator << "top " << static_cast<uint32_t>(SHED.roiTop * 100.0f) << "% of rows skipped";
+                separator = ", ";
+            }
+            if (1 < SHED.rowStep) {
+                sstr << separator << "1 of " << SHED.rowStep << " rows";
+                separator = ", ";
+            }
+            if (1 < SHED.frameStride) {
+                sstr << separator << "1 of " << SHED.frameStride << " frames";
+            }
+            sstr << ")";
+        }
+        sstr << "; last frame took " << m_lastProcessing / 1000.0 << " ms of " << static_cast<double>(budget()) / 1000.0 << " ms budget"
+             << "; " << m_processedFrames << " processed, "
+             << m_skippedFrames.load(std::memory_order_relaxed) << " skipped, "
+             << m_staleFrames << " stale frames.";
+        return sstr.str();
+    }
+
+   private:
+    LoadShedding sheddingFor(uint32_t level) const noexcept {
+        LoadShedding shed;
+        shed.level = level;
+        shed.coarseDetection = (CoarseDetection::ALWAYS == m_coarseDetection);
+
+        // Every level adds the next step; the remaining levels skip frames.
+        uint32_t steps{level};
+        if ( (CoarseDetection::WHEN_SHEDDING == m_coarseDetection) && (0 < steps) ) {
+            shed.coarseDetection = true;
+            steps--;
+        }
+        if (0 < steps) {
+            shed.roiTop = m_roiTop;
+            steps--;
+        }
+        if (!shed.coarseDetection && (0 < steps)) {
+            shed.rowStep = 2;
+            steps--;
+        }
+        shed.frameStride = 1 + steps;
+        return shed;
+    }
+
+   private:
+    static constexpr double ALPHA{0.1};          // Weight of the newest sample in the moving averages.
+    static constexpr double HEADROOM{0.8};       // Share of the frame period left for processing.
+    static constexpr uint32_t OVERRUN_FRAMES{5};
+    static constexpr uint32_t UNDERRUN_FRAMES{60};
+
+    const int64_t m_fixedBudget;
+    const float m_roiTop;
+    const bool m_enabled;
+    const CoarseDetection m_coarseDetection;
+
+    std::atomic<uint32_t> m_level{0};
+    std::atomic<uint64_t> m_skippedFrames{0};
+    uint64_t m_staleFrames{0};
+    uint64_t m_processedFrames{0};
+
+    int64_t m_lastSampleTimeStamp{0};
+    uint32_t m_lastFrameNumber{0};
+    double m_period{0.0};      // Microseconds between two frames of the producer.
+    double m_processing{0.0};  // Microseconds to process one frame.
+    double m_lastProcessing{0.0};
+    uint32_t m_overruns{0};
+    uint32_t m_underruns{0};
+};
+
+#endif
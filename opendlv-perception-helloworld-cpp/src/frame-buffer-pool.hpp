@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_BUFFER_POOL_HPP
+#define FRAME_BUFFER_POOL_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * This function copies a frame out of shared memory. On x86, large frames
+ * are copied with non-temporal stores so that the copy neither evicts the
+ * working set of the consumer nor reads the destination cache lines first;
+ * elsewhere, the platform's memcpy is used.
+ *
+ * @param dst Destination; must be aligned to 16 bytes for the streaming path.
+ * @param src Source (typically SharedMemory::data()).
+ * @param size Number of bytes to copy.
+ */
+inline void copyFrame(char *dst, const char *src, std::size_t size) noexcept {
+#if defined(__SSE2__)
+    constexpr std::size_t MIN_SIZE_FOR_STREAMING{256 * 1024};
+    if ( (size >= MIN_SIZE_FOR_STREAMING) && (0 == (reinterpret_cast<uintptr_t>(dst) & 15)) ) {
+        const std::size_t BLOCKS{size / 64};
+        for (std::size_t i{0}; i < BLOCKS; i++) {
+            const __m128i *s = reinterpret_cast<const __m128i*>(src + i * 64);
+            __m128i *d = reinterpret_cast<__m128i*>(dst + i * 64);
+            __m128i a = _mm_loadu_si128(s + 0);
+            __m128i b = _mm_loadu_si128(s + 1);
+            __m128i c = _mm_loadu_si128(s + 2);
+            __m128i e = _mm_loadu_si128(s + 3);
+            _mm_stream_si128(d + 0, a);
+            _mm_stream_si128(d + 1, b);
+            _mm_stream_si128(d + 2, c);
+            _mm_stream_si128(d + 3, e);
+        }
+        _mm_sfence();
+        std::memcpy(dst + BLOCKS * 64, src + BLOCKS * 64, size - BLOCKS * 64);
+        return;
+    }
+#endif
+    std::memcpy(dst, src, size);
+}
+
+/**
+ * A FrameBufferPool owns a small ring of preallocated, cache-line aligned
+ * frame buffers. A consumer acquires a free buffer, copies the frame into
+ * it while holding the shared memory lock, and passes the buffer on by
+ * moving its handle instead of allocating a new image per frame. The buffer
+ * returns to the pool when its handle goes out of scope.
+ *
+ * acquire() and the release of a handle may happen on different threads.
+ */
+class FrameBufferPool {
+   private:
+    FrameBufferPool(const FrameBufferPool &) = delete;
+    FrameBufferPool(FrameBufferPool &&)      = delete;
+    FrameBufferPool &operator=(const FrameBufferPool &) = delete;
+    FrameBufferPool &operator=(FrameBufferPool &&) = delete;
+
+   public:
+    class Releaser {
+       public:
+        Releaser() = default;
+        explicit Releaser(FrameBufferPool *pool) noexcept : m_pool(pool) {}
+        void operator()(char *buffer) const noexcept {
+            if (nullptr != m_pool) {
+                m_pool->release(buffer);
+            }
+        }
+
+       private:
+        FrameBufferPool *m_pool{nullptr};
+    };
+    using Handle = std::unique_ptr<char, Releaser>;
+
+   public:
+    static constexpr std::size_t ALIGNMENT{64};
+
+    /**
+     * Constructor.
+     *
+     * @param numberOfBuffers Number of buffers in the ring (2 = double, 3 = triple buffering).
+     * @param bufferSize Size in bytes of each buffer.
+     */
+    FrameBufferPool(uint32_t numberOfBuffers, std::size_t bufferSize) noexcept
+        : m_numberOfBuffers(numberOfBuffers)
+        , m_bufferSize(bufferSize)
+        , m_stride((bufferSize + ALIGNMENT - 1) & ~(ALIGNMENT - 1)) {
+        if (0 < m_numberOfBuffers) {
+            void *memory{nullptr};
+            if (0 == ::posix_memalign(&memory, ALIGNMENT, m_stride * m_numberOfBuffers)) {
+                m_memory = static_cast<char*>(memory);
+                // Touch all pages once so that no page faults occur in the frame loop.
+                std::memset(m_memory, 0, m_stride * m_numberOfBuffers);
+                m_inUse.reset(new std::atomic<bool>[m_numberOfBuffers]);
+                for (uint32_t i{0}; i < m_numberOfBuffers; i++) {
+                    m_inUse[i].store(false);
+                }
+            }
+        }
+    }
+
+    ~FrameBufferPool() noexcept {
+        ::free(m_memory);
+    }
+
+    /**
+     * @return True if all buffers could be allocated.
+     */
+    bool valid() const noexcept {
+        return (nullptr != m_memory);
+    }
+
+    /**
+     * @return Size in bytes of each buffer.
+     */
+    std::size_t bufferSize() const noexcept {
+        return m_bufferSize;
+    }
+
+    /**
+     * @return Number of buffers in this pool.
+     */
+    uint32_t numberOfBuffers() const noexcept {
+        return m_numberOfBuffers;
+    }
+
+    /**
+     * @return True if buffer is one of the buffers of this pool.
+     */
+    bool owns(const char *buffer) const noexcept {
+        return (nullptr != m_memory) && (buffer >= m_memory) && (buffer < m_memory + m_stride * m_numberOfBuffers);
+    }
+
+    /**
+     * This method hands out the next free buffer in round-robin order.
+     *
+     * @return Handle to a buffer or an empty handle if all buffers are in use.
+     */
+    Handle acquire() noexcept {
+        if (valid()) {
+            const uint32_t START{m_next.fetch_add(1) % m_numberOfBuffers};
+            for (uint32_t i{0}; i < m_numberOfBuffers; i++) {
+                const uint32_t INDEX{(START + i) % m_numberOfBuffers};
+                bool expected{false};
+                if (m_inUse[INDEX].compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                    return Handle{m_memory + INDEX * m_stride, Releaser{this}};
+                }
+            }
+        }
+        return Handle{nullptr, Releaser{}};
+    }
+
+   private:
+    void release(char *buffer) noexcept {
+        if ( (nullptr != buffer) && (buffer >= m_memory) ) {
+            const std::size_t INDEX{static_cast<std::size_t>(buffer - m_memory) / m_stride};
+            if (INDEX < m_numberOfBuffers) {
+                m_inUse[INDEX].store(false, std::memory_order_release);
+            }
+        }
+    }
+
+   private:
+    uint32_t m_numberOfBuffers{0};
+    std::size_t m_bufferSize{0};
+    std::size_t m_stride{0};
+    char *m_memory{nullptr};
+    std::unique_ptr<std::atomic<bool>[]> m_inUse{};
+    std::atomic<uint32_t> m_next{0};
+};
+
+#endif
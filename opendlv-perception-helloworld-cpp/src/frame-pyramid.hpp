@@ -0,0 +1,407 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_PYRAMID_HPP
+#define FRAME_PYRAMID_HPP
+
+#include "frame-ring.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FRAME_PYRAMID_X86
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FRAME_PYRAMID_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * Image pyramid built while copying a frame out of shared memory.
+ *
+ * Level l has half the width and height of level l - 1; every pixel is the
+ * rounded mean of a 2x2 block (for I420, luma and chroma planes are halved
+ * alike). Level 1 is computed in the same pass that copies the frame, so
+ * the shared memory is read only once; the higher levels are computed from
+ * level 1, which is a quarter of the frame and still in cache.
+ *
+ * All levels of a frame live in one buffer with the pixel format of the
+ * frame and tightly packed rows.
+ */
+
+namespace framePyramid {
+
+// Averages 2x2 blocks of interleaved channels for output pixels [from, to);
+// if COPY, the two source rows are also copied to d0 and d1.
+template <bool COPY>
+inline void downsampleRowPairScalar(const uint8_t *s0, const uint8_t *s1, uint8_t *d0, uint8_t *d1, uint8_t *half,
+                                    uint32_t from, uint32_t to, uint32_t channels) noexcept {
+    for (uint32_t x{from}; x < to; x++) {
+        for (uint32_t c{0}; c < channels; c++) {
+            const uint32_t I{2 * x * channels + c};
+            half[x * channels + c] = static_cast<uint8_t>((s0[I] + s0[I + channels] + s1[I] + s1[I + channels] + 2) >> 2);
+        }
+    }
+    if (COPY && (from < to)) {
+        std::memcpy(d0 + 2 * from * channels, s0 + 2 * from * channels, 2 * (to - from) * channels);
+        std::memcpy(d1 + 2 * from * channels, s1 + 2 * from * channels, 2 * (to - from) * channels);
+    }
+}
+
+#ifdef FRAME_PYRAMID_X86
+////////////////////////////////////////////////////////////////////////////////
+// SSE2 (baseline on x86-64).
+
+// Sums of neighbouring bytes as 16-bit values.
+inline __m128i pairSumsSSE2(__m128i a) noexcept {
+    return _mm_add_epi16(_mm_and_si128(a, _mm_set1_epi16(0x00ff)), _mm_srli_epi16(a, 8));
+}
+
+// Sums of neighbouring BGRA pixels (0 + 1, 2 + 3) as 16-bit channels.
+inline __m128i pixelPairSumsSSE2(__m128i a) noexcept {
+    const __m128i LO{_mm_unpacklo_epi8(a, _mm_setzero_si128())};
+    const __m128i HI{_mm_unpackhi_epi8(a, _mm_setzero_si128())};
+    return _mm_add_epi16(_mm_unpacklo_epi64(LO, HI), _mm_unpackhi_epi64(LO, HI));
+}
+
+inline __m128i meanSSE2(__m128i top, __m128i bottom) noexcept {
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(top, bottom), _mm_set1_epi16(2)), 2);
+}
+
+template <bool COPY>
+inline uint32_t downsampleRowPairGraySSE2(const uint8_t *s0, const uint8_t *s1, uint8_t *d0, uint8_t *d1, uint8_t *half, uint32_t width) noexcept {
+    uint32_t x{0};
+    for (; x + 16 <= width; x += 16) {
+        const __m128i *a = reinterpret_cast<const __m128i*>(s0 + 2 * x);
+        const __m128i *b = reinterpret_cast<const __m128i*>(s1 + 2 * x);
+        const __m128i A0{_mm_loadu_si128(a + 0)}, A1{_mm_loadu_si128(a + 1)};
+        const __m128i B0{_mm_loadu_si128(b + 0)}, B1{_mm_loadu_si128(b + 1)};
+        if (COPY) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d0 + 2 * x) + 0, A0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d0 + 2 * x) + 1, A1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d1 + 2 * x) + 0, B0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d1 + 2 * x) + 1, B1);
+        }
+        const __m128i LO{meanSSE2(pairSumsSSE2(A0), pairSumsSSE2(B0))};
+        const __m128i HI{meanSSE2(pairSumsSSE2(A1), pairSumsSSE2(B1))};
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(half + x), _mm_packus_epi16(LO, HI));
+    }
+    return x;
+}
+
+template <bool COPY>
+inline uint32_t downsampleRowPairBGRASSE2(const uint8_t *s0, const uint8_t *s1, uint8_t *d0, uint8_t *d1, uint8_t *half, uint32_t width) noexcept {
+    uint32_t x{0};
+    for (; x + 4 <= width; x += 4) {
+        const __m128i *a = reinterpret_cast<const __m128i*>(s0 + 8 * x);
+        const __m128i *b = reinterpret_cast<const __m128i*>(s1 + 8 * x);
+        const __m128i A0{_mm_loadu_si128(a + 0)}, A1{_mm_loadu_si128(a + 1)};
+        const __m128i B0{_mm_loadu_si128(b + 0)}, B1{_mm_loadu_si128(b + 1)};
+        if (COPY) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d0 + 8 * x) + 0, A0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d0 + 8 * x) + 1, A1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d1 + 8 * x) + 0, B0);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d1 + 8 * x) + 1, B1);
+        }
+        const __m128i LO{meanSSE2(pixelPairSumsSSE2(A0), pixelPairSumsSSE2(B0))};
+        const __m128i HI{meanSSE2(pixelPairSumsSSE2(A1), pixelPairSumsSSE2(B1))};
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(half + 4 * x), _mm_packus_epi16(LO, HI));
+    }
+    return x;
+}
+#endif
+
+#ifdef FRAME_PYRAMID_NEON
+////////////////////////////////////////////////////////////////////////////////
+// NEON.
+
+template <bool COPY>
+inline uint32_t downsampleRowPairGrayNEON(const uint8_t *s0, const uint8_t *s1, uint8_t *d0, uint8_t *d1, uint8_t *half, uint32_t width) noexcept {
+    uint32_t x{0};
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16_t A0{vld1q_u8(s0 + 2 * x)}, A1{vld1q_u8(s0 + 2 * x + 16)};
+        const uint8x16_t B0{vld1q_u8(s1 + 2 * x)}, B1{vld1q_u8(s1 + 2 * x + 16)};
+        if (COPY) {
+            vst1q_u8(d0 + 2 * x, A0);
+            vst1q_u8(d0 + 2 * x + 16, A1);
+            vst1q_u8(d1 + 2 * x, B0);
+            vst1q_u8(d1 + 2 * x + 16, B1);
+        }
+        const uint8x8_t LO{vrshrn_n_u16(vaddq_u16(vpaddlq_u8(A0), vpaddlq_u8(B0)), 2)};
+        const uint8x8_t HI{vrshrn_n_u16(vaddq_u16(vpaddlq_u8(A1), vpaddlq_u8(B1)), 2)};
+        vst1q_u8(half + x, vcombine_u8(LO, HI));
+    }
+    return x;
+}
+
+template <bool COPY>
+inline uint32_t downsampleRowPairBGRANEON(const uint8_t *s0, const uint8_t *s1, uint8_t *d0, uint8_t *d1, uint8_t *half, uint32_t width) noexcept {
+    uint32_t x{0};
+    for (; x + 8 <= width; x += 8) {
+        const uint8x16x4_t A{vld4q_u8(s0 + 8 * x)};
+        const uint8x16x4_t B{vld4q_u8(s1 + 8 * x)};
+        if (COPY) {
+            vst4q_u8(d0 + 8 * x, A);
+            vst4q_u8(d1 + 8 * x, B);
+        }
+        uint8x8x4_t h;
+        for (int c{0}; c < 4; c++) {
+            h.val[c] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(A.val[c]), vpaddlq_u8(B.val[c])), 2);
+        }
+        vst4_u8(half + 4 * x, h);
+    }
+    return x;
+}
+#endif
+
+/**
+ * This function computes one row of the next level from two rows of the
+ * current one; with COPY, it also copies the two rows from s0, s1 to d0, d1.
+ *
+ * @param width Number of output pixels.
+ * @param channels 1 for planes, 4 for BGRA.
+ */
+template <bool COPY>
+inline void downsampleRowPair(const uint8_t *s0, const uint8_t *s1, uint8_t *d0, uint8_t *d1, uint8_t *half, uint32_t width, uint32_t channels) noexcept {
+    uint32_t x{0};
+#if defined(FRAME_PYRAMID_X86)
+    x = (1 == channels) ? downsampleRowPairGraySSE2<COPY>(s0, s1, d0, d1, half, width) : downsampleRowPairBGRASSE2<COPY>(s0, s1, d0, d1, half, width);
+#elif defined(FRAME_PYRAMID_NEON)
+    x = (1 == channels) ? downsampleRowPairGrayNEON<COPY>(s0, s1, d0, d1, half, width) : downsampleRowPairBGRANEON<COPY>(s0, s1, d0, d1, half, width);
+#endif
+    downsampleRowPairScalar<COPY>(s0, s1, d0, d1, half, x, width, channels);
+}
+
+/**
+ * This function halves a region of a plane; region is given in pixels of
+ * the source plane and must have even borders.
+ */
+template <bool COPY>
+inline void downsamplePlane(const char *src, uint32_t srcStride, char *dst, uint32_t dstStride, char *half, uint32_t halfStride,
+                            const FrameRegion &region, uint32_t channels) noexcept {
+    const uint32_t WIDTH{(region.right - region.left) / 2};
+    for (uint32_t y{region.top}; y + 1 < region.bottom; y += 2) {
+        const std::size_t OFFSET{static_cast<std::size_t>(y) * srcStride + region.left * channels};
+        const std::size_t DST_OFFSET{static_cast<std::size_t>(y) * dstStride + region.left * channels};
+        const std::size_t HALF_OFFSET{static_cast<std::size_t>(y / 2) * halfStride + region.left / 2 * channels};
+        downsampleRowPair<COPY>(reinterpret_cast<const uint8_t*>(src + OFFSET), reinterpret_cast<const uint8_t*>(src + OFFSET + srcStride),
+                                COPY ? reinterpret_cast<uint8_t*>(dst + DST_OFFSET) : nullptr,
+                                COPY ? reinterpret_cast<uint8_t*>(dst + DST_OFFSET + dstStride) : nullptr,
+                                reinterpret_cast<uint8_t*>(half + HALF_OFFSET), WIDTH, channels);
+    }
+}
+
+} // namespace framePyramid
+
+/**
+ * Where the levels of a frame's pyramid are; level 0 is the frame itself.
+ */
+struct PyramidLayout {
+    static constexpr uint32_t MAX_LEVELS{3};
+    uint32_t levels{0};
+    FrameInfo info[MAX_LEVELS + 1]{};
+    std::size_t offset[MAX_LEVELS + 1]{};  // Bytes into the pyramid buffer; unused for level 0.
+    std::size_t size{0};                  // Bytes needed for all levels.
+};
+
+/**
+ * @return Bytes of a pyramid buffer that holds all levels of any frame of up to frameSize bytes.
+ */
+inline std::size_t pyramidCapacity(std::size_t frameSize) noexcept {
+    // Every level needs at most a quarter of the one below it.
+    return frameSize / 3 + 3 * 64 * PyramidLayout::MAX_LEVELS;
+}
+
+/**
+ * This function lays out up to the requested number of levels; there are
+ * fewer levels if the frame's size is not divisible by 2^(levels + 1),
+ * which keeps all levels' regions (and I420 chroma samples) aligned.
+ */
+inline PyramidLayout pyramidLayout(const FrameInfo &info, uint32_t levels) noexcept {
+    PyramidLayout layout;
+    layout.info[0] = info;
+    levels = std::min(levels, PyramidLayout::MAX_LEVELS);
+    while ( (0 < levels) && ((0 != (info.width % (2u << levels))) || (0 != (info.height % (2u << levels)))) ) {
+        levels--;
+    }
+    layout.levels = levels;
+    for (uint32_t l{1}; l <= levels; l++) {
+        FrameInfo &level{layout.info[l]};
+        level = info;
+        level.width = info.width >> l;
+        level.height = info.height >> l;
+        level.stride = (FOURCC_I420 == info.fourcc) ? level.width : level.width * 4;
+        level.size = (FOURCC_I420 == info.fourcc) ? level.stride * level.height * 3 / 2 : level.stride * level.height;
+        layout.offset[l] = layout.size;
+        layout.size += (static_cast<std::size_t>(level.size) + 63) & ~static_cast<std::size_t>(63);
+    }
+    return layout;
+}
+
+/**
+ * @return Region of level 0 that is copied and halved when the given region
+ *         is requested; grown outwards so that it halves evenly on all levels.
+ */
+inline FrameRegion pyramidRegion(const FrameRegion &region, const PyramidLayout &layout) noexcept {
+    const FrameInfo &INFO{layout.info[0]};
+    const uint32_t ALIGNMENT{2u << layout.levels};
+    const FrameRegion R{clampFrameRegion(region, INFO)};
+    FrameRegion r;
+    r.left = R.left & ~(ALIGNMENT - 1);
+    r.top = R.top & ~(ALIGNMENT - 1);
+    r.right = std::min((R.right + ALIGNMENT - 1) & ~(ALIGNMENT - 1), INFO.width);
+    r.bottom = std::min((R.bottom + ALIGNMENT - 1) & ~(ALIGNMENT - 1), INFO.height);
+    return r;
+}
+
+/**
+ * @return Region of a level corresponding to a region of level 0 returned by pyramidRegion().
+ */
+inline FrameRegion pyramidLevelRegion(const FrameRegion &region, uint32_t level) noexcept {
+    FrameRegion r;
+    r.left = region.left >> level;
+    r.top = region.top >> level;
+    r.right = region.right >> level;
+    r.bottom = region.bottom >> level;
+    return r;
+}
+
+/**
+ * Time spent on each level of the last pyramid; level 1 includes the copy of the frame.
+ */
+struct PyramidTimings {
+    std::chrono::microseconds level[PyramidLayout::MAX_LEVELS + 1]{};
+};
+
+/**
+ * This function copies a region of a frame like copyFrameRegion() and
+ * builds the levels of the pyramid for that region on the way.
+ *
+ * @param dst Destination of the frame; same layout as src.
+ * @param pyramid Destination of the levels; layout.size bytes.
+ * @param src Frame to copy.
+ * @param layout Layout for the frame's description.
+ * @param region Part of the frame to copy; grown by pyramidRegion().
+ * @param timings Time spent per level.
+ */
+inline void copyFrameRegionWithPyramid(char *dst, char *pyramid, const char *src, const PyramidLayout &layout, const FrameRegion &region, PyramidTimings &timings) noexcept {
+    const FrameInfo &INFO{layout.info[0]};
+    if (0 == layout.levels) {
+        copyFrameRegion(dst, src, INFO, region);
+        return;
+    }
+
+    const bool I420{FOURCC_I420 == INFO.fourcc};
+    const uint32_t CHANNELS{I420 ? 1u : 4u};
+    const FrameRegion R{pyramidRegion(region, layout)};
+    for (uint32_t l{0}; l < layout.levels; l++) {
+        const auto START{std::chrono::steady_clock::now()};
+        const FrameInfo &from{layout.info[l]};
+        const FrameInfo &to{layout.info[l + 1]};
+        const char *s{(0 == l) ? src : pyramid + layout.offset[l]};
+        char *h{pyramid + layout.offset[l + 1]};
+        const FrameRegion AREA{pyramidLevelRegion(R, l)};
+        if (0 == l) {
+            framePyramid::downsamplePlane<true>(s, from.stride, dst, from.stride, h, to.stride, AREA, CHANNELS);
+        }
+        else {
+            framePyramid::downsamplePlane<false>(s, from.stride, nullptr, 0, h, to.stride, AREA, CHANNELS);
+        }
+        if (I420) {
+            // Both chroma planes follow the luma plane and have half its stride.
+            const std::size_t LUMA{static_cast<std::size_t>(from.stride) * from.height};
+            const std::size_t HALF_LUMA{static_cast<std::size_t>(to.stride) * to.height};
+            const FrameRegion CHROMA{pyramidLevelRegion(AREA, 1)};
+            for (std::size_t plane{0}; plane < 2; plane++) {
+                const std::size_t OFFSET{LUMA + plane * LUMA / 4};
+                const std::size_t HALF_OFFSET{HALF_LUMA + plane * HALF_LUMA / 4};
+                if (0 == l) {
+                    framePyramid::downsamplePlane<true>(s + OFFSET, from.stride / 2, dst + OFFSET, from.stride / 2, h + HALF_OFFSET, to.stride / 2, CHROMA, 1);
+                }
+                else {
+                    framePyramid::downsamplePlane<false>(s + OFFSET, from.stride / 2, nullptr, 0, h + HALF_OFFSET, to.stride / 2, CHROMA, 1);
+                }
+            }
+        }
+        timings.level[l + 1] = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - START);
+    }
+}
+
+/**
+ * PyramidStatistics averages where the time goes in pyramid mode so that
+ * the number of levels can be tuned: building each level, detecting on
+ * the coarsest level, and refining the candidates at full resolution.
+ */
+class PyramidStatistics {
+   private:
+    PyramidStatistics(const PyramidStatistics &) = delete;
+    PyramidStatistics(PyramidStatistics &&)      = delete;
+    PyramidStatistics &operator=(const PyramidStatistics &) = delete;
+    PyramidStatistics &operator=(PyramidStatistics &&) = delete;
+
+   public:
+    PyramidStatistics() = default;
+
+    void update(uint32_t levels, const PyramidTimings &build, const std::chrono::microseconds &detect,
+                const std::chrono::microseconds &refine, uint32_t candidates) noexcept {
+        m_levels = levels;
+        for (uint32_t l{1}; l <= levels; l++) {
+            average(m_build[l], build.level[l].count());
+        }
+        average(m_detect, detect.count());
+        average(m_refine, refine.count());
+        average(m_candidates, candidates);
+        m_updates++;
+    }
+
+    /**
+     * @return Human readable summary of the average timings.
+     */
+    std::string report() const noexcept {
+        std::stringstream sstr;
+        sstr << "Pyramid timings (average):";
+        for (uint32_t l{1}; l <= m_levels; l++) {
+            sstr << " level " << l << ((1 == l) ? " with copy " : " ") << static_cast<int64_t>(m_build[l]) << " us,";
+        }
+        sstr << " detection on level " << m_levels << " " << static_cast<int64_t>(m_detect) << " us,"
+             << " refinement of " << m_candidates << " candidates " << static_cast<int64_t>(m_refine) << " us.";
+        return sstr.str();
+    }
+
+   private:
+    void average(double &value, double sample) const noexcept {
+        value = (0 == m_updates) ? sample : (1.0 - ALPHA) * value + ALPHA * sample;
+    }
+
+   private:
+    static constexpr double ALPHA{0.1};
+
+    uint64_t m_updates{0};
+    uint32_t m_levels{0};
+    double m_build[PyramidLayout::MAX_LEVELS + 1]{};
+    double m_detect{0.0};
+    double m_refine{0.0};
+    double m_candidates{0.0};
+};
+
+#endif
@@ -0,0 +1,662 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_RING_HPP
+#define FRAME_RING_HPP
+
+#include "cluon-complete.hpp"
+#include "frame-buffer-pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include <pthread.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// The ring lives in memory shared between unrelated processes; hence, its
+// atomics must not fall back to a process-local lock.
+static_assert(2 == ATOMIC_INT_LOCK_FREE, "32-bit atomics must be lock-free to be shared between processes.");
+
+/*
+ * Layout of a frame ring inside the user accessible part of a
+ * cluon::SharedMemory area (all blocks are aligned to 64 bytes):
+ *
+ *   [FrameRingHeader][FrameSlotHeader|payload 0]...[FrameSlotHeader|payload N-1]
+ *
+ * Frame n (n >= 1) is written into slot n % N. The sequence counter of a
+ * slot is odd (2n - 1) while frame n is being written and even (2n) once
+ * it is complete; the header's 'latest' field holds the number of the last
+ * complete frame. Hence, the single writer fills slot k+1 while any number
+ * of readers copy slot k without taking the shared memory lock; a reader
+ * detects a torn copy by a changed sequence counter and retries.
+ *
+ * Every slot starts with a FrameInfo describing the pixel format, geometry
+ * and sample time of its frame so that consumers neither need to be told
+ * the resolution nor have to guess the format.
+ *
+ * On Linux, the header also carries a futex word that is incremented for
+ * every published frame; the writer only enters the kernel (FUTEX_WAKE)
+ * when readers are actually sleeping on it.
+ */
+constexpr uint32_t fourcc(char a, char b, char c, char d) noexcept {
+    return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) | (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+}
+
+// As with libyuv, 'ARGB' is stored as B, G, R, A in memory (i.e., CV_8UC4 in OpenCV).
+constexpr uint32_t FOURCC_ARGB{fourcc('A', 'R', 'G', 'B')};
+constexpr uint32_t FOURCC_I420{fourcc('I', '4', '2', '0')};
+
+/**
+ * Description of the frame in a slot; written by the producer together
+ * with the pixels and protected by the same sequence counter.
+ */
+struct FrameInfo {
+    uint32_t fourcc{0};
+    uint32_t width{0};
+    uint32_t height{0};
+    uint32_t stride{0};          // Bytes per row of the first plane.
+    uint32_t size{0};            // Bytes of pixel data in the slot.
+    uint32_t frameNumber{0};     // Set by FrameRingWriter::endWrite(); increases by one per frame.
+    int64_t sampleTimeStamp{0};  // Microseconds since epoch when the frame was sampled.
+};
+
+/**
+ * @return True if the frame described by info is plausible and fits into capacity bytes.
+ */
+inline bool isValidFrameInfo(const FrameInfo &info, std::size_t capacity) noexcept {
+    bool retVal{(0 < info.width) && (0 < info.height) && (info.size <= capacity)};
+    if (FOURCC_ARGB == info.fourcc) {
+        retVal &= (info.stride >= info.width * 4) && (info.size >= static_cast<std::size_t>(info.stride) * info.height);
+    }
+    else if (FOURCC_I420 == info.fourcc) {
+        // Y plane with 'stride' bytes per row followed by U and V planes with half the stride and rows.
+        retVal &= (0 == (info.width % 2)) && (0 == (info.height % 2)) && (0 == (info.stride % 2))
+               && (info.stride >= info.width) && (info.size >= static_cast<std::size_t>(info.stride) * info.height * 3 / 2);
+    }
+    else {
+        retVal = false;
+    }
+    return retVal;
+}
+
+/**
+ * Rectangle of a frame in pixels; right and bottom are exclusive. The
+ * default region covers any frame.
+ */
+struct FrameRegion {
+    uint32_t left{0};
+    uint32_t top{0};
+    uint32_t right{UINT32_MAX};
+    uint32_t bottom{UINT32_MAX};
+};
+
+/**
+ * This function clamps a region to a frame; its borders are moved outwards
+ * to even columns and rows so that it covers whole I420 chroma samples.
+ */
+inline FrameRegion clampFrameRegion(const FrameRegion &region, const FrameInfo &info) noexcept {
+    FrameRegion r;
+    r.left = std::min(region.left, info.width) & ~1u;
+    r.top = std::min(region.top, info.height) & ~1u;
+    const uint32_t RIGHT{std::min(region.right, info.width)};
+    const uint32_t BOTTOM{std::min(region.bottom, info.height)};
+    r.right = std::max(r.left, std::min(RIGHT + (RIGHT & 1u), info.width));
+    r.bottom = std::max(r.top, std::min(BOTTOM + (BOTTOM & 1u), info.height));
+    return r;
+}
+
+/**
+ * This function copies only a region of a frame; dst gets the same layout
+ * as src and is left untouched outside of the region.
+ */
+inline void copyFrameRegion(char *dst, const char *src, const FrameInfo &info, const FrameRegion &region) noexcept {
+    const FrameRegion R{clampFrameRegion(region, info)};
+    auto copyPlane = [](char *d, const char *s, uint32_t stride, uint32_t width, const FrameRegion &r, uint32_t bytesPerPixel) {
+        if ( (0 == r.left) && (width == r.right) ) {
+            // Whole rows are one block.
+            const std::size_t OFFSET{static_cast<std::size_t>(r.top) * stride};
+            copyFrame(d + OFFSET, s + OFFSET, static_cast<std::size_t>(r.bottom - r.top) * stride);
+            return;
+        }
+        for (uint32_t y{r.top}; y < r.bottom; y++) {
+            const std::size_t OFFSET{static_cast<std::size_t>(y) * stride + r.left * bytesPerPixel};
+            std::memcpy(d + OFFSET, s + OFFSET, (r.right - r.left) * bytesPerPixel);
+        }
+    };
+
+    if (FOURCC_I420 == info.fourcc) {
+        const std::size_t LUMA{static_cast<std::size_t>(info.stride) * info.height};
+        const std::size_t CHROMA{LUMA / 4};
+        FrameRegion half;
+        half.left = R.left / 2;
+        half.top = R.top / 2;
+        half.right = R.right / 2;
+        half.bottom = R.bottom / 2;
+        copyPlane(dst, src, info.stride, info.width, R, 1);
+        copyPlane(dst + LUMA, src + LUMA, info.stride / 2, info.width / 2, half, 1);
+        copyPlane(dst + LUMA + CHROMA, src + LUMA + CHROMA, info.stride / 2, info.width / 2, half, 1);
+    }
+    else {
+        copyPlane(dst, src, info.stride, info.width, R, 4);
+    }
+}
+
+struct FrameRingHeader {
+    static constexpr uint32_t MAGIC{0x474e5246}; // 'FRNG'
+    static constexpr uint32_t VERSION{3};
+
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t numberOfSlots;
+    uint32_t slotSize;
+    std::atomic<uint32_t> latest;
+    std::atomic<uint32_t> futex;
+    std::atomic<uint32_t> waiters;
+};
+
+struct FrameSlotHeader {
+    std::atomic<uint32_t> sequence;
+    FrameInfo info;
+};
+
+namespace frameRingLayout {
+constexpr std::size_t ALIGNMENT{64};
+
+constexpr std::size_t align(std::size_t size) noexcept {
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+constexpr std::size_t headerSize() noexcept {
+    return align(sizeof(FrameRingHeader));
+}
+
+constexpr std::size_t slotStride(uint32_t slotSize) noexcept {
+    return align(sizeof(FrameSlotHeader)) + align(slotSize);
+}
+
+/**
+ * @return Size of the shared memory area needed for a ring with the given geometry.
+ */
+constexpr std::size_t requiredSize(uint32_t numberOfSlots, uint32_t slotSize) noexcept {
+    return headerSize() + numberOfSlots * slotStride(slotSize);
+}
+} // namespace frameRingLayout
+
+#ifdef __linux__
+namespace frameRingFutex {
+// The futex word is shared between processes; hence, no FUTEX_PRIVATE_FLAG.
+// @return false if the (relative) timeout expired.
+inline bool wait(std::atomic<uint32_t> *word, uint32_t expected, const struct timespec *timeout) noexcept {
+    return !( (-1 == ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, timeout, nullptr, 0)) && (ETIMEDOUT == errno) );
+}
+
+inline void wakeAll(std::atomic<uint32_t> *word) noexcept {
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+} // namespace frameRingFutex
+#endif
+
+/**
+ * A SharedMemoryCondition waits for SharedMemory::notifyAll() like
+ * SharedMemory::wait() but with a timeout, which libcluon v0.0.127 does not
+ * offer. It finds the condition the same way libcluon does: the semaphore
+ * of the SysV implementation by the key of the token file, and the shared
+ * condition variable of the POSIX implementation in the header in front of
+ * the user accessible part of the area.
+ */
+class SharedMemoryCondition {
+   private:
+    SharedMemoryCondition(const SharedMemoryCondition &) = delete;
+    SharedMemoryCondition(SharedMemoryCondition &&)      = delete;
+    SharedMemoryCondition &operator=(const SharedMemoryCondition &) = delete;
+    SharedMemoryCondition &operator=(SharedMemoryCondition &&) = delete;
+
+    // Layout of SharedMemory::SharedMemoryHeader (POSIX implementation).
+    struct PosixHeader {
+        uint32_t size;
+        pthread_mutex_t mutex;
+        pthread_cond_t condition;
+    };
+
+    // ID of the semaphore that libcluon uses as condition (cf. SharedMemory::initConditionSysV).
+    static constexpr int ID_SEM_AS_CONDITION{3};
+
+   public:
+    explicit SharedMemoryCondition(cluon::SharedMemory &sharedMemory) noexcept
+        : m_sharedMemory(sharedMemory) {
+        if (sharedMemory.valid() && (nullptr != sharedMemory.data())) {
+#if defined(__NetBSD__) || defined(__OpenBSD__)
+            const bool USE_POSIX{false};
+#else
+            const char *CLUON_SHAREDMEMORY_POSIX{::getenv("CLUON_SHAREDMEMORY_POSIX")};
+            const bool USE_POSIX{(nullptr != CLUON_SHAREDMEMORY_POSIX) && ('1' == CLUON_SHAREDMEMORY_POSIX[0])};
+#endif
+            if (USE_POSIX) {
+                m_posixHeader = reinterpret_cast<PosixHeader*>(sharedMemory.data() - sizeof(PosixHeader));
+            }
+            else {
+                const key_t KEY{::ftok(sharedMemory.name().c_str(), ID_SEM_AS_CONDITION)};
+                if (-1 != KEY) {
+                    m_conditionIDSysV = ::semget(KEY, 0, 0);
+                }
+            }
+        }
+    }
+
+    /**
+     * @return True if the condition of the shared memory area was found.
+     */
+    bool valid() const noexcept {
+        return ( (nullptr != m_posixHeader) || (-1 != m_conditionIDSysV) );
+    }
+
+    /**
+     * This method waits for being notified until the deadline passed.
+     *
+     * @param deadline Point in time when to stop waiting.
+     * @return true if notified; false if the deadline passed.
+     */
+    bool waitUntil(const std::chrono::steady_clock::time_point &deadline) noexcept {
+        const int64_t REMAINING{std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count()};
+        if (0 >= REMAINING) {
+            return false;
+        }
+        bool retVal{false};
+        if (nullptr != m_posixHeader) {
+            // The shared condition uses CLOCK_MONOTONIC except on macOS (cf. SharedMemory::initPOSIX).
+            struct timespec absolute;
+#ifdef __APPLE__
+            ::clock_gettime(CLOCK_REALTIME, &absolute);
+#else
+            ::clock_gettime(CLOCK_MONOTONIC, &absolute);
+#endif
+            const int64_t NANOSECONDS{static_cast<int64_t>(absolute.tv_nsec) + REMAINING % 1000000000};
+            absolute.tv_sec += static_cast<time_t>(REMAINING / 1000000000 + NANOSECONDS / 1000000000);
+            absolute.tv_nsec = static_cast<long>(NANOSECONDS % 1000000000);
+
+            m_sharedMemory.lock();
+            retVal = (0 == ::pthread_cond_timedwait(&(m_posixHeader->condition), &(m_posixHeader->mutex), &absolute));
+            m_sharedMemory.unlock();
+        }
+        else if (-1 != m_conditionIDSysV) {
+            // Wait for the semaphore to become 0 as SharedMemory::waitSysV() does.
+            struct sembuf operation;
+            operation.sem_num = 0;
+            operation.sem_op = 0;
+#ifdef __linux__
+            operation.sem_flg = 0;
+            struct timespec timeout;
+            timeout.tv_sec = static_cast<time_t>(REMAINING / 1000000000);
+            timeout.tv_nsec = static_cast<long>(REMAINING % 1000000000);
+            retVal = (0 == ::semtimedop(m_conditionIDSysV, &operation, 1, &timeout));
+#else
+            // semtimedop is Linux only; poll the semaphore instead.
+            operation.sem_flg = IPC_NOWAIT;
+            do {
+                retVal = (0 == ::semop(m_conditionIDSysV, &operation, 1));
+                if (retVal || (EAGAIN != errno)) {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            } while (std::chrono::steady_clock::now() < deadline);
+#endif
+        }
+        else {
+            std::this_thread::sleep_until(deadline);
+        }
+        return retVal;
+    }
+
+    /**
+     * This method waits for being notified until the timeout expired.
+     *
+     * @param timeout Maximum duration to wait.
+     * @return true if notified; false if the timeout expired.
+     */
+    bool waitFor(const std::chrono::microseconds &timeout) noexcept {
+        return waitUntil(std::chrono::steady_clock::now() + timeout);
+    }
+
+   private:
+    cluon::SharedMemory &m_sharedMemory;
+    PosixHeader *m_posixHeader{nullptr};
+    int m_conditionIDSysV{-1};
+};
+
+/**
+ * A FrameRingWriter turns a shared memory area created by a producer into a
+ * frame ring. There must be only one writer per area.
+ *
+ * Usage:
+ *   cluon::SharedMemory sm{"img.argb", frameRingLayout::requiredSize(3, W*H*4)};
+ *   FrameRingWriter ring{sm, 3};
+ *   char *p = ring.beginWrite(); ...fill p...; ring.endWrite(info); sm.notifyAll();
+ *
+ * The call to notifyAll() is only needed for consumers that do not know
+ * about the frame ring and wait on the shared memory itself.
+ */
+class FrameRingWriter {
+   private:
+    FrameRingWriter(const FrameRingWriter &) = delete;
+    FrameRingWriter(FrameRingWriter &&)      = delete;
+    FrameRingWriter &operator=(const FrameRingWriter &) = delete;
+    FrameRingWriter &operator=(FrameRingWriter &&) = delete;
+
+   public:
+    FrameRingWriter(cluon::SharedMemory &sharedMemory, uint32_t numberOfSlots) noexcept {
+        if ( sharedMemory.valid() && (1 < numberOfSlots) ) {
+            const std::size_t AVAILABLE{sharedMemory.size()};
+            const std::size_t OVERHEAD{frameRingLayout::headerSize() + numberOfSlots * frameRingLayout::align(sizeof(FrameSlotHeader))};
+            if (AVAILABLE > OVERHEAD) {
+                // Use the largest slot payload (multiple of the alignment) that fits.
+                const uint32_t SLOT_SIZE{static_cast<uint32_t>(((AVAILABLE - OVERHEAD) / numberOfSlots) & ~(frameRingLayout::ALIGNMENT - 1))};
+                if (0 < SLOT_SIZE) {
+                    m_data = sharedMemory.data();
+                    m_header = reinterpret_cast<FrameRingHeader*>(m_data);
+                    m_header->version = FrameRingHeader::VERSION;
+                    m_header->numberOfSlots = numberOfSlots;
+                    m_header->slotSize = SLOT_SIZE;
+                    m_header->latest.store(0);
+                    m_header->futex.store(0);
+                    m_header->waiters.store(0);
+                    for (uint32_t i{0}; i < numberOfSlots; i++) {
+                        slot(i)->sequence.store(0);
+                    }
+                    // Publish the header last so that readers never see a partial one.
+                    m_header->magic.store(FrameRingHeader::MAGIC, std::memory_order_release);
+                }
+            }
+        }
+    }
+
+    bool valid() const noexcept {
+        return (nullptr != m_header);
+    }
+
+    /**
+     * @return Maximum number of bytes per frame.
+     */
+    uint32_t slotSize() const noexcept {
+        return (valid() ? m_header->slotSize : 0);
+    }
+
+    /**
+     * This method marks the next slot as being written.
+     *
+     * @return Pointer to the payload of the next slot.
+     */
+    char *beginWrite() noexcept {
+        if (!valid()) {
+            return nullptr;
+        }
+        m_frame = m_header->latest.load(std::memory_order_relaxed) + 1;
+        FrameSlotHeader *s{slot(m_frame % m_header->numberOfSlots)};
+        s->sequence.store(2 * m_frame - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return payload(s);
+    }
+
+    /**
+     * This method publishes the slot handed out by the last call to beginWrite()
+     * and wakes up readers waiting in FrameRingReader::wait().
+     *
+     * @param info Description of the written frame; its frameNumber is set here.
+     * @return Number of the frame that was published.
+     */
+    uint32_t endWrite(const FrameInfo &info) noexcept {
+        if (valid()) {
+            FrameSlotHeader *s{slot(m_frame % m_header->numberOfSlots)};
+            s->info = info;
+            s->info.frameNumber = m_frame;
+            s->sequence.store(2 * m_frame, std::memory_order_release);
+            m_header->latest.store(m_frame, std::memory_order_release);
+            m_header->futex.fetch_add(1, std::memory_order_seq_cst);
+#ifdef __linux__
+            if (0 < m_header->waiters.load(std::memory_order_seq_cst)) {
+                frameRingFutex::wakeAll(&m_header->futex);
+            }
+#endif
+        }
+        return m_frame;
+    }
+
+   private:
+    FrameSlotHeader *slot(uint32_t index) noexcept {
+        return reinterpret_cast<FrameSlotHeader*>(m_data + frameRingLayout::headerSize() + index * frameRingLayout::slotStride(m_header->slotSize));
+    }
+    static char *payload(FrameSlotHeader *s) noexcept {
+        return reinterpret_cast<char*>(s) + frameRingLayout::align(sizeof(FrameSlotHeader));
+    }
+
+   private:
+    char *m_data{nullptr};
+    FrameRingHeader *m_header{nullptr};
+    uint32_t m_frame{0};
+};
+
+/**
+ * A FrameRingReader attaches to a shared memory area written by a
+ * FrameRingWriter and copies the most recent complete frame without
+ * locking the shared memory.
+ */
+class FrameRingReader {
+   private:
+    FrameRingReader(const FrameRingReader &) = delete;
+    FrameRingReader(FrameRingReader &&)      = delete;
+    FrameRingReader &operator=(const FrameRingReader &) = delete;
+    FrameRingReader &operator=(FrameRingReader &&) = delete;
+
+   public:
+    explicit FrameRingReader(cluon::SharedMemory &sharedMemory) noexcept
+        : m_sharedMemory(sharedMemory)
+        , m_condition(sharedMemory) {
+        if ( sharedMemory.valid() && (sharedMemory.size() >= frameRingLayout::headerSize()) ) {
+            FrameRingHeader *header{reinterpret_cast<FrameRingHeader*>(sharedMemory.data())};
+            if ( (FrameRingHeader::MAGIC == header->magic.load(std::memory_order_acquire))
+              && (FrameRingHeader::VERSION == header->version)
+              && (1 < header->numberOfSlots)
+              && (frameRingLayout::requiredSize(header->numberOfSlots, header->slotSize) <= sharedMemory.size()) ) {
+                m_data = sharedMemory.data();
+                m_header = header;
+                m_seen = m_header->futex.load(std::memory_order_acquire);
+            }
+        }
+    }
+
+    /**
+     * @return True if the shared memory area contains a frame ring.
+     */
+    bool valid() const noexcept {
+        return (nullptr != m_header);
+    }
+
+    uint32_t slotSize() const noexcept {
+        return (valid() ? m_header->slotSize : 0);
+    }
+
+    /**
+     * @return Number of the last complete frame or 0 if none was written yet.
+     */
+    uint32_t latest() const noexcept {
+        return (valid() ? m_header->latest.load(std::memory_order_acquire) : 0);
+    }
+
+    /**
+     * This method blocks until a frame was published after the previous call.
+     * On Linux, it sleeps on the futex word in the ring header; elsewhere,
+     * it falls back to SharedMemory::wait().
+     */
+    void wait() noexcept {
+        if (!valid()) {
+            return;
+        }
+#ifdef __linux__
+        uint32_t current{m_header->futex.load(std::memory_order_acquire)};
+        while (current == m_seen) {
+            m_header->waiters.fetch_add(1, std::memory_order_seq_cst);
+            frameRingFutex::wait(&m_header->futex, current, nullptr);
+            m_header->waiters.fetch_sub(1, std::memory_order_seq_cst);
+            current = m_header->futex.load(std::memory_order_acquire);
+        }
+        m_seen = current;
+#else
+        m_sharedMemory.wait();
+#endif
+    }
+
+    /**
+     * This method blocks until a frame was published after the previous call
+     * or until the deadline passed.
+     *
+     * @param deadline Point in time when to stop waiting.
+     * @return true if a new frame was published; false if the deadline passed.
+     */
+    bool waitUntil(const std::chrono::steady_clock::time_point &deadline) noexcept {
+        if (!valid()) {
+            return false;
+        }
+#ifdef __linux__
+        uint32_t current{m_header->futex.load(std::memory_order_acquire)};
+        while (current == m_seen) {
+            const int64_t REMAINING{std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count()};
+            if (0 >= REMAINING) {
+                return false;
+            }
+            struct timespec timeout;
+            timeout.tv_sec = static_cast<time_t>(REMAINING / 1000000000);
+            timeout.tv_nsec = static_cast<long>(REMAINING % 1000000000);
+            m_header->waiters.fetch_add(1, std::memory_order_seq_cst);
+            frameRingFutex::wait(&m_header->futex, current, &timeout);
+            m_header->waiters.fetch_sub(1, std::memory_order_seq_cst);
+            current = m_header->futex.load(std::memory_order_acquire);
+        }
+        m_seen = current;
+        return true;
+#else
+        return m_condition.waitUntil(deadline);
+#endif
+    }
+
+    /**
+     * This method blocks until a frame was published after the previous call
+     * or until the timeout expired.
+     *
+     * @param timeout Maximum duration to wait.
+     * @return true if a new frame was published; false if the timeout expired.
+     */
+    bool waitFor(const std::chrono::microseconds &timeout) noexcept {
+        return waitUntil(std::chrono::steady_clock::now() + timeout);
+    }
+
+    /**
+     * @return Number of copies that were discarded because the writer overwrote the slot.
+     */
+    uint32_t tornReads() const noexcept {
+        return m_tornReads;
+    }
+
+    /**
+     * This method copies the most recent complete frame and its description.
+     *
+     * @param dst Destination buffer.
+     * @param size Capacity of dst; at most min(size, info.size) bytes are copied.
+     * @param info Description of the copied frame.
+     * @param region Part of the frame to copy; dst is left untouched outside of it.
+     * @return Number of the copied frame or 0 if no consistent copy could be made.
+     */
+    uint32_t read(char *dst, std::size_t size, FrameInfo &info, const FrameRegion &region = FrameRegion{}) noexcept {
+        return readWith(info, [dst, size, &region](const char *src, const FrameInfo &frame, std::size_t available) {
+            const std::size_t SIZE{std::min(size, available)};
+            // Copy only the requested region when the frame is described well enough to find it.
+            if ( (0 < region.left) || (0 < region.top) || (frame.width > region.right) || (frame.height > region.bottom) ) {
+                if (isValidFrameInfo(frame, SIZE)) {
+                    copyFrameRegion(dst, src, frame, region);
+                }
+            }
+            else {
+                copyFrame(dst, src, SIZE);
+            }
+        });
+    }
+
+    /**
+     * This method hands the most recent complete frame to a copy function
+     * that may copy (or transform) as much of it as it needs; the function
+     * is called again if the writer overwrote the slot in the meantime.
+     *
+     * @param info Description of the copied frame.
+     * @param copy Called as copy(const char *src, const FrameInfo &info, std::size_t available).
+     * @return Number of the copied frame or 0 if no consistent copy could be made.
+     */
+    template <typename Copy>
+    uint32_t readWith(FrameInfo &info, Copy &&copy) noexcept {
+        constexpr uint32_t MAX_RETRIES{8};
+        if (valid()) {
+            for (uint32_t i{0}; i < MAX_RETRIES; i++) {
+                const uint32_t LATEST{m_header->latest.load(std::memory_order_acquire)};
+                if (0 == LATEST) {
+                    break;
+                }
+                const FrameSlotHeader *s{slot(LATEST % m_header->numberOfSlots)};
+                const uint32_t BEFORE{s->sequence.load(std::memory_order_acquire)};
+                if (BEFORE == 2 * LATEST) {
+                    info = s->info;
+                    copy(payload(s), static_cast<const FrameInfo&>(info), std::min(static_cast<std::size_t>(info.size), static_cast<std::size_t>(m_header->slotSize)));
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (BEFORE == s->sequence.load(std::memory_order_relaxed)) {
+                        return LATEST;
+                    }
+                }
+                m_tornReads++;
+            }
+        }
+        return 0;
+    }
+
+   private:
+    const FrameSlotHeader *slot(uint32_t index) const noexcept {
+        return reinterpret_cast<const FrameSlotHeader*>(m_data + frameRingLayout::headerSize() + index * frameRingLayout::slotStride(m_header->slotSize));
+    }
+    static const char *payload(const FrameSlotHeader *s) noexcept {
+        return reinterpret_cast<const char*>(s) + frameRingLayout::align(sizeof(FrameSlotHeader));
+    }
+
+   private:
+    cluon::SharedMemory &m_sharedMemory;
+    SharedMemoryCondition m_condition;
+    char *m_data{nullptr};
+    FrameRingHeader *m_header{nullptr};
+    uint32_t m_seen{0};
+    uint32_t m_tornReads{0};
+};
+
+#endif
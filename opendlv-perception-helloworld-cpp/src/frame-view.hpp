@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_VIEW_HPP
+#define FRAME_VIEW_HPP
+
+#include "frame-ring.hpp"
+
+#include <opencv2/core/core.hpp>
+
+/*
+ * Helpers to wrap a frame buffer described by a FrameInfo as cv::Mat
+ * headers; no pixels are copied or allocated.
+ */
+
+/**
+ * @return CV_8UC4 image of an ARGB (B, G, R, A in memory) frame.
+ */
+inline cv::Mat wrapARGB(const FrameInfo &info, char *data) noexcept {
+    return cv::Mat(static_cast<int>(info.height), static_cast<int>(info.width), CV_8UC4, data, info.stride);
+}
+
+/**
+ * Planes of an I420 frame: full resolution luma and quarter resolution chroma.
+ */
+struct I420View {
+    cv::Mat y{};
+    cv::Mat u{};
+    cv::Mat v{};
+    cv::Mat yuv{}; // All three planes as one (height * 3/2) x width image, e.g., for cv::cvtColor.
+};
+
+inline I420View wrapI420(const FrameInfo &info, char *data) noexcept {
+    const int WIDTH{static_cast<int>(info.width)};
+    const int HEIGHT{static_cast<int>(info.height)};
+    const std::size_t LUMA{static_cast<std::size_t>(info.stride) * info.height};
+    const std::size_t CHROMA{LUMA / 4};
+
+    I420View view;
+    view.y = cv::Mat(HEIGHT, WIDTH, CV_8UC1, data, info.stride);
+    view.u = cv::Mat(HEIGHT / 2, WIDTH / 2, CV_8UC1, data + LUMA, info.stride / 2);
+    view.v = cv::Mat(HEIGHT / 2, WIDTH / 2, CV_8UC1, data + LUMA + CHROMA, info.stride / 2);
+    view.yuv = cv::Mat(HEIGHT * 3 / 2, WIDTH, CV_8UC1, data, info.stride);
+    return view;
+}
+
+#endif
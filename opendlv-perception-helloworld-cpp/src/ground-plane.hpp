@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GROUND_PLANE_HPP
+#define GROUND_PLANE_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * Mounting of the camera above flat ground.
+ */
+struct CameraPose {
+    float height{0.095f};  // Meters above the ground.
+    float pitch{0.0f};     // Degrees; positive when looking down.
+    float fovy{48.8f};     // Vertical field of view in degrees.
+};
+
+/**
+ * GroundPlaneTable maps every pixel of a pinhole camera (square pixels,
+ * principal point in the image center) to the point on flat ground that it
+ * shows, given in the vehicle frame with x forward and y to the left of the
+ * point below the camera, and to the azimuth of that point. As the camera
+ * pose is fixed, the table is computed once, or loaded from a file written
+ * by an earlier run, and detections only need a lookup.
+ *
+ * As the camera is only pitched, not rolled, all pixels of a row see the
+ * ground at the same distance x, and y grows linearly with the column.
+ * Thus, the table holds x and the lateral scale per row (8 bytes per row,
+ * a few kilobytes in total that stay in the cache); lookups compute y and
+ * the azimuth from them. Rows that do not see the ground within 32 m are
+ * marked as invalid.
+ */
+class GroundPlaneTable {
+   private:
+    GroundPlaneTable(const GroundPlaneTable &) = delete;
+    GroundPlaneTable(GroundPlaneTable &&)      = delete;
+    GroundPlaneTable &operator=(const GroundPlaneTable &) = delete;
+    GroundPlaneTable &operator=(GroundPlaneTable &&) = delete;
+
+   public:
+    GroundPlaneTable() = default;
+
+    bool valid() const noexcept {
+        return !m_rows.empty();
+    }
+
+    /**
+     * @return true if the table was made for the given pose and image size.
+     */
+    bool matches(const CameraPose &pose, uint32_t width, uint32_t height) const noexcept {
+        return valid() && (width == m_width) && (height == m_height) && equal(pose, m_pose);
+    }
+
+    /**
+     * This method computes the table.
+     */
+    void build(const CameraPose &pose, uint32_t width, uint32_t height) noexcept {
+        m_pose = pose;
+        m_width = width;
+        m_height = height;
+        m_rows.assign(height, Row{0.0f, 0.0f});
+
+        const double PI{3.14159265358979323846};
+        const double F{0.5 * height / std::tan(0.5 * pose.fovy * PI / 180.0)};
+        const double CY{0.5 * height - 0.5};
+        const double SIN_PITCH{std::sin(pose.pitch * PI / 180.0)};
+        const double COS_PITCH{std::cos(pose.pitch * PI / 180.0)};
+        for (uint32_t row{0}; row < height; row++) {
+            // Ray through this row in the vehicle frame (x forward, y left, z up),
+            // scaled to hit the ground at -height.
+            const double UP{(CY - row) / F};
+            const double FORWARD{COS_PITCH + SIN_PITCH * UP};
+            const double VERTICAL{COS_PITCH * UP - SIN_PITCH};
+            if (0.0 <= VERTICAL) {
+                continue;
+            }
+            const double SCALE{pose.height / -VERTICAL};
+            const double X{SCALE * FORWARD};
+            if (MAX_RANGE <= std::fabs(X)) {
+                continue;
+            }
+            m_rows[row] = Row{static_cast<float>(X), static_cast<float>(SCALE / F)};
+        }
+    }
+
+    /**
+     * This method loads a table written by save().
+     *
+     * @return false if the file is missing, damaged, or made for another pose or image size.
+     */
+    bool load(const std::string &filename, const CameraPose &pose, uint32_t width, uint32_t height) noexcept {
+        std::ifstream in(filename, std::ios::binary);
+        Header header;
+        if (!in.good() || !in.read(reinterpret_cast<char*>(&header), sizeof(Header)) ||
+            (MAGIC != header.magic) || (width != header.width) || (height != header.height) || !equal(pose, header.pose)) {
+            return false;
+        }
+        std::vector<Row> rows(height);
+        if (!in.read(reinterpret_cast<char*>(rows.data()), static_cast<std::streamsize>(rows.size() * sizeof(Row)))) {
+            return false;
+        }
+        m_rows.swap(rows);
+        m_pose = pose;
+        m_width = width;
+        m_height = height;
+        return true;
+    }
+
+    /**
+     * This method writes the table to be loaded by a later run.
+     */
+    bool save(const std::string &filename) const noexcept {
+        std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+        Header header;
+        header.width = m_width;
+        header.height = m_height;
+        header.pose = m_pose;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        out.write(reinterpret_cast<const char*>(m_rows.data()), static_cast<std::streamsize>(m_rows.size() * sizeof(Row)));
+        return out.good();
+    }
+
+    /**
+     * This method looks up the ground point shown by a pixel.
+     *
+     * @param x Meters forward.
+     * @param y Meters to the left.
+     * @param azimuth Radians; positive to the left.
+     * @return false if the pixel does not show the ground within range.
+     */
+    bool lookup(uint32_t col, uint32_t row, float &x, float &y, float &azimuth) const noexcept {
+        if ( (col >= m_width) || (row >= m_height) ) {
+            return false;
+        }
+        const Row &r{m_rows[row]};
+        const float Y{r.scale * (0.5f * static_cast<float>(m_width) - 0.5f - static_cast<float>(col))};
+        if ( (0.0f >= r.scale) || (MAX_RANGE <= std::fabs(Y)) ) {
+            return false;
+        }
+        x = r.x;
+        y = Y;
+        azimuth = std::atan2(Y, r.x);
+        return true;
+    }
+
+   private:
+    static bool equal(const CameraPose &a, const CameraPose &b) noexcept {
+        return (std::fabs(a.height - b.height) < 1e-6f) && (std::fabs(a.pitch - b.pitch) < 1e-6f) && (std::fabs(a.fovy - b.fovy) < 1e-6f);
+    }
+
+   private:
+    static constexpr float MAX_RANGE{32.0f};
+    static constexpr uint32_t MAGIC{0x524c5047};  // 'GPLR'; per row.
+
+    struct Row {
+        float x;      // Meters forward.
+        float scale;  // Meters to the left per column left of the center; 0 if the row is invalid.
+    };
+
+    struct Header {
+        uint32_t magic{MAGIC};
+        uint32_t width{0};
+        uint32_t height{0};
+        CameraPose pose{};
+    };
+
+    CameraPose m_pose{};
+    uint32_t m_width{0};
+    uint32_t m_height{0};
+    std::vector<Row> m_rows{};
+};
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCY_TRACE_HPP
+#define LATENCY_TRACE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+/**
+ * Points in time that a frame passes on its way through the pipeline, in
+ * microseconds since epoch like FrameInfo::sampleTimeStamp.
+ */
+struct FrameTimes {
+    int64_t acquired{0};         // Copied out of shared memory.
+    int64_t processingStart{0};  // Taken by the processing stage.
+    int64_t processed{0};        // Handed to the publishing stage.
+};
+
+/**
+ * LatencyHistogram counts durations in fixed buckets: one per microsecond
+ * below 16 us, and eight per power of two above, up to about 16 s. Hence,
+ * percentiles are accurate to 1/8 of their value, and recording is one
+ * increment without allocation. The maximum is kept exactly.
+ */
+class LatencyHistogram {
+   public:
+    static constexpr uint32_t LINEAR{16};
+    static constexpr uint32_t SUB_BUCKETS{8};
+    static constexpr uint32_t NUMBER_OF_BUCKETS{LINEAR + (24 - 4) * SUB_BUCKETS};
+
+   public:
+    /**
+     * This method counts one duration; negative durations count as 0.
+     */
+    void record(int64_t microseconds) noexcept {
+        const uint64_t VALUE{static_cast<uint64_t>(std::max<int64_t>(0, microseconds))};
+        m_buckets[bucket(VALUE)]++;
+        m_count++;
+        m_max = std::max(m_max, VALUE);
+    }
+
+    /**
+     * @return Upper bound of the bucket that holds the given fraction (0..1) of all durations.
+     */
+    uint64_t percentile(float fraction) const noexcept {
+        const uint64_t RANK{static_cast<uint64_t>(fraction * static_cast<float>(m_count) + 0.5f)};
+        uint64_t sum{0};
+        for (uint32_t i{0}; i < NUMBER_OF_BUCKETS; i++) {
+            sum += m_buckets[i];
+            if ( (0 < sum) && (sum >= RANK) ) {
+                return std::min(m_max, upperBound(i));
+            }
+        }
+        return m_max;
+    }
+
+    /**
+     * This method adds count durations to a bucket and raises the maximum
+     * to max; used to rebuild a histogram from one that is shared.
+     */
+    void add(uint32_t index, uint64_t count, uint64_t max) noexcept {
+        m_buckets[std::min(index, NUMBER_OF_BUCKETS - 1)] += count;
+        m_count += count;
+        m_max = std::max(m_max, max);
+    }
+
+    uint64_t max() const noexcept {
+        return m_max;
+    }
+
+    uint64_t count() const noexcept {
+        return m_count;
+    }
+
+    void reset() noexcept {
+        m_buckets.fill(0);
+        m_count = 0;
+        m_max = 0;
+    }
+
+    /**
+     * @return p50/p99/max in ms, e.g., "12.3/20.1/25.0".
+     */
+    std::string summary() const noexcept {
+        std::stringstream sstr;
+        sstr << std::fixed << std::setprecision(1)
+             << static_cast<double>(percentile(0.5f)) / 1000.0 << "/"
+             << static_cast<double>(percentile(0.99f)) / 1000.0 << "/"
+             << static_cast<double>(m_max) / 1000.0;
+        return sstr.str();
+    }
+
+    /**
+     * @return Index of the bucket that counts value.
+     */
+    static uint32_t bucket(uint64_t value) noexcept {
+        if (value < LINEAR) {
+            return static_cast<uint32_t>(value);
+        }
+        const uint32_t EXPONENT{63u - static_cast<uint32_t>(__builtin_clzll(value))};
+        const uint32_t INDEX{LINEAR + (EXPONENT - 4) * SUB_BUCKETS + static_cast<uint32_t>((value >> (EXPONENT - 3)) & (SUB_BUCKETS - 1))};
+        return std::min(INDEX, NUMBER_OF_BUCKETS - 1);
+    }
+
+    /**
+     * @return Largest value counted in the bucket at index.
+     */
+    static uint64_t upperBound(uint32_t index) noexcept {
+        if (index < LINEAR) {
+            return index;
+        }
+        const uint32_t EXPONENT{4 + (index - LINEAR) / SUB_BUCKETS};
+        const uint64_t SUB{(index - LINEAR) % SUB_BUCKETS};
+        return ((SUB_BUCKETS + SUB + 1) << (EXPONENT - 3)) - 1;
+    }
+
+   private:
+    std::array<uint64_t, NUMBER_OF_BUCKETS> m_buckets{};
+    uint64_t m_count{0};
+    uint64_t m_max{0};
+};
+
+/**
+ * LatencyTrace collects how long frames take from their sample time to
+ * each stage of the pipeline and to the messages that are sent for them.
+ * It is used by the publishing stage only.
+ */
+class LatencyTrace {
+   public:
+    /**
+     * This method records the times of a frame whose results were just sent.
+     *
+     * @param sampleTimeStamp Sample time of the frame.
+     * @param times Times of the frame in the stages.
+     * @param published Time when the results were sent.
+     */
+    void record(int64_t sampleTimeStamp, const FrameTimes &times, int64_t published) noexcept {
+        m_acquisition.record(times.acquired - sampleTimeStamp);
+        m_waiting.record(times.processingStart - times.acquired);
+        m_processing.record(times.processed - times.processingStart);
+        m_publishing.record(published - times.processed);
+        m_endToEnd.record(published - sampleTimeStamp);
+    }
+
+    /**
+     * @return Number of frames since the last reset().
+     */
+    uint64_t count() const noexcept {
+        return m_endToEnd.count();
+    }
+
+    const LatencyHistogram &endToEnd() const noexcept {
+        return m_endToEnd;
+    }
+
+    /**
+     * @return p50/p99/max of every stage since the last reset().
+     */
+    std::string report() const noexcept {
+        std::stringstream sstr;
+        sstr << "Latency p50/p99/max in ms over " << count() << " frames: "
+             << "sample to acquired " << m_acquisition.summary()
+             << ", queued " << m_waiting.summary()
+             << ", processing " << m_processing.summary()
+             << ", to sent " << m_publishing.summary()
+             << ", end-to-end " << m_endToEnd.summary() << ".";
+        return sstr.str();
+    }
+
+    void reset() noexcept {
+        m_acquisition.reset();
+        m_waiting.reset();
+        m_processing.reset();
+        m_publishing.reset();
+        m_endToEnd.reset();
+    }
+
+   private:
+    LatencyHistogram m_acquisition{};
+    LatencyHistogram m_waiting{};
+    LatencyHistogram m_processing{};
+    LatencyHistogram m_publishing{};
+    LatencyHistogram m_endToEnd{};
+};
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAT_ALLOCATOR_HPP
+#define MAT_ALLOCATOR_HPP
+
+#include "frame-buffer-pool.hpp"
+
+#include <opencv2/core/core.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+/**
+ * PooledMatAllocator serves the data of cv::Mat from preallocated,
+ * cache-line aligned buffers instead of the heap. Install it with
+ * cv::Mat::setDefaultAllocator() before any cv::Mat is created; then, also
+ * the temporaries that OpenCV functions create internally (e.g., the
+ * stripes of cv::remap) are recycled from frame to frame.
+ *
+ * Buffers come in a few size classes from 4 KiB to 1 MiB, growing by a
+ * factor of 4; each class is a FrameBufferPool. A request is served by the
+ * smallest class it fits into; larger requests, and requests for which
+ * all buffers of their class are taken, fall back to the heap and are
+ * counted as misses. The header of each matrix (cv::UMatData) comes from
+ * a pool as well.
+ *
+ * The allocator is used from all threads that create matrices.
+ */
+class PooledMatAllocator : public cv::MatAllocator {
+   public:
+    static constexpr uint32_t NUMBER_OF_CLASSES{5};
+    static constexpr std::size_t SMALLEST_CLASS{4 * 1024};
+
+   private:
+    PooledMatAllocator(const PooledMatAllocator &) = delete;
+    PooledMatAllocator(PooledMatAllocator &&)      = delete;
+    PooledMatAllocator &operator=(const PooledMatAllocator &) = delete;
+    PooledMatAllocator &operator=(PooledMatAllocator &&) = delete;
+
+#if CV_VERSION_MAJOR >= 4
+    using AccessFlags = cv::AccessFlag;
+#else
+    using AccessFlags = int;
+#endif
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param buffersPerClass Number of buffers in each size class.
+     */
+    explicit PooledMatAllocator(uint32_t buffersPerClass) noexcept
+        : cv::MatAllocator()
+        , m_headers{new FrameBufferPool{NUMBER_OF_CLASSES * buffersPerClass, sizeof(cv::UMatData)}} {
+        for (uint32_t i{0}; i < NUMBER_OF_CLASSES; i++) {
+            m_classes[i].reset(new FrameBufferPool{buffersPerClass, SMALLEST_CLASS << (2 * i)});
+        }
+    }
+
+    ~PooledMatAllocator() override = default;
+
+    /**
+     * @return True if all buffers could be allocated.
+     */
+    bool valid() const noexcept {
+        bool retVal{m_headers->valid()};
+        for (const auto &c : m_classes) {
+            retVal = retVal && c->valid();
+        }
+        return retVal;
+    }
+
+    /**
+     * @return Number of matrices whose data or header had to come from the heap.
+     */
+    uint64_t misses() const noexcept {
+        return m_misses.load(std::memory_order_relaxed);
+    }
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, AccessFlags, cv::UMatUsageFlags) const override {
+        // Same layout as OpenCV's default allocator: densely packed unless
+        // the caller brings its own data and steps.
+        std::size_t total{static_cast<std::size_t>(CV_ELEM_SIZE(type))};
+        for (int i{dims - 1}; i >= 0; i--) {
+            if (nullptr != step) {
+                if ( (nullptr != data) && (CV_AUTOSTEP != step[i]) ) {
+                    total = step[i];
+                }
+                else {
+                    step[i] = total;
+                }
+            }
+            total *= static_cast<std::size_t>(sizes[i]);
+        }
+
+        cv::UMatData *u{nullptr};
+        {
+            FrameBufferPool::Handle header{m_headers->acquire()};
+            if (header) {
+                u = new (header.release()) cv::UMatData(this);
+            }
+            else {
+                m_misses.fetch_add(1, std::memory_order_relaxed);
+                u = new cv::UMatData(this);
+            }
+        }
+
+        if (nullptr != data) {
+            u->data = u->origdata = static_cast<uchar*>(data);
+            u->flags |= cv::UMatData::USER_ALLOCATED;
+        }
+        else {
+            FrameBufferPool::Handle buffer{acquire(total)};
+            if (buffer) {
+                u->data = u->origdata = reinterpret_cast<uchar*>(buffer.release());
+            }
+            else {
+                m_misses.fetch_add(1, std::memory_order_relaxed);
+                u->data = u->origdata = static_cast<uchar*>(cv::fastMalloc(total));
+            }
+        }
+        u->size = total;
+        return u;
+    }
+
+    bool allocate(cv::UMatData *u, AccessFlags, cv::UMatUsageFlags) const override {
+        return (nullptr != u);
+    }
+
+    void deallocate(cv::UMatData *u) const override {
+        if (nullptr == u) {
+            return;
+        }
+        if (0 == (u->flags & cv::UMatData::USER_ALLOCATED)) {
+            char *buffer{reinterpret_cast<char*>(u->origdata)};
+            FrameBufferPool *pool{owner(buffer)};
+            if (nullptr != pool) {
+                // Returns the buffer to its pool.
+                FrameBufferPool::Handle released{buffer, FrameBufferPool::Releaser{pool}};
+            }
+            else {
+                cv::fastFree(u->origdata);
+            }
+            u->origdata = nullptr;
+        }
+
+        char *header{reinterpret_cast<char*>(u)};
+        if (m_headers->owns(header)) {
+            u->~UMatData();
+            FrameBufferPool::Handle released{header, FrameBufferPool::Releaser{m_headers.get()}};
+        }
+        else {
+            delete u;
+        }
+    }
+
+   private:
+    FrameBufferPool::Handle acquire(std::size_t size) const noexcept {
+        for (const auto &c : m_classes) {
+            if (size <= c->bufferSize()) {
+                return c->acquire();
+            }
+        }
+        return FrameBufferPool::Handle{nullptr, FrameBufferPool::Releaser{}};
+    }
+
+    FrameBufferPool *owner(const char *buffer) const noexcept {
+        for (const auto &c : m_classes) {
+            if (c->owns(buffer)) {
+                return c.get();
+            }
+        }
+        return nullptr;
+    }
+
+   private:
+    // OpenCV's interface is const; the pools themselves are thread-safe.
+    std::unique_ptr<FrameBufferPool> m_headers;
+    std::array<std::unique_ptr<FrameBufferPool>, NUMBER_OF_CLASSES> m_classes{};
+    mutable std::atomic<uint64_t> m_misses{0};
+};
+
+#endif
@@ -17,133 +17,741 @@
 
 #include "cluon-complete.hpp"
 #include "opendlv-standard-message-set.hpp"
+#include "async-log.hpp"
+#include "cone-blobs.hpp"
+#include "cone-controller.hpp"
+#include "cone-segmentation.hpp"
+#include "debug-overlay.hpp"
+#include "frame-arena.hpp"
+#include "frame-budget.hpp"
+#include "frame-buffer-pool.hpp"
+#include "frame-pyramid.hpp"
+#include "frame-ring.hpp"
+#include "frame-view.hpp"
+#include "ground-plane.hpp"
+#include "latency-trace.hpp"
+#include "mat-allocator.hpp"
+#include "pipeline.hpp"
+#include "processing-stage.hpp"
+#include "region-of-interest.hpp"
+#include "sensor-store.hpp"
+#include "stage-telemetry.hpp"
+#include "undistortion.hpp"
+#include "work-stealing-pool.hpp"
 
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <memory>
-#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// The latest cones handed from the processing stage to the control loop.
+struct PerceptionResult {
+    ConeDetections cones{};
+    int64_t sampleTimeStamp{0};
+};
 
 int32_t main(int32_t argc, char **argv) {
     int32_t retCode{1};
     auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
     if ( (0 == commandlineArguments.count("cid")) ||
-         (0 == commandlineArguments.count("name")) ||
-         (0 == commandlineArguments.count("width")) ||
-         (0 == commandlineArguments.count("height")) ) {
-        std::cerr << argv[0] << " attaches to a shared memory area containing an ARGB image." << std::endl;
-        std::cerr << "Usage:   " << argv[0] << " --cid=<OD4 session> --name=<name of shared memory area> [--verbose]" << std::endl;
+         (0 == commandlineArguments.count("name")) ) {
+        std::cerr << argv[0] << " attaches to a shared memory area containing an ARGB or I420 image." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " --cid=<OD4 session> --name=<name of shared memory area> [--width=<width> --height=<height>] [--format=<argb|i420>] [--buffers=<n>] [--timeout=<ms>] [--blue=<ranges>] [--yellow=<ranges>] [--simd=<kernel>] [--cpu-acquire=<core>] [--cpu-process=<core>] [--cpu-publish=<core>] [--tile-threads=<n>] [--cpu-tiles=<c0,c1,...>] [--budget=<ms>] [--no-shedding] [--fovy=<deg>] [--cone-height=<m>] [--min-area=<px>] [--camera-height=<m>] [--camera-pitch=<deg>] [--ground-table=<file>] [--calibration=<file>] [--undistort=<mode>] [--undistort-roi=<x,y,w,h>] [--roi-band=<from,to>] [--roi-polygon=<x0,y0,x1,y1,...>] [--roi-follow] [--detect-every=<n>] [--pyramid=<levels>] [--shed-pyramid=<levels>] [--debug-stream=<name>] [--debug-rate=<Hz>] [--cpu-debug=<core>] [--log-level=<levels>] [--log-rate=<n>] [--log-od4] [--telemetry=<Hz>] [--control-rate=<Hz>] [--control-timeout=<ms>] [--cpu-control=<core>] [--lookahead=<m>] [--steering-gain=<k>] [--pedal=<p>] [--min-pedal=<p>] [--stop-distance=<m>] [--verbose]" << std::endl;
         std::cerr << "         --cid:    CID of the OD4Session to send and receive messages" << std::endl;
         std::cerr << "         --name:   name of the shared memory area to attach" << std::endl;
-        std::cerr << "         --width:  width of the frame" << std::endl;
-        std::cerr << "         --height: height of the frame" << std::endl;
-        std::cerr << "Example: " << argv[0] << " --cid=112 --name=img.argb --width=640 --height=480 --verbose" << std::endl;
+        std::cerr << "         --width:  width of the frame; only needed for areas without frame ring" << std::endl;
+        std::cerr << "         --height: height of the frame; only needed for areas without frame ring" << std::endl;
+        std::cerr << "         --format: pixel format for areas without frame ring (default: i420 if the name contains 'i420', argb otherwise)" << std::endl;
+        std::cerr << "         --buffers: number of preallocated frame buffers (default: 5)" << std::endl;
+        std::cerr << "         --timeout: report a stalled camera when no frame arrived within this time in ms; the control loop then stops Kiwi (default: 500)" << std::endl;
+        std::cerr << "         --blue:   YUV ranges for blue cones as minY,maxY,minU,maxU,minV,maxV (default: 20,200,140,255,0,125)" << std::endl;
+        std::cerr << "         --yellow: YUV ranges for yellow cones as minY,maxY,minU,maxU,minV,maxV (default: 90,255,0,110,130,180)" << std::endl;
+        std::cerr << "         --simd:   segmentation kernel to use: scalar, sse2, avx2, neon if the CPU supports it (default: fastest available)" << std::endl;
+        std::cerr << "         --cpu-acquire: pin the frame acquisition stage to this core" << std::endl;
+        std::cerr << "         --cpu-process: pin the image processing stage to this core" << std::endl;
+        std::cerr << "         --cpu-publish: pin the display and publishing stage to this core" << std::endl;
+        std::cerr << "         --tile-threads: threads besides the processing thread that segment and search tiles of each frame (default: 0)" << std::endl;
+        std::cerr << "         --cpu-tiles: cores for these threads, e.g., all but the one running the UDP receiver (default: one thread per core given)" << std::endl;
+        std::cerr << "         --budget: processing time per frame in ms before shedding load (default: 80% of the frame period)" << std::endl;
+        std::cerr << "         --no-shedding: always process full frames; only report overruns" << std::endl;
+        std::cerr << "         --fovy:   vertical field of view of the camera in degrees (default: 48.8)" << std::endl;
+        std::cerr << "         --cone-height: height of a cone in m to estimate its distance (default: 0.1)" << std::endl;
+        std::cerr << "         --min-area: smallest blob in pixels that is reported as cone (default: 20)" << std::endl;
+        std::cerr << "         --camera-height: height of the camera above the ground in m (default: 0.095)" << std::endl;
+        std::cerr << "         --camera-pitch: downward pitch of the camera in degrees (default: 0)" << std::endl;
+        std::cerr << "         --ground-table: file to cache the pixel to ground plane table in" << std::endl;
+        std::cerr << "         --calibration: camera calibration in OpenCV's format to correct lens distortion" << std::endl;
+        std::cerr << "         --undistort: points (cone key points only), roi (labels in --undistort-roi), frame (all labels), none (default: points)" << std::endl;
+        std::cerr << "         --undistort-roi: rectangle to undistort in mode roi (default: lower 60% of the frame)" << std::endl;
+        std::cerr << "         --roi-band: rows to process as degrees below the horizon, or none (default: -5,90)" << std::endl;
+        std::cerr << "         --roi-polygon: only process pixels inside this polygon" << std::endl;
+        std::cerr << "         --roi-follow: only process the surroundings of the cones in the previous frame" << std::endl;
+        std::cerr << "         --detect-every: search the whole ROI only every n frames and follow tracked cones in between (default: 10 with --roi-follow)" << std::endl;
+        std::cerr << "         --pyramid: detect cones on a frame downsampled this many times (1-3) and label only their surroundings at full resolution" << std::endl;
+        std::cerr << "         --shed-pyramid: without --pyramid, do so with this many times downsampled frames as first load shedding level; 0 disables (default: 1)" << std::endl;
+        std::cerr << "         --debug-stream: write frames with cones, labels, and ROI into a new shared memory area of this name instead of showing them (I420 if the name contains 'i420', ARGB otherwise)" << std::endl;
+        std::cerr << "         --debug-rate: frames per second to write to the debug stream at most (default: 5)" << std::endl;
+        std::cerr << "         --cpu-debug: pin the debug stream's thread to this core" << std::endl;
+        std::cerr << "         --log-level: most verbose level to log (3: errors .. 7: debug), for all or as category:level,... for general, acquisition, processing, publishing, sensors, control (default: 6 with --verbose, 5 otherwise)" << std::endl;
+        std::cerr << "         --log-rate: messages per second and category to log at most (default: 20)" << std::endl;
+        std::cerr << "         --log-od4: publish log messages in batches as opendlv.system.LogMessage instead of writing them to stderr" << std::endl;
+        std::cerr << "         --telemetry: publish run time histograms of all stages this often as opendlv.system.LogMessage; 0 disables (default: 1)" << std::endl;
+        std::cerr << "         --control-rate: steer along the cones and send steering and pedal requests this often; 0 disables (default: 0)" << std::endl;
+        std::cerr << "         --control-timeout: center the steering and release the pedal when the latest cones are older than this in ms, and release the pedal when the front distance reading is older (default: 500)" << std::endl;
+        std::cerr << "         --cpu-control: pin the control loop to this core" << std::endl;
+        std::cerr << "         --lookahead: distance in m to the cones that are followed (default: 0.7)" << std::endl;
+        std::cerr << "         --steering-gain: factor on the steering angle towards the middle of the lane (default: 1)" << std::endl;
+        std::cerr << "         --pedal:  pedal position on straights (default: 0.15)" << std::endl;
+        std::cerr << "         --min-pedal: pedal position at full steering and when no cone is seen (default: 0.08)" << std::endl;
+        std::cerr << "         --stop-distance: release the pedal when the front distance is closer than this in m (default: 0.25)" << std::endl;
+        std::cerr << "         --verbose: print statistics, and show frames and labels in windows unless --debug-stream is given" << std::endl;
+        std::cerr << "Example: " << argv[0] << " --cid=112 --name=img.i420 --width=640 --height=480 --verbose" << std::endl;
     }
     else {
         const std::string NAME{commandlineArguments["name"]};
-        const uint32_t WIDTH{static_cast<uint32_t>(std::stoi(commandlineArguments["width"]))};
-        const uint32_t HEIGHT{static_cast<uint32_t>(std::stoi(commandlineArguments["height"]))};
+        const uint32_t WIDTH{(commandlineArguments.count("width") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["width"])) : 0};
+        const uint32_t HEIGHT{(commandlineArguments.count("height") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["height"])) : 0};
+        const std::string FORMAT{(commandlineArguments.count("format") != 0) ? commandlineArguments["format"] : ((std::string::npos != NAME.find("i420")) ? "i420" : "argb")};
+        if ( ("argb" != FORMAT) && ("i420" != FORMAT) ) {
+            std::cerr << argv[0] << ": The format must be given as argb or i420." << std::endl;
+            return retCode;
+        }
+        const uint32_t FOURCC{("i420" == FORMAT) ? FOURCC_I420 : FOURCC_ARGB};
+        const uint32_t BUFFERS{(commandlineArguments.count("buffers") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["buffers"])) : 5};
+        const std::chrono::milliseconds TIMEOUT{(commandlineArguments.count("timeout") != 0) ? std::stoi(commandlineArguments["timeout"]) : 500};
+        const int32_t CPU_ACQUIRE{(commandlineArguments.count("cpu-acquire") != 0) ? std::stoi(commandlineArguments["cpu-acquire"]) : -1};
+        const int32_t CPU_PROCESS{(commandlineArguments.count("cpu-process") != 0) ? std::stoi(commandlineArguments["cpu-process"]) : -1};
+        const int32_t CPU_PUBLISH{(commandlineArguments.count("cpu-publish") != 0) ? std::stoi(commandlineArguments["cpu-publish"]) : -1};
+        std::vector<int32_t> tileCores;
+        if ( (commandlineArguments.count("cpu-tiles") != 0) && !parseCoreList(commandlineArguments["cpu-tiles"], tileCores) ) {
+            std::cerr << argv[0] << ": Cores must be given as a comma separated list of indices." << std::endl;
+            return retCode;
+        }
+        const uint32_t TILE_THREADS{(commandlineArguments.count("tile-threads") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["tile-threads"])) : static_cast<uint32_t>(tileCores.size())};
+        const std::chrono::microseconds BUDGET{(commandlineArguments.count("budget") != 0) ? static_cast<int64_t>(std::stod(commandlineArguments["budget"]) * 1000.0) : 0};
+        const bool SHEDDING{commandlineArguments.count("no-shedding") == 0};
+        const uint32_t PYRAMID_LEVELS{(commandlineArguments.count("pyramid") != 0) ? std::min(PyramidLayout::MAX_LEVELS, static_cast<uint32_t>(std::stoi(commandlineArguments["pyramid"]))) : 0};
+        const uint32_t SHED_PYRAMID_LEVELS{(commandlineArguments.count("shed-pyramid") != 0) ? std::min(PyramidLayout::MAX_LEVELS, static_cast<uint32_t>(std::stoi(commandlineArguments["shed-pyramid"]))) : 1};
+        const CoarseDetection COARSE_DETECTION{(0 < PYRAMID_LEVELS) ? CoarseDetection::ALWAYS : (((0 < SHED_PYRAMID_LEVELS) && SHEDDING) ? CoarseDetection::WHEN_SHEDDING : CoarseDetection::NEVER)};
+        const uint32_t COARSE_LEVELS{(0 < PYRAMID_LEVELS) ? PYRAMID_LEVELS : ((CoarseDetection::NEVER != COARSE_DETECTION) ? SHED_PYRAMID_LEVELS : 0)};
+        const std::string DEBUG_STREAM{commandlineArguments["debug-stream"]};
+        const float DEBUG_RATE{(commandlineArguments.count("debug-rate") != 0) ? std::stof(commandlineArguments["debug-rate"]) : 5.0f};
+        const int32_t CPU_DEBUG{(commandlineArguments.count("cpu-debug") != 0) ? std::stoi(commandlineArguments["cpu-debug"]) : -1};
+        const float TELEMETRY_RATE{(commandlineArguments.count("telemetry") != 0) ? std::stof(commandlineArguments["telemetry"]) : 1.0f};
+        const float CONTROL_RATE{(commandlineArguments.count("control-rate") != 0) ? std::stof(commandlineArguments["control-rate"]) : 0.0f};
+        const int32_t CPU_CONTROL{(commandlineArguments.count("cpu-control") != 0) ? std::stoi(commandlineArguments["cpu-control"]) : -1};
         const bool VERBOSE{commandlineArguments.count("verbose") != 0};
 
+        // All matrices, including OpenCV's internal temporaries, take their
+        // data from preallocated buffers. The allocator is never deleted as
+        // OpenCV may still release matrices when the program exits.
+        PooledMatAllocator *matAllocator{new PooledMatAllocator{4}};
+        if (!matAllocator->valid()) {
+            std::cerr << argv[0] << ": Failed to allocate matrix buffers." << std::endl;
+            return retCode;
+        }
+        cv::Mat::setDefaultAllocator(matAllocator);
+
+        SegmentationParameters segmentationParameters;
+        if ( ((commandlineArguments.count("blue") != 0) && !parseColourRange(commandlineArguments["blue"], segmentationParameters.blue)) ||
+             ((commandlineArguments.count("yellow") != 0) && !parseColourRange(commandlineArguments["yellow"], segmentationParameters.yellow)) ) {
+            std::cerr << argv[0] << ": Colour ranges must be given as six values in [0, 255]." << std::endl;
+            return retCode;
+        }
+        ConeSegmentation::Path simdPath{ConeSegmentation::Path::SCALAR};
+        if (!ConeSegmentation::parsePath(commandlineArguments["simd"], simdPath) || !ConeSegmentation::supported(simdPath)) {
+            std::cerr << argv[0] << ": The segmentation kernel must be a kernel this CPU supports: scalar, sse2, avx2, or neon." << std::endl;
+            return retCode;
+        }
+        const ConeSegmentation segmentation{segmentationParameters, commandlineArguments["simd"]};
+
+        ConeGeometry coneGeometry;
+        coneGeometry.fovy = (commandlineArguments.count("fovy") != 0) ? std::stof(commandlineArguments["fovy"]) : coneGeometry.fovy;
+        coneGeometry.coneHeight = (commandlineArguments.count("cone-height") != 0) ? std::stof(commandlineArguments["cone-height"]) : coneGeometry.coneHeight;
+        coneGeometry.minArea = (commandlineArguments.count("min-area") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["min-area"])) : coneGeometry.minArea;
+
+        CameraPose cameraPose;
+        cameraPose.height = (commandlineArguments.count("camera-height") != 0) ? std::stof(commandlineArguments["camera-height"]) : cameraPose.height;
+        cameraPose.pitch = (commandlineArguments.count("camera-pitch") != 0) ? std::stof(commandlineArguments["camera-pitch"]) : cameraPose.pitch;
+
+        ControllerParameters controllerParameters;
+        controllerParameters.lookahead = (commandlineArguments.count("lookahead") != 0) ? std::stof(commandlineArguments["lookahead"]) : controllerParameters.lookahead;
+        controllerParameters.steeringGain = (commandlineArguments.count("steering-gain") != 0) ? std::stof(commandlineArguments["steering-gain"]) : controllerParameters.steeringGain;
+        controllerParameters.pedal = (commandlineArguments.count("pedal") != 0) ? std::stof(commandlineArguments["pedal"]) : controllerParameters.pedal;
+        controllerParameters.minPedal = (commandlineArguments.count("min-pedal") != 0) ? std::stof(commandlineArguments["min-pedal"]) : controllerParameters.minPedal;
+        controllerParameters.stopDistance = (commandlineArguments.count("stop-distance") != 0) ? std::stof(commandlineArguments["stop-distance"]) : controllerParameters.stopDistance;
+        controllerParameters.timeout = (commandlineArguments.count("control-timeout") != 0) ? std::stof(commandlineArguments["control-timeout"]) / 1000.0f : controllerParameters.timeout;
+        cameraPose.fovy = coneGeometry.fovy;
+        const std::string GROUND_TABLE{commandlineArguments["ground-table"]};
+
+        cv::Rect undistortionROI;
+        if (commandlineArguments.count("undistort-roi") != 0) {
+            std::stringstream sstr{commandlineArguments["undistort-roi"]};
+            char comma{0};
+            sstr >> undistortionROI.x >> comma >> undistortionROI.y >> comma >> undistortionROI.width >> comma >> undistortionROI.height;
+        }
+        RoiParameters roiParameters;
+        roiParameters.follow = (commandlineArguments.count("roi-follow") != 0) || (commandlineArguments.count("detect-every") != 0);
+        roiParameters.fullScanInterval = (commandlineArguments.count("detect-every") != 0) ? static_cast<uint32_t>(std::max(1, std::stoi(commandlineArguments["detect-every"]))) : roiParameters.fullScanInterval;
+        if ( ((commandlineArguments.count("roi-band") != 0) && !parseRoiBand(commandlineArguments["roi-band"], roiParameters)) ||
+             ((commandlineArguments.count("roi-polygon") != 0) && !parseRoiPolygon(commandlineArguments["roi-polygon"], roiParameters)) ) {
+            std::cerr << argv[0] << ": The ROI must be given as band 'from,to' in degrees or as polygon 'x0,y0,x1,y1,x2,y2,...' in pixels." << std::endl;
+            return retCode;
+        }
+        RegionOfInterest regionOfInterest{roiParameters, cameraPose};
+
+        Undistortion::Mode undistortionMode{Undistortion::Mode::POINTS};
+        if (!Undistortion::parseMode(commandlineArguments["undistort"], undistortionMode)) {
+            std::cerr << argv[0] << ": The lens correction must be one of points, roi, frame, or none." << std::endl;
+            return retCode;
+        }
+        Undistortion undistortion{undistortionMode, undistortionROI};
+        if (commandlineArguments.count("calibration") != 0) {
+            if (!undistortion.load(commandlineArguments["calibration"])) {
+                std::cerr << argv[0] << ": Failed to read camera calibration from '" << commandlineArguments["calibration"] << "'." << std::endl;
+                return retCode;
+            }
+            std::clog << argv[0] << ": Correcting lens distortion with '" << commandlineArguments["calibration"] << "'." << std::endl;
+        }
+        std::clog << argv[0] << ": Using " << segmentation.pathName() << " kernel for cone segmentation." << std::endl;
+
         // Attach to the shared memory.
         std::unique_ptr<cluon::SharedMemory> sharedMemory{new cluon::SharedMemory{NAME}};
         if (sharedMemory && sharedMemory->valid()) {
             std::clog << argv[0] << ": Attached to shared memory '" << sharedMemory->name() << " (" << sharedMemory->size() << " bytes)." << std::endl;
 
+            // Producers that use a FrameRingWriter let us copy frames without
+            // locking and describe each frame; other producers just write
+            // WIDTH x HEIGHT pixels in FORMAT.
+            FrameRingReader frameRing{*sharedMemory};
+            SharedMemoryCondition sharedMemoryCondition{*sharedMemory};
+            const uint32_t STRIDE{(FOURCC_I420 == FOURCC) ? WIDTH : WIDTH * 4};
+            const std::size_t FRAME_SIZE{frameRing.valid() ? frameRing.slotSize() : ((FOURCC_I420 == FOURCC) ? static_cast<std::size_t>(STRIDE) * HEIGHT * 3 / 2 : static_cast<std::size_t>(STRIDE) * HEIGHT)};
+            if (frameRing.valid()) {
+                std::clog << argv[0] << ": Found lock-free frame ring in '" << sharedMemory->name() << "'." << std::endl;
+            }
+            else if ( (0 == FRAME_SIZE) || (FRAME_SIZE > sharedMemory->size()) ) {
+                std::cerr << argv[0] << ": Frame of " << WIDTH << "x" << HEIGHT << " does not fit into shared memory '" << sharedMemory->name() << "'; --width and --height are needed." << std::endl;
+                return retCode;
+            }
+
+            // Preallocate the frames to copy into and their labels so that
+            // the stages do not allocate; a stage that finds its pool empty
+            // drops the frame instead of queueing stale data. The debug
+            // stream holds on to up to two more frames.
+            const uint32_t FRAME_BUFFERS{BUFFERS + (DEBUG_STREAM.empty() ? 0 : 2)};
+            FrameBufferPool framePool{FRAME_BUFFERS, FRAME_SIZE};
+            FrameBufferPool labelPool{FRAME_BUFFERS, frameRing.valid() ? FRAME_SIZE : static_cast<std::size_t>(WIDTH) * HEIGHT};
+            FrameBufferPool pyramidPool{(0 < COARSE_LEVELS) ? BUFFERS : 0, pyramidCapacity(FRAME_SIZE)};
+            if (!framePool.valid() || !labelPool.valid() || ((0 < COARSE_LEVELS) && !pyramidPool.valid()) ) {
+                std::cerr << argv[0] << ": Failed to allocate " << BUFFERS << " frame buffers." << std::endl;
+                return retCode;
+            }
+
             // Interface to a running OpenDaVINCI session; here, you can send and receive messages.
             cluon::OD4Session od4{static_cast<uint16_t>(std::stoi(commandlineArguments["cid"]))};
 
-            // Handler to receive distance readings (realized as C++ lambda).
-            std::mutex distancesMutex;
-            float front{0};
-            float rear{0};
-            float left{0};
-            float right{0};
-            auto onDistance = [&distancesMutex, &front, &rear, &left, &right](cluon::data::Envelope &&env){
-                auto senderStamp = env.senderStamp();
-                // Now, we unpack the cluon::data::Envelope to get the desired DistanceReading.
-                opendlv::proxy::DistanceReading dr = cluon::extractMessage<opendlv::proxy::DistanceReading>(std::move(env));
-
-                // Store distance readings.
-                std::lock_guard<std::mutex> lck(distancesMutex);
-                switch (senderStamp) {
-                    case 0: front = dr.distance(); break;
-                    case 2: rear = dr.distance(); break;
-                    case 1: left = dr.distance(); break;
-                    case 3: right = dr.distance(); break;
+            // The stages only queue log messages; a thread of its own writes
+            // them in batches.
+            AsyncLog logger{argv[0], (commandlineArguments.count("log-od4") != 0) ? &od4 : nullptr, std::chrono::milliseconds(100)};
+            logger.setLevel(VERBOSE ? LogLevel::INFO : LogLevel::NOTICE);
+            logger.setRate((commandlineArguments.count("log-rate") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["log-rate"])) : 20);
+            if ( (commandlineArguments.count("log-level") != 0) && !parseLogLevels(commandlineArguments["log-level"], logger) ) {
+                std::cerr << argv[0] << ": Log levels must be given as 3..7 or as category:level,..." << std::endl;
+                return retCode;
+            }
+
+            // Keep the latest value of every sensor reading; the frame loop
+            // reads them without ever blocking the receiving thread.
+            SensorStore sensors;
+            subscribeToReadings(od4, sensors);
+
+            // The frame loop runs as three stages on their own threads that
+            // hand over frames through bounded queues: while frame N is
+            // processed, frame N+1 is acquired and frame N-1 is published.
+            SpscQueue<AcquiredFrame> acquiredFrames{1};
+            SpscQueue<ProcessedFrame> processedFrames{1};
+            SpscQueue<ProcessedFrame> debugFrames{1};
+
+            // Set by the acquisition stage while no frames arrive; only the
+            // control loop, which owns actuation, acts on it.
+            std::atomic<bool> cameraStalled{false};
+
+            // When processing cannot keep up with the camera, leave out rows
+            // and frames rather than falling behind; the top rows mostly
+            // show the sky and the surroundings of the track.
+            // When cones can be detected on a frame pyramid, that comes first.
+            FrameBudget frameBudget{BUDGET, 0.4f, SHEDDING, COARSE_DETECTION};
+
+            // Every stage records its run time; a snapshot of all stages is
+            // published every second so that the CPU budget use per stage
+            // can be watched live on the vehicle.
+            StageTelemetry telemetry;
+
+            // The control loop runs at its own fixed rate and always takes
+            // the latest cones; the processing stage never waits for it.
+            LatestValue<PerceptionResult> perceptionResults;
+
+            // Segmentation and blob extraction are split into tiles of rows
+            // that a small pool works on together with the processing stage;
+            // OpenCV's own threads would only compete with it.
+            WorkStealingPool tilePool{TILE_THREADS, tileCores};
+
+            // The processing stage is shared with the benchmark and the
+            // closed-loop simulation; it only runs on the processing thread.
+            ProcessingStage processingStage{segmentation, coneGeometry, cameraPose, COARSE_LEVELS, GROUND_TABLE,
+                                            regionOfInterest, undistortion, frameBudget, tilePool, telemetry, logger};
+            if (1 < tilePool.size()) {
+                cv::setNumThreads(0);
+                std::clog << argv[0] << ": Processing " << processingStage.tiles() << " tiles per frame on " << tilePool.size() << " threads." << std::endl;
+                if (!tileCores.empty() && (tilePool.pinnedWorkers() + 1 < tilePool.size())) {
+                    std::cerr << argv[0] << ": Failed to pin tile threads to cores " << commandlineArguments["cpu-tiles"] << "." << std::endl;
                 }
-            };
-            // Finally, we register our lambda for the message identifier for opendlv::proxy::DistanceReading.
-            od4.dataTrigger(opendlv::proxy::DistanceReading::ID(), onDistance);
+            }
 
-            // Endless loop; end the program by pressing Ctrl-C.
-            while (od4.isRunning()) {
-                cv::Mat img;
+            ////////////////////////////////////////////////////////////////////
+            // Stage 1: Acquire frames from shared memory.
+            std::thread acquisition([&]() {
+                if (!pinCurrentThreadToCore(CPU_ACQUIRE)) {
+                    logger.log(LogCategory::ACQUISITION, LogLevel::ERROR, "Failed to pin acquisition to core %d.", CPU_ACQUIRE);
+                }
 
-                // Wait for a notification of a new frame.
-                sharedMemory->wait();
+                bool stalled{false};
+                uint32_t frameCounter{0};
+                uint32_t lastFrameNumber{0};
+                uint64_t droppedFrames{0};
+                while (od4.isRunning()) {
+                    // Wait for a notification of a new frame; the timeout lets us
+                    // re-check od4.isRunning() and react to a stalled camera.
+                    const bool NEW_FRAME{frameRing.valid() ? frameRing.waitFor(TIMEOUT) : sharedMemoryCondition.waitFor(TIMEOUT)};
+                    if (!NEW_FRAME) {
+                        if (!stalled) {
+                            logger.log(LogCategory::ACQUISITION, LogLevel::WARNING, "No frame within %lld ms.", static_cast<long long>(TIMEOUT.count()));
+                            cameraStalled.store(true, std::memory_order_release);
+                            stalled = true;
+                        }
+                        continue;
+                    }
+                    if (stalled) {
+                        logger.log(LogCategory::ACQUISITION, LogLevel::NOTICE, "Frames arrive again.");
+                        cameraStalled.store(false, std::memory_order_release);
+                        stalled = false;
+                    }
+                    const auto ACQUISITION_START{std::chrono::steady_clock::now()};
 
-                // Lock the shared memory.
-                sharedMemory->lock();
-                {
-                    // Copy image into cvMat structure.
-                    // Be aware of that any code between lock/unlock is blocking
-                    // the camera to provide the next frame. Thus, any
-                    // computationally heavy algorithms should be placed outside
-                    // lock/unlock
-                    cv::Mat wrapped(HEIGHT, WIDTH, CV_8UC4, sharedMemory->data());
-                    img = wrapped.clone();
+                    // Take the next free frame buffer; it returns to the pool
+                    // when the last stage is done with it.
+                    AcquiredFrame frame{framePool.acquire(), FrameInfo{}, regionOfInterest.region()};
+                    if (!frame.buffer) {
+                        continue;
+                    }
+                    if ( (0 < COARSE_LEVELS) && frameBudget.shedding().coarseDetection ) {
+                        frame.pyramid = pyramidPool.acquire();
+                        if (!frame.pyramid) {
+                            continue;
+                        }
+                    }
+
+                    // Only the region of interest is copied; in pyramid mode,
+                    // the downsampled levels are built in the same pass.
+                    FrameInfo &info{frame.info};
+                    const auto COPY_START{std::chrono::steady_clock::now()};
+                    if (frameRing.valid()) {
+                        // Copy the latest complete frame; the producer is never blocked.
+                        const uint32_t COPIED{frame.pyramid ?
+                            frameRing.readWith(info, [&frame, &FRAME_SIZE, &COARSE_LEVELS](const char *src, const FrameInfo &i, std::size_t available) {
+                                if (isValidFrameInfo(i, std::min(FRAME_SIZE, available))) {
+                                    copyFrameRegionWithPyramid(frame.buffer.get(), frame.pyramid.get(), src, pyramidLayout(i, COARSE_LEVELS), frame.region, frame.pyramidTimings);
+                                }
+                            }) :
+                            frameRing.read(frame.buffer.get(), FRAME_SIZE, info, frame.region)};
+                        telemetry.record(Stage::COPY, COPY_START, std::chrono::steady_clock::now());
+                        if (0 == COPIED) {
+                            continue;
+                        }
+                        if (!isValidFrameInfo(info, FRAME_SIZE)) {
+                            logger.log(LogCategory::ACQUISITION, LogLevel::ERROR, "Skipping frame %u with unsupported format or geometry (%ux%u).", info.frameNumber, info.width, info.height);
+                            continue;
+                        }
+                    }
+                    else {
+                        info.fourcc = FOURCC;
+                        info.width = WIDTH;
+                        info.height = HEIGHT;
+                        info.stride = STRIDE;
+                        info.size = static_cast<uint32_t>(FRAME_SIZE);
+                        info.frameNumber = ++frameCounter;
+
+                        // Lock the shared memory.
+                        sharedMemory->lock();
+                        {
+                            // Copy image into the preallocated frame buffer.
+                            // Be aware of that any code between lock/unlock is blocking
+                            // the camera to provide the next frame. Thus, any
+                            // computationally heavy algorithms should be placed outside
+                            // lock/unlock
+                            if (frame.pyramid) {
+                                copyFrameRegionWithPyramid(frame.buffer.get(), frame.pyramid.get(), sharedMemory->data(), pyramidLayout(info, COARSE_LEVELS), frame.region, frame.pyramidTimings);
+                            }
+                            else {
+                                copyFrameRegion(frame.buffer.get(), sharedMemory->data(), info, frame.region);
+                            }
+                            info.sampleTimeStamp = cluon::time::toMicroseconds(sharedMemory->getTimeStamp().second);
+                        }
+                        sharedMemory->unlock();
+                        telemetry.record(Stage::COPY, COPY_START, std::chrono::steady_clock::now());
+                    }
+
+                    // Count the frames that the producer wrote but we never saw.
+                    if ( (0 < lastFrameNumber) && (info.frameNumber > lastFrameNumber + 1) ) {
+                        droppedFrames += info.frameNumber - lastFrameNumber - 1;
+                        logger.log(LogCategory::ACQUISITION, LogLevel::INFO, "Dropped %u frame(s), %llu in total.", info.frameNumber - lastFrameNumber - 1, static_cast<unsigned long long>(droppedFrames));
+                    }
+                    lastFrameNumber = info.frameNumber;
+
+                    // Do not even hand over frames that load shedding leaves out.
+                    if (frameBudget.skip(info.frameNumber)) {
+                        continue;
+                    }
+
+                    // If processing is still busy, this frame is dropped.
+                    frame.times.acquired = cluon::time::toMicroseconds(cluon::time::now());
+                    telemetry.record(Stage::ACQUISITION, ACQUISITION_START, std::chrono::steady_clock::now());
+                    acquiredFrames.tryPush(std::move(frame));
+                }
+            });
+
+            ////////////////////////////////////////////////////////////////////
+            // Stage 2: Process frames.
+            std::thread processing([&]() {
+                if (!pinCurrentThreadToCore(CPU_PROCESS)) {
+                    logger.log(LogCategory::PROCESSING, LogLevel::ERROR, "Failed to pin processing to core %d.", CPU_PROCESS);
                 }
-                sharedMemory->unlock();
 
-                // TODO: Do something with the frame.
+                auto lastAllocationReport{std::chrono::steady_clock::now()};
+                while (od4.isRunning()) {
+                    AcquiredFrame frame;
+                    if (!acquiredFrames.popFor(frame, TIMEOUT)) {
+                        continue;
+                    }
+                    const FrameInfo &info{frame.info};
 
-                // Invert colors
-                cv::bitwise_not(img, img);
+                    // Results for frames that waited too long would only mislead the controller.
+                    frame.times.processingStart = cluon::time::toMicroseconds(cluon::time::now());
+                    if (frameBudget.isStale(info, frame.times.processingStart)) {
+                        continue;
+                    }
 
-                // Draw a red rectangle
-                cv::rectangle(img, cv::Point(50, 50), cv::Point(100, 100), cv::Scalar(0,0,255));
+                    // One label per pixel (CONE_NONE, CONE_BLUE, CONE_YELLOW).
+                    ProcessedFrame processed{std::move(frame.buffer), labelPool.acquire(), info};
+                    if (!processed.labels) {
+                        continue;
+                    }
+                    processed.times = frame.times;
+                    processingStage.process(frame, processed);
 
-                // Display image.
-                if (VERBOSE) {
-                    cv::imshow(sharedMemory->name().c_str(), img);
+                    const auto PROCESSING_END{std::chrono::steady_clock::now()};
+                    if (PROCESSING_END - lastAllocationReport > std::chrono::seconds(5)) {
+                        logger.log(LogCategory::PROCESSING, LogLevel::INFO, "%llu frames; %llu matrices not from the pool in total; frame arena of %zu bytes.",
+                                   static_cast<unsigned long long>(processingStage.allocationFrames()),
+                                   static_cast<unsigned long long>(matAllocator->misses()), processingStage.arenaHighWater());
+                        processingStage.resetAllocations();
+                        lastAllocationReport = PROCESSING_END;
+                    }
+
+                    if (0.0f < CONTROL_RATE) {
+                        PerceptionResult &result{perceptionResults.back()};
+                        result.cones = processed.cones;
+                        result.sampleTimeStamp = info.sampleTimeStamp;
+                        perceptionResults.publish();
+                    }
+
+                    // If publishing is still busy, this result is dropped.
+                    processed.times.processed = cluon::time::toMicroseconds(cluon::time::now());
+                    processedFrames.tryPush(std::move(processed));
+                }
+            });
+
+            ////////////////////////////////////////////////////////////////////
+            // Optional stage: Draw a few frames per second with what was
+            // found into a shared memory area for a video encoder or viewer;
+            // neither a display nor the drawing slows down the other stages.
+            std::unique_ptr<DebugOverlay> debugOverlay;
+            std::thread debugOutput;
+            if (!DEBUG_STREAM.empty()) {
+                debugOverlay.reset(new DebugOverlay{DEBUG_STREAM, (std::string::npos != DEBUG_STREAM.find("i420")) ? FOURCC_I420 : FOURCC_ARGB, DEBUG_RATE});
+                std::clog << argv[0] << ": Writing up to " << DEBUG_RATE << " annotated frames per second to shared memory '" << DEBUG_STREAM << "'." << std::endl;
+                debugOutput = std::thread([&]() {
+                    if (!pinCurrentThreadToCore(CPU_DEBUG)) {
+                        logger.log(LogCategory::PUBLISHING, LogLevel::ERROR, "Failed to pin debug stream to core %d.", CPU_DEBUG);
+                    }
+
+                    bool failed{false};
+                    while (od4.isRunning()) {
+                        ProcessedFrame processed;
+                        if (!debugFrames.popFor(processed, TIMEOUT)) {
+                            continue;
+                        }
+                        const FrameInfo &info{processed.info};
+                        std::stringstream caption;
+                        caption << "#" << info.frameNumber << " " << processed.processingTime.count() / 1000.0 << " ms"
+                                << ", shed " << processed.sheddingLevel << ", " << processed.cones.count << " cones";
+                        const auto DISPLAY_START{std::chrono::steady_clock::now()};
+                        const bool WRITTEN{debugOverlay->write(info, processed.buffer.get(), reinterpret_cast<const uint8_t*>(processed.labels.get()),
+                                                               processed.region, processed.cones, caption.str())};
+                        telemetry.record(Stage::DISPLAY, DISPLAY_START, std::chrono::steady_clock::now());
+                        if (!WRITTEN && !failed) {
+                            logger.log(LogCategory::PUBLISHING, LogLevel::ERROR, "Failed to create shared memory '%s' for the debug stream.", DEBUG_STREAM.c_str());
+                        }
+                        failed = !WRITTEN;
+                    }
+                });
+            }
+
+            ////////////////////////////////////////////////////////////////////
+            // Publish the run time of all stages at a fixed rate.
+            std::thread telemetryOutput;
+            if (0.0f < TELEMETRY_RATE) {
+                telemetryOutput = std::thread([&]() {
+                    od4.timeTrigger(TELEMETRY_RATE, [&]() {
+                        const std::string SNAPSHOT{telemetry.snapshot()};
+                        opendlv::system::LogMessage message;
+                        message.level(static_cast<uint8_t>(LogLevel::INFO)).description(SNAPSHOT);
+                        od4.send(message);
+                        logger.log(LogCategory::GENERAL, LogLevel::DEBUG, "%s", SNAPSHOT.c_str());
+                        return od4.isRunning();
+                    });
+                });
+            }
+
+            ////////////////////////////////////////////////////////////////////
+            // Optional stage: Steer along the cones at a fixed rate,
+            // independent of the camera's frame rate and of how long a frame
+            // takes to process. Range of the steering: +38deg (left) ..
+            // -38deg (right) in radians; range of the pedal: +0.25 (forward)
+            // .. -1.0 (backwards). Be careful! This is the only part that
+            // sends requests; on stale cones, e.g., from a stalled camera,
+            // it centers the steering and releases the pedal.
+            std::thread control;
+            if (0.0f < CONTROL_RATE) {
+                std::clog << argv[0] << ": Sending steering and pedal requests " << CONTROL_RATE << " times per second." << std::endl;
+                control = std::thread([&]() {
+                    if (!pinCurrentThreadToCore(CPU_CONTROL)) {
+                        logger.log(LogCategory::CONTROL, LogLevel::ERROR, "Failed to pin control to core %d.", CPU_CONTROL);
+                    }
+
+                    ConeController controller{controllerParameters};
+                    LatencyHistogram coneAge;
+                    bool stale{true};
+                    bool frontUnknown{false};
+                    int64_t lastReport{cluon::time::toMicroseconds(cluon::time::now())};
+                    od4.timeTrigger(CONTROL_RATE, [&]() {
+                        const auto CONTROL_START{std::chrono::steady_clock::now()};
+                        const int64_t NOW{cluon::time::toMicroseconds(cluon::time::now())};
+                        perceptionResults.update();
+                        const PerceptionResult &result{perceptionResults.latest()};
+
+                        // A front distance that was never received or is too
+                        // old cannot rule out an obstacle.
+                        SensorReading front;
+                        const bool FRONT{sensors.load(opendlv::proxy::DistanceReading::ID(), 0, front)};
+
+                        // While the camera is stalled, the latest cones are
+                        // stale however recent they are.
+                        const int64_t CONES_TIME{cameraStalled.load(std::memory_order_acquire) ? 0 : result.sampleTimeStamp};
+                        const ActuationRequest request{controller.step(result.cones, CONES_TIME, static_cast<float>(front.value[0]), FRONT ? front.sampleTimeStamp : 0, NOW)};
+                        if (request.stale != stale) {
+                            if (request.stale) {
+                                logger.log(LogCategory::CONTROL, LogLevel::WARNING, "No cones within %g ms; centering the steering and releasing the pedal.", 1000.0 * controllerParameters.timeout);
+                            }
+                            else {
+                                logger.log(LogCategory::CONTROL, LogLevel::NOTICE, "Cones are %lld ms old; driving.", static_cast<long long>((NOW - CONES_TIME) / 1000));
+                            }
+                            stale = request.stale;
+                        }
+                        if (request.frontUnknown != frontUnknown) {
+                            if (request.frontUnknown) {
+                                logger.log(LogCategory::CONTROL, LogLevel::WARNING, "No front distance reading within %g ms; releasing the pedal.", 1000.0 * controllerParameters.timeout);
+                            }
+                            else {
+                                logger.log(LogCategory::CONTROL, LogLevel::NOTICE, "Front distance readings arrive again.");
+                            }
+                            frontUnknown = request.frontUnknown;
+                        }
+                        if (!request.stale) {
+                            coneAge.record(NOW - CONES_TIME);
+                        }
+
+                        // Requests carry the sample time of the frame they are
+                        // based on so that their age can be traced end to end;
+                        // without recent cones, they are based on nothing but now.
+                        const bool FROM_CONES{!request.stale && (0 != result.sampleTimeStamp)};
+                        const cluon::data::TimeStamp SAMPLE_TIME{cluon::time::fromMicroseconds(FROM_CONES ? result.sampleTimeStamp : NOW)};
+                        opendlv::proxy::GroundSteeringRequest gsr;
+                        gsr.groundSteering(request.groundSteering);
+                        od4.send(gsr, SAMPLE_TIME);
+
+                        opendlv::proxy::PedalPositionRequest ppr;
+                        ppr.position(request.pedalPosition);
+                        od4.send(ppr, SAMPLE_TIME);
+                        telemetry.record(Stage::CONTROL, CONTROL_START, std::chrono::steady_clock::now());
+
+                        if (NOW - lastReport > 5000000) {
+                            logger.log(LogCategory::CONTROL, LogLevel::INFO, "Age of the cones p50/p99/max in ms over %llu steps: %s.",
+                                       static_cast<unsigned long long>(coneAge.count()), coneAge.summary().c_str());
+                            coneAge.reset();
+                            lastReport = NOW;
+                        }
+                        return od4.isRunning();
+                    });
+                });
+            }
+
+            ////////////////////////////////////////////////////////////////////
+            // Stage 3: Display and publish results; runs on the main thread
+            // as GUI toolkits expect. End the program by pressing Ctrl-C.
+            if (!pinCurrentThreadToCore(CPU_PUBLISH)) {
+                logger.log(LogCategory::PUBLISHING, LogLevel::ERROR, "Failed to pin publishing to core %d.", CPU_PUBLISH);
+            }
+            FrameArena displayArena{1024 * 1024};
+            LatencyTrace latencyTrace;
+            int64_t lastLatencyReport{cluon::time::toMicroseconds(cluon::time::now())};
+            while (od4.isRunning()) {
+                ProcessedFrame processed;
+                if (!processedFrames.popFor(processed, TIMEOUT)) {
+                    continue;
+                }
+                const FrameInfo &info{processed.info};
+                displayArena.reset();
+
+                // Display image and labels: blue cones gray, yellow cones white.
+                if (VERBOSE && !debugOverlay) {
+                    const auto DISPLAY_START{std::chrono::steady_clock::now()};
+                    if (FOURCC_I420 == info.fourcc) {
+                        // Only here, we convert to BGR.
+                        cv::Mat bgr{displayArena.mat(static_cast<int32_t>(info.height), static_cast<int32_t>(info.width), CV_8UC3)};
+                        cv::cvtColor(wrapI420(info, processed.buffer.get()).yuv, bgr, cv::COLOR_YUV2BGR_I420);
+                        cv::imshow(sharedMemory->name().c_str(), bgr);
+                    }
+                    else {
+                        cv::imshow(sharedMemory->name().c_str(), wrapARGB(info, processed.buffer.get()));
+                    }
+                    cv::Mat mask(static_cast<int>(info.height), static_cast<int>(info.width), CV_8UC1, processed.labels.get());
+                    cv::Mat scaled{displayArena.mat(mask.rows, mask.cols, CV_8UC1)};
+                    mask.convertTo(scaled, CV_8U, 127.0);
+                    cv::imshow("cones", scaled);
                     cv::waitKey(1);
+                    telemetry.record(Stage::DISPLAY, DISPLAY_START, std::chrono::steady_clock::now());
                 }
+                const auto PUBLISHING_START{std::chrono::steady_clock::now()};
 
                 ////////////////////////////////////////////////////////////////
                 // Do something with the distance readings if wanted.
                 {
-                    std::lock_guard<std::mutex> lck(distancesMutex);
-                    std::cout << "front = " << front << ", "
-                              << "rear = " << rear << ", "
-                              << "left = " << left << ", "
-                              << "right = " << right << "." << std::endl;
+                    // Distance readings are sent with senderStamps 0 (front), 1 (left), 2 (rear), and 3 (right).
+                    SensorReading front, left, rear, right;
+                    sensors.load(opendlv::proxy::DistanceReading::ID(), 0, front);
+                    sensors.load(opendlv::proxy::DistanceReading::ID(), 1, left);
+                    sensors.load(opendlv::proxy::DistanceReading::ID(), 2, rear);
+                    sensors.load(opendlv::proxy::DistanceReading::ID(), 3, right);
+                    logger.log(LogCategory::SENSORS, LogLevel::DEBUG, "front = %g, rear = %g, left = %g, right = %g.",
+                               front.value[0], rear.value[0], left.value[0], right.value[0]);
+
+                    // A reading's sample time tells how fresh it is.
+                    if (0 < front.sampleTimeStamp) {
+                        const int64_t NOW{cluon::time::toMicroseconds(cluon::time::now())};
+                        logger.log(LogCategory::SENSORS, LogLevel::INFO, "Front distance is %lld ms old.", static_cast<long long>((NOW - front.sampleTimeStamp) / 1000));
+                    }
                 }
 
                 ////////////////////////////////////////////////////////////////
-                // Example for creating and sending a message to other microservices; can
-                // be removed when not needed.
-                opendlv::proxy::AngleReading ar;
-                ar.angle(123.45f);
-                od4.send(ar);
+                // Publish the cones of this frame as one object frame; the
+                // frame number identifies the object frame. Everything sent
+                // for a frame carries the frame's sample time so that
+                // consumers know how old the image behind it is.
+                const cluon::data::TimeStamp SAMPLE_TIME{cluon::time::fromMicroseconds(info.sampleTimeStamp)};
+                {
+                    opendlv::logic::perception::ObjectFrameStart ofs;
+                    ofs.objectFrameId(info.frameNumber);
+                    od4.send(ofs, SAMPLE_TIME);
 
-                ////////////////////////////////////////////////////////////////
-                // Steering and acceleration/decelration.
-                //
-                // Uncomment the following lines to steer; range: +38deg (left) .. -38deg (right).
-                // Value groundSteeringRequest.groundSteering must be given in radians (DEG/180. * PI).
-                //opendlv::proxy::GroundSteeringRequest gsr;
-                //gsr.groundSteering(0);
-                //od4.send(gsr);
-
-                // Uncomment the following lines to accelerate/decelerate; range: +0.25 (forward) .. -1.0 (backwards).
-                // Be careful!
-                //opendlv::proxy::PedalPositionRequest ppr;
-                //ppr.position(0);
-                //od4.send(ppr);
+                    for (uint32_t i{0}; i < processed.cones.count; i++) {
+                        // Tracked cones keep their objectId from frame to frame.
+                        const ConeBlob &cone{processed.cones.cones[i]};
+
+                        opendlv::logic::perception::Object o;
+                        o.objectId(cone.id);
+                        od4.send(o, SAMPLE_TIME);
+
+                        // The type is the cone's colour label (1: blue, 2: yellow).
+                        opendlv::logic::perception::ObjectType ot;
+                        ot.objectId(cone.id).type(cone.label);
+                        od4.send(ot, SAMPLE_TIME);
+
+                        opendlv::logic::perception::ObjectDirection od;
+                        od.objectId(cone.id).azimuthAngle(cone.azimuth).zenithAngle(cone.zenith);
+                        od4.send(od, SAMPLE_TIME);
+
+                        opendlv::logic::perception::ObjectDistance odi;
+                        odi.objectId(cone.id).distance(cone.distance);
+                        od4.send(odi, SAMPLE_TIME);
+
+                        if (cone.onGround) {
+                            opendlv::logic::perception::ObjectPosition op;
+                            op.objectId(cone.id).x(cone.x).y(cone.y).z(0.0f);
+                            od4.send(op, SAMPLE_TIME);
+                        }
+                    }
+
+                    opendlv::logic::perception::ObjectFrameEnd ofe;
+                    ofe.objectFrameId(info.frameNumber);
+                    od4.send(ofe, SAMPLE_TIME);
+                }
+
+                telemetry.record(Stage::PUBLISHING, PUBLISHING_START, std::chrono::steady_clock::now());
+
+                // Trace how old the frame is at each stage and when its results leave.
+                {
+                    const int64_t SENT{cluon::time::toMicroseconds(cluon::time::now())};
+                    latencyTrace.record(info.sampleTimeStamp, processed.times, SENT);
+                    if (SENT - lastLatencyReport > 5000000) {
+                        logger.log(LogCategory::PUBLISHING, LogLevel::NOTICE, "%s", latencyTrace.report().c_str());
+                        latencyTrace.reset();
+                        lastLatencyReport = SENT;
+                    }
+                }
+
+                // Hand the frame over for drawing once everything is sent;
+                // if the debug stream is still busy, it misses this frame.
+                if (debugOverlay && debugOverlay->due()) {
+                    debugFrames.tryPush(std::move(processed));
+                }
+
+                // Steering and acceleration/deceleration are requested by the
+                // control loop at its own rate; see --control-rate.
+            }
+
+            if (debugOutput.joinable()) {
+                debugOutput.join();
+            }
+            if (telemetryOutput.joinable()) {
+                telemetryOutput.join();
+            }
+            if (control.joinable()) {
+                control.join();
             }
+            processing.join();
+            acquisition.join();
         }
         retCode = 0;
     }
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/**
+ * This function pins the calling thread to one CPU core.
+ *
+ * @param core Index of the core; negative values leave the thread unpinned.
+ * @return true if the thread is pinned as requested.
+ */
+inline bool pinCurrentThreadToCore(int32_t core) noexcept {
+    if (0 > core) {
+        return true;
+    }
+#ifdef __linux__
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(core, &cpuset);
+    return (0 == ::pthread_setaffinity_np(::pthread_self(), sizeof(cpu_set_t), &cpuset));
+#else
+    return false;
+#endif
+}
+
+/**
+ * SpscQueue is a bounded queue between exactly one producing and one
+ * consuming thread. Pushing and popping are lock-free; the mutex and
+ * condition variable are only touched when the consumer has to sleep on an
+ * empty queue.
+ */
+template <typename T>
+class SpscQueue {
+   private:
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue(SpscQueue &&)      = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+    SpscQueue &operator=(SpscQueue &&) = delete;
+
+   public:
+    explicit SpscQueue(uint32_t capacity) noexcept
+        : m_capacity(capacity + 1)
+        , m_slots(new T[capacity + 1]) {}
+
+    /**
+     * This method appends an element unless the queue is full.
+     *
+     * @return false if the queue was full; value is left untouched then.
+     */
+    bool tryPush(T &&value) noexcept {
+        const uint32_t TAIL{m_tail.load(std::memory_order_relaxed)};
+        const uint32_t NEXT{(TAIL + 1) % m_capacity};
+        if (NEXT == m_head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        m_slots[TAIL] = std::move(value);
+        m_tail.store(NEXT, std::memory_order_seq_cst);
+        if (m_sleeping.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lck(m_mutex);
+            m_condition.notify_one();
+        }
+        return true;
+    }
+
+    /**
+     * This method removes the oldest element if there is one.
+     *
+     * @return false if the queue was empty.
+     */
+    bool tryPop(T &value) noexcept {
+        const uint32_t HEAD{m_head.load(std::memory_order_relaxed)};
+        if (HEAD == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(m_slots[HEAD]);
+        m_head.store((HEAD + 1) % m_capacity, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * This method removes the oldest element and waits at most timeout for one to arrive.
+     *
+     * @return false if the queue stayed empty.
+     */
+    bool popFor(T &value, const std::chrono::microseconds &timeout) noexcept {
+        if (tryPop(value)) {
+            return true;
+        }
+        {
+            std::unique_lock<std::mutex> lck(m_mutex);
+            m_sleeping.store(true, std::memory_order_seq_cst);
+            m_condition.wait_for(lck, timeout, [this]() {
+                return m_head.load(std::memory_order_relaxed) != m_tail.load(std::memory_order_seq_cst);
+            });
+            m_sleeping.store(false, std::memory_order_relaxed);
+        }
+        return tryPop(value);
+    }
+
+    bool empty() const noexcept {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+   private:
+    const uint32_t m_capacity;
+    std::unique_ptr<T[]> m_slots;
+    alignas(64) std::atomic<uint32_t> m_head{0};
+    alignas(64) std::atomic<uint32_t> m_tail{0};
+    std::atomic<bool> m_sleeping{false};
+    std::mutex m_mutex{};
+    std::condition_variable m_condition{};
+};
+
+/**
+ * LatestValue hands the most recent value from one producing to one
+ * consuming thread; neither ever waits for the other. It is a triple
+ * buffer: the producer writes into its back buffer and swaps it with the
+ * middle one, and the consumer swaps the middle buffer with its front one
+ * when a newer value is there. Values the consumer does not pick up in
+ * time are overwritten.
+ */
+template <typename T>
+class LatestValue {
+   private:
+    LatestValue(const LatestValue &) = delete;
+    LatestValue(LatestValue &&)      = delete;
+    LatestValue &operator=(const LatestValue &) = delete;
+    LatestValue &operator=(LatestValue &&) = delete;
+
+   public:
+    LatestValue() = default;
+
+    /**
+     * @return Buffer to fill with the next value; called by the producer only.
+     */
+    T &back() noexcept {
+        return m_buffers[m_back];
+    }
+
+    /**
+     * This method publishes the buffer returned by back(); called by the producer only.
+     */
+    void publish() noexcept {
+        const uint8_t MIDDLE{m_middle.exchange(static_cast<uint8_t>(m_back | FRESH), std::memory_order_acq_rel)};
+        m_back = MIDDLE & INDEX;
+    }
+
+    /**
+     * This method takes over the latest published value; called by the consumer only.
+     *
+     * @return true if a value was published since the previous call.
+     */
+    bool update() noexcept {
+        if (0 == (m_middle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        const uint8_t MIDDLE{m_middle.exchange(m_front, std::memory_order_acq_rel)};
+        m_front = MIDDLE & INDEX;
+        return true;
+    }
+
+    /**
+     * @return Value taken over by the last update(); default constructed before the first one.
+     */
+    const T &latest() const noexcept {
+        return m_buffers[m_front];
+    }
+
+   private:
+    static constexpr uint8_t INDEX{3};
+    static constexpr uint8_t FRESH{4};
+
+    T m_buffers[3]{};
+    alignas(64) uint8_t m_back{0};
+    alignas(64) std::atomic<uint8_t> m_middle{1};
+    alignas(64) uint8_t m_front{2};
+};
+
+#endif
@@ -0,0 +1,402 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROCESSING_STAGE_HPP
+#define PROCESSING_STAGE_HPP
+
+#include "allocation-counter.hpp"
+#include "async-log.hpp"
+#include "cone-blobs.hpp"
+#include "cone-segmentation.hpp"
+#include "cone-tracker.hpp"
+#include "frame-arena.hpp"
+#include "frame-budget.hpp"
+#include "frame-buffer-pool.hpp"
+#include "frame-pyramid.hpp"
+#include "frame-ring.hpp"
+#include "frame-view.hpp"
+#include "ground-plane.hpp"
+#include "latency-trace.hpp"
+#include "region-of-interest.hpp"
+#include "stage-telemetry.hpp"
+#include "undistortion.hpp"
+#include "work-stealing-pool.hpp"
+
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A frame handed from the acquisition stage to the processing stage.
+struct AcquiredFrame {
+    FrameBufferPool::Handle buffer{nullptr, FrameBufferPool::Releaser{}};
+    FrameInfo info{};
+    FrameRegion region{};  // Only this part of the frame was copied.
+    FrameBufferPool::Handle pyramid{nullptr, FrameBufferPool::Releaser{}};
+    PyramidTimings pyramidTimings{};
+    FrameTimes times{};
+};
+
+// A frame and its labels handed from the processing stage to the publishing stage.
+struct ProcessedFrame {
+    FrameBufferPool::Handle buffer{nullptr, FrameBufferPool::Releaser{}};
+    FrameBufferPool::Handle labels{nullptr, FrameBufferPool::Releaser{}};
+    FrameInfo info{};
+    ConeDetections cones{};
+    FrameRegion region{};  // Labels were computed only for this part of the frame.
+    std::chrono::microseconds processingTime{0};
+    uint32_t sheddingLevel{0};
+    FrameTimes times{};
+};
+
+/**
+ * ProcessingStage turns an acquired frame into labels and cones: it
+ * segments the copied region (or, on a frame pyramid, only the surroundings
+ * of the cones found on its coarsest level) as the frame budget allows,
+ * removes the lens distortion, extracts and tracks the cones, and places
+ * them on the ground plane. Afterwards, it accounts the frame's processing
+ * time with the frame budget and reports changes of the shedding level.
+ *
+ * The region of interest, the frame budget, the telemetry and the log are
+ * shared with the other stages and are not owned. Once the first frames
+ * have sized all buffers, process() does not allocate; where heap
+ * allocations are counted, this includes the tiles that run on the
+ * threads of the tile pool.
+ */
+class ProcessingStage {
+   private:
+    ProcessingStage(const ProcessingStage &) = delete;
+    ProcessingStage(ProcessingStage &&)      = delete;
+    ProcessingStage &operator=(const ProcessingStage &) = delete;
+    ProcessingStage &operator=(ProcessingStage &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param coarseLevels Pyramid level that cones are detected on when a frame comes with a pyramid.
+     * @param groundTable File to cache the ground plane table in; empty to always build it.
+     */
+    ProcessingStage(const ConeSegmentation &segmentation, const ConeGeometry &geometry, const CameraPose &pose, uint32_t coarseLevels,
+                    const std::string &groundTable, RegionOfInterest &regionOfInterest, Undistortion &undistortion, FrameBudget &frameBudget,
+                    WorkStealingPool &tilePool, StageTelemetry &telemetry, AsyncLog &logger) noexcept
+        : m_segmentation(segmentation)
+        , m_geometry(geometry)
+        , m_pose(pose)
+        , m_coarseLevels(coarseLevels)
+        , m_groundTable(groundTable)
+        , m_regionOfInterest(regionOfInterest)
+        , m_undistortion(undistortion)
+        , m_frameBudget(frameBudget)
+        , m_tilePool(tilePool)
+        , m_telemetry(telemetry)
+        , m_logger(logger)
+        , m_tiles{(1 < tilePool.size()) ? 2 * tilePool.size() : 1}
+        , m_blobExtractor{geometry}
+        , m_coarseExtractor{coarseGeometry(geometry, coarseLevels)} {}
+
+    /**
+     * @return Number of tiles that a frame is split into.
+     */
+    uint32_t tiles() const noexcept {
+        return m_tiles;
+    }
+
+    /**
+     * This method processes a frame. The pixels are taken from
+     * processed.buffer, whose frame is described by processed.info; one
+     * label per pixel (CONE_NONE, CONE_BLUE, CONE_YELLOW) is written to
+     * processed.labels. The region and the pyramid come from frame.
+     */
+    void process(const AcquiredFrame &frame, ProcessedFrame &processed) noexcept {
+        const auto PROCESSING_START{std::chrono::steady_clock::now()};
+        const uint64_t ALLOCATIONS_START{heapAllocations()};
+        const FrameInfo &info{processed.info};
+        m_arena.reset();
+        cv::Mat mask(static_cast<int>(info.height), static_cast<int>(info.width), CV_8UC1, processed.labels.get());
+
+        // Allocations are counted per thread; tiles that run on the
+        // threads of the pool add theirs to those of this thread.
+        const std::thread::id CALLER{std::this_thread::get_id()};
+        auto parallelFor = [this, &CALLER](uint32_t count, auto &&function) {
+            m_tilePool.parallelFor(count, [this, &CALLER, &function](uint32_t i) {
+                const uint64_t START{heapAllocations()};
+                function(i);
+                const uint64_t ALLOCATIONS{heapAllocations() - START};
+                if ( (0 < ALLOCATIONS) && (std::this_thread::get_id() != CALLER) ) {
+                    m_tileAllocations.fetch_add(ALLOCATIONS, std::memory_order_relaxed);
+                }
+            });
+        };
+        bool reportPyramid{false};
+
+        // Only the copied region is processed; the ROI for the
+        // following frames is prepared once the frame size is known.
+        m_regionOfInterest.prepare(info.width, info.height);
+        const FrameRegion REGION{clampFrameRegion(frame.region, info)};
+
+        // Shed load as requested: the upper part of the region gets
+        // no labels; rows in between processed rows repeat the
+        // labels of the processed row above them.
+        const auto SEGMENTATION_START{std::chrono::steady_clock::now()};
+        const LoadShedding SHED{m_frameBudget.shedding()};
+        const uint32_t FIRST_ROW{(REGION.top + static_cast<uint32_t>(SHED.roiTop * static_cast<float>(REGION.bottom - REGION.top))) & ~1u};
+        const PyramidLayout PYRAMID{pyramidLayout(info, frame.pyramid ? m_coarseLevels : 0)};
+        if (0 < PYRAMID.levels) {
+            // Look for cones on the coarsest level only, and label the
+            // frame at full resolution just around what was found there.
+            const auto DETECTION_START{std::chrono::steady_clock::now()};
+            const uint32_t LEVEL{PYRAMID.levels};
+            const FrameInfo &COARSE{PYRAMID.info[LEVEL]};
+            FrameRegion coarseRegion{pyramidLevelRegion(pyramidRegion(frame.region, PYRAMID), LEVEL)};
+            coarseRegion.top = std::min(coarseRegion.bottom, std::max(coarseRegion.top, (FIRST_ROW >> LEVEL) & ~1u));
+            cv::Mat coarseLabels{m_arena.mat(static_cast<int32_t>(COARSE.height), static_cast<int32_t>(COARSE.width), CV_8UC1)};
+            segmentArea(COARSE, frame.pyramid.get() + PYRAMID.offset[LEVEL], coarseLabels, coarseRegion);
+            m_coarseExtractor.extract(coarseLabels.ptr(static_cast<int>(coarseRegion.top)) + coarseRegion.left, static_cast<uint32_t>(coarseLabels.step),
+                                      coarseRegion.right - coarseRegion.left, coarseRegion.bottom - coarseRegion.top, m_tiles, parallelFor, m_candidates);
+
+            const auto REFINEMENT_START{std::chrono::steady_clock::now()};
+            for (uint32_t y{FIRST_ROW}; y < REGION.bottom; y++) {
+                std::memset(mask.ptr(static_cast<int>(y)) + REGION.left, CONE_NONE, REGION.right - REGION.left);
+            }
+            for (uint32_t i{0}; i < m_candidates.count; i++) {
+                // Leave room for the parts of the cone that blurred into the background.
+                const ConeBlob &c{m_candidates.cones[i]};
+                const uint32_t MARGIN{2 + (c.bottom - c.top + 1) / 2};
+                FrameRegion area;
+                area.left = std::max(REGION.left, (coarseRegion.left + ((c.left > MARGIN) ? c.left - MARGIN : 0)) << LEVEL);
+                area.top = std::max(FIRST_ROW, (coarseRegion.top + ((c.top > MARGIN) ? c.top - MARGIN : 0)) << LEVEL);
+                area.right = std::min(REGION.right, (coarseRegion.left + c.right + 1 + MARGIN) << LEVEL);
+                area.bottom = std::min(REGION.bottom, (coarseRegion.top + c.bottom + 1 + MARGIN) << LEVEL);
+                segmentArea(info, processed.buffer.get(), mask, clampFrameRegion(area, info));
+            }
+
+            const auto REFINEMENT_END{std::chrono::steady_clock::now()};
+            m_pyramidStatistics.update(LEVEL, frame.pyramidTimings,
+                                       std::chrono::duration_cast<std::chrono::microseconds>(REFINEMENT_START - DETECTION_START),
+                                       std::chrono::duration_cast<std::chrono::microseconds>(REFINEMENT_END - REFINEMENT_START), m_candidates.count);
+            if (m_logger.enabled(LogCategory::PROCESSING, LogLevel::INFO) && (REFINEMENT_END - m_lastPyramidReport > std::chrono::seconds(5))) {
+                reportPyramid = true;
+                m_lastPyramidReport = REFINEMENT_END;
+            }
+        }
+        else {
+            // Every tile gets whole groups of a processed row (pair
+            // for I420) and the rows that repeat its labels.
+            const uint32_t ROWS{(FOURCC_I420 == info.fourcc) ? 2u : 1u};
+            const uint32_t GROUP{ROWS * SHED.rowStep};
+            const uint32_t GROUPS{(REGION.bottom - std::min(FIRST_ROW, REGION.bottom) + GROUP - 1) / GROUP};
+            const uint32_t NUMBER_OF_TILES{std::min(m_tiles, GROUPS)};
+            parallelFor(NUMBER_OF_TILES, [&](uint32_t t) {
+                const uint32_t FROM{FIRST_ROW + GROUPS * t / NUMBER_OF_TILES * GROUP};
+                const uint32_t TO{std::min(REGION.bottom, FIRST_ROW + GROUPS * (t + 1) / NUMBER_OF_TILES * GROUP)};
+                if (1 == SHED.rowStep) {
+                    segmentArea(info, processed.buffer.get(), mask, FrameRegion{REGION.left, FROM, REGION.right, TO});
+                    return;
+                }
+                for (uint32_t r{FROM}; r < TO; r += GROUP) {
+                    const uint32_t LAST_ROW{std::min(r + ROWS, TO)};
+                    segmentArea(info, processed.buffer.get(), mask, FrameRegion{REGION.left, r, REGION.right, LAST_ROW});
+                    for (uint32_t k{LAST_ROW}; k < std::min(r + GROUP, TO); k++) {
+                        std::memcpy(mask.ptr(static_cast<int>(k)) + REGION.left, mask.ptr(static_cast<int>(k - ROWS)) + REGION.left, REGION.right - REGION.left);
+                    }
+                }
+            });
+        }
+        const auto LABELLING_START{std::chrono::steady_clock::now()};
+        m_telemetry.record(Stage::SEGMENTATION, SEGMENTATION_START, LABELLING_START);
+        FrameRegion &labelled{processed.region};
+        labelled = REGION;
+        labelled.top = FIRST_ROW;
+        m_regionOfInterest.clearOutside(mask, labelled);
+
+        // Correct lens distortion of the labels if requested; much
+        // cheaper than for the pixels, and only needed where we look.
+        m_undistortion.prepare(info.width, info.height, m_geometry.fovy);
+        m_undistortion.remapLabels(mask);
+
+        // Turn labelled pixels into cones with bearing and distance.
+        ConeDetections &cones{processed.cones};
+        m_blobExtractor.extract(mask.data, static_cast<uint32_t>(mask.step), info.width, info.height, m_tiles, parallelFor, cones);
+
+        // Keep the cones' identities across frames; cones that were
+        // not detected in this frame are kept at their predicted
+        // position for a few frames. The next frame only needs to be
+        // searched around the tracked cones.
+        m_tracker.update(cones, info.sampleTimeStamp);
+        for (uint32_t i{0}; i < cones.count; i++) {
+            m_blobExtractor.estimate(cones.cones[i], info.width, info.height);
+        }
+        m_regionOfInterest.follow(cones);
+
+        // Otherwise, correct only the key points of each cone.
+        if (Undistortion::Mode::POINTS == m_undistortion.mode()) {
+            m_keyPoints.clear();
+            for (uint32_t i{0}; i < cones.count; i++) {
+                const ConeBlob &cone{cones.cones[i]};
+                m_keyPoints.push_back(cv::Point2f(cone.centerX, cone.centerY));
+                m_keyPoints.push_back(cv::Point2f(cone.centerX, static_cast<float>(cone.top)));
+                m_keyPoints.push_back(cv::Point2f(cone.centerX, static_cast<float>(cone.bottom)));
+            }
+            m_undistortion.undistortPoints(m_keyPoints);
+            for (uint32_t i{0}; i < cones.count; i++) {
+                ConeBlob &cone{cones.cones[i]};
+                cone.centerX = m_keyPoints[3 * i].x;
+                cone.centerY = m_keyPoints[3 * i].y;
+                cone.top = static_cast<uint32_t>(std::max(0.0f, std::round(m_keyPoints[3 * i + 1].y)));
+                cone.bottom = std::max(cone.top, static_cast<uint32_t>(std::max(0.0f, std::round(m_keyPoints[3 * i + 2].y))));
+                m_blobExtractor.estimate(cone, info.width, info.height);
+            }
+        }
+
+        // The ground point below each pixel never changes for a fixed
+        // camera; the table is made once for the first frame (or when
+        // the resolution changes) and cached in a file if requested.
+        if (!m_groundPlane.matches(m_pose, info.width, info.height)) {
+            if (m_groundTable.empty() || !m_groundPlane.load(m_groundTable, m_pose, info.width, info.height)) {
+                m_groundPlane.build(m_pose, info.width, info.height);
+                if (!m_groundTable.empty() && !m_groundPlane.save(m_groundTable)) {
+                    m_logger.log(LogCategory::PROCESSING, LogLevel::ERROR, "Failed to write ground plane table to '%s'.", m_groundTable.c_str());
+                }
+            }
+            m_logger.log(LogCategory::PROCESSING, LogLevel::NOTICE, "Ground plane table for %ux%u is ready.", info.width, info.height);
+        }
+
+        // A cone stands on the ground at the bottom of its blob; a tracked
+        // cone may have coasted out of the frame.
+        for (uint32_t i{0}; i < cones.count; i++) {
+            ConeBlob &cone{cones.cones[i]};
+            const bool IN_FRAME{(0.0f <= cone.centerX) && (cone.centerX < static_cast<float>(info.width))};
+            cone.onGround = IN_FRAME && m_groundPlane.lookup(static_cast<uint32_t>(cone.centerX + 0.5f), cone.bottom, cone.x, cone.y, cone.azimuth);
+            if (cone.onGround) {
+                cone.distance = std::sqrt(cone.x * cone.x + cone.y * cone.y);
+            }
+        }
+
+        // Nothing up to here should have touched the heap once the
+        // first frames have sized all buffers; formatting the
+        // reports below does.
+        m_allocations += heapAllocations() - ALLOCATIONS_START + m_tileAllocations.exchange(0, std::memory_order_relaxed);
+        m_allocationFrames++;
+        if (reportPyramid) {
+            m_logger.log(LogCategory::PROCESSING, LogLevel::INFO, "%s", m_pyramidStatistics.report().c_str());
+        }
+
+        // Report every change, and what is being shed every few seconds.
+        const auto PROCESSING_END{std::chrono::steady_clock::now()};
+        m_telemetry.record(Stage::LABELLING, LABELLING_START, PROCESSING_END);
+        m_telemetry.record(Stage::PROCESSING, PROCESSING_START, PROCESSING_END);
+        processed.processingTime = std::chrono::duration_cast<std::chrono::microseconds>(PROCESSING_END - PROCESSING_START);
+        processed.sheddingLevel = SHED.level;
+        if (m_frameBudget.update(info, processed.processingTime) ||
+            ( (0 < SHED.level) && (PROCESSING_END - m_lastReport > std::chrono::seconds(5)) ) ) {
+            m_logger.log(LogCategory::PROCESSING, LogLevel::NOTICE, "%s", m_frameBudget.report().c_str());
+            m_lastReport = PROCESSING_END;
+        }
+    }
+
+    /**
+     * @return Heap allocations while processing frames since the last call of resetAllocations().
+     */
+    uint64_t allocations() const noexcept {
+        return m_allocations;
+    }
+
+    /**
+     * @return Frames processed since the last call of resetAllocations().
+     */
+    uint64_t allocationFrames() const noexcept {
+        return m_allocationFrames;
+    }
+
+    void resetAllocations() noexcept {
+        m_allocations = 0;
+        m_allocationFrames = 0;
+    }
+
+    /**
+     * @return Most bytes that the temporaries of a frame took from the frame arena.
+     */
+    std::size_t arenaHighWater() const noexcept {
+        return m_arena.highWater();
+    }
+
+   private:
+    // On a level of the pyramid, a cone covers 1/4 of the pixels per level.
+    static ConeGeometry coarseGeometry(const ConeGeometry &geometry, uint32_t levels) noexcept {
+        ConeGeometry g{geometry};
+        g.minArea = std::max(1u, geometry.minArea >> (2 * levels));
+        return g;
+    }
+
+    // Label blue and yellow cone pixels in a single pass over an area.
+    // Wrap the frame buffer; no pixels are copied or allocated here.
+    void segmentArea(const FrameInfo &info, char *pixels, cv::Mat &labels, const FrameRegion &area) const noexcept {
+        const uint32_t WIDTH_OF_AREA{area.right - area.left};
+        if (FOURCC_I420 == info.fourcc) {
+            // I420 needs less than half the memory bandwidth of ARGB;
+            // colour lives in the subsampled U and V planes.
+            I420View img{wrapI420(info, pixels)};
+            m_segmentation.segmentI420(img.y.data + area.left, static_cast<uint32_t>(img.y.step), img.u.data + area.left / 2, img.v.data + area.left / 2, static_cast<uint32_t>(img.u.step),
+                                       WIDTH_OF_AREA, area.top, area.bottom, labels.data + area.left, static_cast<uint32_t>(labels.step));
+        }
+        else {
+            cv::Mat img{wrapARGB(info, pixels)};
+            m_segmentation.segmentBGRA(img.data + area.left * 4, static_cast<uint32_t>(img.step), WIDTH_OF_AREA, area.top, area.bottom, labels.data + area.left, static_cast<uint32_t>(labels.step));
+        }
+    }
+
+   private:
+    const ConeSegmentation &m_segmentation;
+    const ConeGeometry m_geometry;
+    const CameraPose m_pose;
+    const uint32_t m_coarseLevels;
+    const std::string m_groundTable;
+    RegionOfInterest &m_regionOfInterest;
+    Undistortion &m_undistortion;
+    FrameBudget &m_frameBudget;
+    WorkStealingPool &m_tilePool;
+    StageTelemetry &m_telemetry;
+    AsyncLog &m_logger;
+    const uint32_t m_tiles;
+
+    ConeBlobExtractor m_blobExtractor;
+    ConeBlobExtractor m_coarseExtractor;
+    ConeTracker m_tracker{TrackerParameters{}};
+    GroundPlaneTable m_groundPlane{};
+    ConeDetections m_candidates{};
+    PyramidStatistics m_pyramidStatistics{};
+    std::vector<cv::Point2f> m_keyPoints{};
+
+    // Temporaries of a frame live until the end of the frame.
+    FrameArena m_arena{64 * 1024};
+
+    std::chrono::steady_clock::time_point m_lastReport{std::chrono::steady_clock::now()};
+    std::chrono::steady_clock::time_point m_lastPyramidReport{m_lastReport};
+    uint64_t m_allocations{0};
+    std::atomic<uint64_t> m_tileAllocations{0};
+    uint64_t m_allocationFrames{0};
+};
+
+#endif
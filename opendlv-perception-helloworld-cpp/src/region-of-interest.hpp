@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REGION_OF_INTEREST_HPP
+#define REGION_OF_INTEREST_HPP
+
+#include "cone-blobs.hpp"
+#include "frame-ring.hpp"
+#include "ground-plane.hpp"
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct RoiParameters {
+    bool band{true};
+    float bandFrom{-5.0f};             // Degrees below the horizon where the band starts; negative values are above.
+    float bandTo{90.0f};               // Degrees below the horizon where the band ends.
+    std::vector<cv::Point> polygon{};  // Pixels; empty if there is none.
+    bool follow{false};
+    uint32_t fullScanInterval{10};     // When following, look at the whole ROI at least every this many frames.
+};
+
+/**
+ * This function parses a band given as "from,to" in degrees below the horizon, or "none".
+ */
+inline bool parseRoiBand(const std::string &str, RoiParameters &parameters) noexcept {
+    if ("none" == str) {
+        parameters.band = false;
+        return true;
+    }
+    std::stringstream sstr{str};
+    char comma{0};
+    float from{0.0f};
+    float to{0.0f};
+    if ( !(sstr >> from >> comma >> to) || (',' != comma) || (from >= to) ) {
+        return false;
+    }
+    parameters.band = true;
+    parameters.bandFrom = from;
+    parameters.bandTo = to;
+    return true;
+}
+
+/**
+ * This function parses a polygon given as "x0,y0,x1,y1,..." in pixels.
+ */
+inline bool parseRoiPolygon(const std::string &str, RoiParameters &parameters) noexcept {
+    std::vector<int> values;
+    std::stringstream sstr{str};
+    std::string value;
+    while (std::getline(sstr, value, ',')) {
+        values.push_back(std::atoi(value.c_str()));
+    }
+    if ( (6 > values.size()) || (0 != (values.size() % 2)) ) {
+        return false;
+    }
+    parameters.polygon.clear();
+    for (std::size_t i{0}; i < values.size(); i += 2) {
+        parameters.polygon.push_back(cv::Point(values[i], values[i + 1]));
+    }
+    return true;
+}
+
+/**
+ * RegionOfInterest limits the work per frame to the part of the image that
+ * can show cones: a band of rows relative to the horizon (found from the
+ * camera's pitch and field of view) and, optionally, a static polygon. The
+ * bounding rectangle of both is what the acquisition stage copies out of
+ * shared memory and what the kernels process; labels outside of the
+ * polygon are cleared.
+ *
+ * When following detections, the rectangle for the next frame shrinks to
+ * the surroundings of the cones found in the current frame; the whole ROI
+ * is searched again when nothing was found and at regular intervals to
+ * pick up new cones.
+ *
+ * region() may be called by any stage; all other methods belong to the
+ * processing stage.
+ */
+class RegionOfInterest {
+   private:
+    RegionOfInterest(const RegionOfInterest &) = delete;
+    RegionOfInterest(RegionOfInterest &&)      = delete;
+    RegionOfInterest &operator=(const RegionOfInterest &) = delete;
+    RegionOfInterest &operator=(RegionOfInterest &&) = delete;
+
+   public:
+    RegionOfInterest(const RoiParameters &parameters, const CameraPose &pose) noexcept
+        : m_parameters(parameters)
+        , m_pose(pose) {}
+
+    /**
+     * @return Region of the next frame to be copied and processed.
+     */
+    FrameRegion region() const noexcept {
+        return unpack(m_region.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @return Region covering the whole ROI for the current frame size.
+     */
+    FrameRegion staticRegion() const noexcept {
+        return m_static;
+    }
+
+    /**
+     * This method computes the ROI for frames of the given size; it does
+     * nothing if the size did not change since the last call.
+     */
+    void prepare(uint32_t width, uint32_t height) noexcept {
+        if ( (width == m_width) && (height == m_height) ) {
+            return;
+        }
+        m_width = width;
+        m_height = height;
+
+        FrameRegion r;
+        r.right = width;
+        r.bottom = height;
+        if (m_parameters.band) {
+            // Rows are found from the angle below the optical axis.
+            const double PI{3.14159265358979323846};
+            const double F{0.5 * height / std::tan(0.5 * m_pose.fovy * PI / 180.0)};
+            const double CY{0.5 * height - 0.5};
+            auto rowAt = [&](float degreesBelowHorizon) {
+                const double ANGLE{std::max(-89.0, std::min(89.0, static_cast<double>(degreesBelowHorizon - m_pose.pitch)))};
+                const double ROW{CY + F * std::tan(ANGLE * PI / 180.0)};
+                return static_cast<uint32_t>(std::max(0.0, std::min(static_cast<double>(height), ROW)));
+            };
+            r.top = rowAt(m_parameters.bandFrom);
+            r.bottom = rowAt(m_parameters.bandTo);
+        }
+
+        m_polygon = cv::Mat();
+        if (!m_parameters.polygon.empty()) {
+            m_polygon = cv::Mat::zeros(static_cast<int>(height), static_cast<int>(width), CV_8UC1);
+            std::vector<std::vector<cv::Point>> polygons{m_parameters.polygon};
+            cv::fillPoly(m_polygon, polygons, cv::Scalar(255));
+            const cv::Rect BOX{cv::boundingRect(m_parameters.polygon)};
+            r.left = std::max(r.left, static_cast<uint32_t>(std::max(0, BOX.x)));
+            r.top = std::max(r.top, static_cast<uint32_t>(std::max(0, BOX.y)));
+            r.right = std::min(r.right, static_cast<uint32_t>(std::max(0, BOX.x + BOX.width)));
+            r.bottom = std::min(r.bottom, static_cast<uint32_t>(std::max(0, BOX.y + BOX.height)));
+        }
+
+        FrameInfo info;
+        info.width = width;
+        info.height = height;
+        m_static = clampFrameRegion(r, info);
+        m_region.store(pack(m_static), std::memory_order_relaxed);
+    }
+
+    /**
+     * This method clears all labels outside of the processed region and the polygon.
+     */
+    void clearOutside(cv::Mat &labels, const FrameRegion &region) const noexcept {
+        const uint32_t WIDTH{static_cast<uint32_t>(labels.cols)};
+        const uint32_t HEIGHT{static_cast<uint32_t>(labels.rows)};
+        for (uint32_t y{0}; y < HEIGHT; y++) {
+            uint8_t *row{labels.ptr(static_cast<int>(y))};
+            if ( (y < region.top) || (y >= region.bottom) ) {
+                std::memset(row, CONE_NONE, WIDTH);
+                continue;
+            }
+            std::memset(row, CONE_NONE, region.left);
+            std::memset(row + region.right, CONE_NONE, WIDTH - region.right);
+            if (!m_polygon.empty()) {
+                const uint8_t *inside{m_polygon.ptr(static_cast<int>(y))};
+                for (uint32_t x{region.left}; x < region.right; x++) {
+                    row[x] &= inside[x];
+                }
+            }
+        }
+    }
+
+    /**
+     * This method chooses the region of the next frame from the cones found in the current one.
+     */
+    void follow(const ConeDetections &detections) noexcept {
+        if (!m_parameters.follow) {
+            return;
+        }
+        m_framesSinceFullScan++;
+        if ( (0 == detections.count) || (m_framesSinceFullScan >= m_parameters.fullScanInterval) ) {
+            m_framesSinceFullScan = 0;
+            m_region.store(pack(m_static), std::memory_order_relaxed);
+            return;
+        }
+
+        // Leave room for the cones to move by about their own size.
+        FrameRegion r{UINT32_MAX, UINT32_MAX, 0, 0};
+        for (uint32_t i{0}; i < detections.count; i++) {
+            const ConeBlob &cone{detections.cones[i]};
+            const uint32_t MARGIN{std::max(16u, cone.bottom - cone.top + 1)};
+            r.left = std::min(r.left, (cone.left > MARGIN) ? cone.left - MARGIN : 0);
+            r.top = std::min(r.top, (cone.top > MARGIN) ? cone.top - MARGIN : 0);
+            r.right = std::max(r.right, cone.right + 1 + MARGIN);
+            r.bottom = std::max(r.bottom, cone.bottom + 1 + MARGIN);
+        }
+        r.left = std::max(r.left, m_static.left);
+        r.top = std::max(r.top, m_static.top);
+        r.right = std::min(r.right, m_static.right);
+        r.bottom = std::min(r.bottom, m_static.bottom);
+
+        FrameInfo info;
+        info.width = m_width;
+        info.height = m_height;
+        m_region.store(pack(clampFrameRegion(r, info)), std::memory_order_relaxed);
+    }
+
+   private:
+    // The region is handed to the acquisition stage as four 16-bit values in one atomic word.
+    static uint64_t pack(const FrameRegion &r) noexcept {
+        auto clamp = [](uint32_t v) { return static_cast<uint64_t>(std::min(v, 0xFFFFu)); };
+        return clamp(r.left) | (clamp(r.top) << 16) | (clamp(r.right) << 32) | (clamp(r.bottom) << 48);
+    }
+
+    static FrameRegion unpack(uint64_t v) noexcept {
+        auto expand = [](uint64_t x) { return (0xFFFFu == x) ? UINT32_MAX : static_cast<uint32_t>(x); };
+        FrameRegion r;
+        r.left = static_cast<uint32_t>(v & 0xFFFFu);
+        r.top = static_cast<uint32_t>((v >> 16) & 0xFFFFu);
+        r.right = expand((v >> 32) & 0xFFFFu);
+        r.bottom = expand((v >> 48) & 0xFFFFu);
+        return r;
+    }
+
+   private:
+    const RoiParameters m_parameters;
+    const CameraPose m_pose;
+    uint32_t m_width{0};
+    uint32_t m_height{0};
+    FrameRegion m_static{};
+    cv::Mat m_polygon{};
+    uint32_t m_framesSinceFullScan{0};
+    std::atomic<uint64_t> m_region{pack(FrameRegion{})};
+};
+
+#endif
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SENSOR_STORE_HPP
+#define SENSOR_STORE_HPP
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+/**
+ * Latest value of one sensor, i.e. of one (dataType, senderStamp) pair.
+ * Readings with a single field use value[0]; vectors use value[0..2].
+ */
+struct SensorReading {
+    int32_t dataType{0};
+    uint32_t senderStamp{0};
+    int64_t sampleTimeStamp{0};  // Microseconds; when the value was measured.
+    int64_t receivedTimeStamp{0};// Microseconds; when the value was received.
+    double value[3]{0.0, 0.0, 0.0};
+};
+
+/**
+ * SensorStore keeps the latest reading per (dataType, senderStamp) in a
+ * fixed table of slots, each guarded by its own sequence lock. Writers (the
+ * OD4Session's receiving thread) and readers (any stage of the frame loop)
+ * never block each other: a reader that overlaps with an update simply
+ * retries. Neither storing nor loading allocates.
+ */
+class SensorStore {
+   public:
+    static constexpr uint32_t CAPACITY{64};
+
+   private:
+    SensorStore(const SensorStore &) = delete;
+    SensorStore(SensorStore &&)      = delete;
+    SensorStore &operator=(const SensorStore &) = delete;
+    SensorStore &operator=(SensorStore &&) = delete;
+
+   public:
+    SensorStore() = default;
+
+    /**
+     * This method replaces the latest value for the reading's key.
+     *
+     * @return false if all slots are taken by other keys.
+     */
+    bool store(const SensorReading &reading) noexcept {
+        Slot *slot{claim(key(reading.dataType, reading.senderStamp))};
+        if (nullptr == slot) {
+            return false;
+        }
+
+        // Take the slot from even to odd; this also serializes several writers.
+        uint32_t sequence{slot->sequence.load(std::memory_order_relaxed)};
+        do {
+            sequence &= ~1u;
+        } while (!slot->sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire, std::memory_order_relaxed));
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot->sampleTimeStamp.store(reading.sampleTimeStamp, std::memory_order_relaxed);
+        slot->receivedTimeStamp.store(reading.receivedTimeStamp, std::memory_order_relaxed);
+        for (uint32_t i{0}; i < 3; i++) {
+            slot->value[i].store(reading.value[i], std::memory_order_relaxed);
+        }
+
+        slot->sequence.store(sequence + 2, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * This method copies the latest value for the given key.
+     *
+     * @return false if nothing was stored for this key yet.
+     */
+    bool load(int32_t dataType, uint32_t senderStamp, SensorReading &reading) const noexcept {
+        const Slot *slot{lookup(key(dataType, senderStamp))};
+        if (nullptr == slot) {
+            return false;
+        }
+
+        uint32_t before{0};
+        uint32_t after{0};
+        do {
+            before = slot->sequence.load(std::memory_order_acquire);
+            if (0 != (before & 1u)) {
+                continue;
+            }
+            reading.sampleTimeStamp = slot->sampleTimeStamp.load(std::memory_order_relaxed);
+            reading.receivedTimeStamp = slot->receivedTimeStamp.load(std::memory_order_relaxed);
+            for (uint32_t i{0}; i < 3; i++) {
+                reading.value[i] = slot->value[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = slot->sequence.load(std::memory_order_relaxed);
+        } while ( (0 != (before & 1u)) || (before != after) );
+
+        reading.dataType = dataType;
+        reading.senderStamp = senderStamp;
+        return (0 != after);
+    }
+
+   private:
+    static uint64_t key(int32_t dataType, uint32_t senderStamp) noexcept {
+        // The top bit marks a slot as taken so that key 0 stays free.
+        return (1ull << 63) | (static_cast<uint64_t>(static_cast<uint32_t>(dataType)) << 32) | senderStamp;
+    }
+
+    struct Slot;
+    const Slot *lookup(uint64_t k) const noexcept {
+        // Open addressing with linear probing; slots are never released.
+        uint32_t index{hash(k)};
+        for (uint32_t probes{0}; probes < CAPACITY; probes++, index = (index + 1) % CAPACITY) {
+            const uint64_t EXISTING{m_slots[index].key.load(std::memory_order_acquire)};
+            if (EXISTING == k) {
+                return &m_slots[index];
+            }
+            if (0 == EXISTING) {
+                break;
+            }
+        }
+        return nullptr;
+    }
+
+    Slot *claim(uint64_t k) noexcept {
+        uint32_t index{hash(k)};
+        for (uint32_t probes{0}; probes < CAPACITY; probes++, index = (index + 1) % CAPACITY) {
+            uint64_t existing{m_slots[index].key.load(std::memory_order_acquire)};
+            if ( (0 == existing) && m_slots[index].key.compare_exchange_strong(existing, k, std::memory_order_acq_rel) ) {
+                return &m_slots[index];
+            }
+            if (existing == k) {
+                return &m_slots[index];
+            }
+        }
+        return nullptr;
+    }
+
+    static uint32_t hash(uint64_t k) noexcept {
+        return static_cast<uint32_t>((k ^ (k >> 29)) * 0x9e3779b97f4a7c15ull >> 32) % CAPACITY;
+    }
+
+   private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> key{0};
+        std::atomic<uint32_t> sequence{0};
+        std::atomic<int64_t> sampleTimeStamp{0};
+        std::atomic<int64_t> receivedTimeStamp{0};
+        std::atomic<double> value[3]{{0.0}, {0.0}, {0.0}};
+    };
+    Slot m_slots[CAPACITY]{};
+};
+
+namespace sensorStore {
+// Copy the fields of a reading message into value[0..2].
+inline void values(const opendlv::proxy::AccelerationReading &m, double *v) noexcept { v[0] = m.accelerationX(); v[1] = m.accelerationY(); v[2] = m.accelerationZ(); }
+inline void values(const opendlv::proxy::AngularVelocityReading &m, double *v) noexcept { v[0] = m.angularVelocityX(); v[1] = m.angularVelocityY(); v[2] = m.angularVelocityZ(); }
+inline void values(const opendlv::proxy::MagneticFieldReading &m, double *v) noexcept { v[0] = m.magneticFieldX(); v[1] = m.magneticFieldY(); v[2] = m.magneticFieldZ(); }
+inline void values(const opendlv::proxy::AltitudeReading &m, double *v) noexcept { v[0] = m.altitude(); }
+inline void values(const opendlv::proxy::PressureReading &m, double *v) noexcept { v[0] = m.pressure(); }
+inline void values(const opendlv::proxy::TemperatureReading &m, double *v) noexcept { v[0] = m.temperature(); }
+inline void values(const opendlv::proxy::TorqueReading &m, double *v) noexcept { v[0] = m.torque(); }
+inline void values(const opendlv::proxy::VoltageReading &m, double *v) noexcept { v[0] = m.voltage(); }
+inline void values(const opendlv::proxy::AngleReading &m, double *v) noexcept { v[0] = m.angle(); }
+inline void values(const opendlv::proxy::DistanceReading &m, double *v) noexcept { v[0] = m.distance(); }
+inline void values(const opendlv::proxy::SwitchStateReading &m, double *v) noexcept { v[0] = m.state(); }
+inline void values(const opendlv::proxy::PedalPositionReading &m, double *v) noexcept { v[0] = m.position(); }
+inline void values(const opendlv::proxy::ElectricCurrentReading &m, double *v) noexcept { v[0] = m.electricCurrent(); }
+inline void values(const opendlv::proxy::GroundSteeringReading &m, double *v) noexcept { v[0] = m.groundSteering(); }
+inline void values(const opendlv::proxy::GroundSpeedReading &m, double *v) noexcept { v[0] = m.groundSpeed(); }
+inline void values(const opendlv::proxy::AxleAngularVelocityReading &m, double *v) noexcept { v[0] = m.axleAngularVelocity(); }
+inline void values(const opendlv::proxy::WeightReading &m, double *v) noexcept { v[0] = m.weight(); }
+inline void values(const opendlv::proxy::GeodeticHeadingReading &m, double *v) noexcept { v[0] = m.northHeading(); }
+inline void values(const opendlv::proxy::GeodeticWgs84Reading &m, double *v) noexcept { v[0] = m.latitude(); v[1] = m.longitude(); }
+
+template <typename T>
+inline void subscribe(cluon::OD4Session &od4, SensorStore &store) noexcept {
+    od4.dataTrigger(T::ID(), [&store](cluon::data::Envelope &&env) {
+        SensorReading reading;
+        reading.dataType = env.dataType();
+        reading.senderStamp = env.senderStamp();
+        reading.sampleTimeStamp = cluon::time::toMicroseconds(env.sampleTimeStamp());
+        reading.receivedTimeStamp = cluon::time::toMicroseconds(env.received());
+        values(cluon::extractMessage<T>(std::move(env)), reading.value);
+        store.store(reading);
+    });
+}
+}
+
+/**
+ * This function registers data triggers for all numeric opendlv.proxy.*Reading
+ * messages that keep the given store up to date. ImageReading and
+ * RemoteMessageReading carry variable-length payloads and are not stored.
+ */
+inline void subscribeToReadings(cluon::OD4Session &od4, SensorStore &store) noexcept {
+    using namespace opendlv::proxy;
+    sensorStore::subscribe<AccelerationReading>(od4, store);
+    sensorStore::subscribe<AngularVelocityReading>(od4, store);
+    sensorStore::subscribe<MagneticFieldReading>(od4, store);
+    sensorStore::subscribe<AltitudeReading>(od4, store);
+    sensorStore::subscribe<PressureReading>(od4, store);
+    sensorStore::subscribe<TemperatureReading>(od4, store);
+    sensorStore::subscribe<TorqueReading>(od4, store);
+    sensorStore::subscribe<VoltageReading>(od4, store);
+    sensorStore::subscribe<AngleReading>(od4, store);
+    sensorStore::subscribe<DistanceReading>(od4, store);
+    sensorStore::subscribe<SwitchStateReading>(od4, store);
+    sensorStore::subscribe<PedalPositionReading>(od4, store);
+    sensorStore::subscribe<ElectricCurrentReading>(od4, store);
+    sensorStore::subscribe<GroundSteeringReading>(od4, store);
+    sensorStore::subscribe<GroundSpeedReading>(od4, store);
+    sensorStore::subscribe<AxleAngularVelocityReading>(od4, store);
+    sensorStore::subscribe<WeightReading>(od4, store);
+    sensorStore::subscribe<GeodeticHeadingReading>(od4, store);
+    sensorStore::subscribe<GeodeticWgs84Reading>(od4, store);
+}
+
+#endif
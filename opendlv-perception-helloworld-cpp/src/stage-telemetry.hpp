@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STAGE_TELEMETRY_HPP
+#define STAGE_TELEMETRY_HPP
+
+#include "latency-trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+// Parts of the pipeline whose run time is measured.
+enum class Stage : uint8_t {
+    ACQUISITION  = 0,  // From the notification of a frame until it is handed over; includes COPY.
+    COPY         = 1,  // Copying the frame (and its pyramid) out of shared memory.
+    SEGMENTATION = 2,  // Labelling cone pixels.
+    LABELLING    = 3,  // Turning labels into tracked cones with position.
+    PROCESSING   = 4,  // All of the processing stage; includes SEGMENTATION and LABELLING.
+    PUBLISHING   = 5,  // Sending the cones of a frame.
+    DISPLAY      = 6,  // Showing or drawing a frame for debugging.
+    CONTROL      = 7,  // One step of the control loop.
+};
+
+/**
+ * StageTelemetry keeps a histogram of the run time of every stage that
+ * the stages record into with a few relaxed atomic stores and no locks.
+ *
+ * Each stage is recorded by only one thread at a time. The buckets only
+ * ever count up; snapshot() is called by a single other thread and takes
+ * the difference to its previous snapshot. Thus, recording never waits
+ * and nothing is reset under the feet of a stage.
+ */
+class StageTelemetry {
+   public:
+    static constexpr uint32_t NUMBER_OF_STAGES{8};
+
+   private:
+    StageTelemetry(const StageTelemetry &) = delete;
+    StageTelemetry(StageTelemetry &&)      = delete;
+    StageTelemetry &operator=(const StageTelemetry &) = delete;
+    StageTelemetry &operator=(StageTelemetry &&) = delete;
+
+   public:
+    StageTelemetry() = default;
+
+    /**
+     * This method records one run of a stage; called by the stage's thread.
+     */
+    void record(Stage stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) noexcept {
+        const int64_t DURATION{std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()};
+        const uint64_t VALUE{static_cast<uint64_t>(std::max<int64_t>(0, DURATION))};
+        Histogram &h{m_stages[static_cast<uint8_t>(stage)]};
+
+        // Single writer per stage: no read-modify-write instructions needed.
+        std::atomic<uint64_t> &b{h.buckets[LatencyHistogram::bucket(VALUE)]};
+        b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        h.sum.store(h.sum.load(std::memory_order_relaxed) + VALUE, std::memory_order_relaxed);
+
+        // The maximum is reset by snapshot(); do not overwrite a reset with an old maximum.
+        uint64_t max{h.max.load(std::memory_order_relaxed)};
+        while ( (VALUE > max) && !h.max.compare_exchange_weak(max, VALUE, std::memory_order_relaxed) ) {}
+    }
+
+    /**
+     * This method summarizes all stages since the previous snapshot as a
+     * single line "stage-timing period=<s> <stage>:n=<runs>,p50=<ms>,p99=<ms>,max=<ms>,busy=<%> ...",
+     * where busy is the share of the period spent in the stage.
+     *
+     * @return Summary of all stages that ran in the period.
+     */
+    std::string snapshot() noexcept {
+        static const char *NAMES[NUMBER_OF_STAGES]{"acquisition", "copy", "segmentation", "labelling", "processing", "publishing", "display", "control"};
+        const auto NOW{std::chrono::steady_clock::now()};
+        const double PERIOD{std::chrono::duration_cast<std::chrono::microseconds>(NOW - m_lastSnapshot).count() * 1e-6};
+        m_lastSnapshot = NOW;
+
+        std::stringstream sstr;
+        sstr << std::fixed << std::setprecision(2) << "stage-timing period=" << PERIOD;
+        for (uint32_t s{0}; s < NUMBER_OF_STAGES; s++) {
+            Histogram &h{m_stages[s]};
+            m_window.reset();
+            for (uint32_t i{0}; i < LatencyHistogram::NUMBER_OF_BUCKETS; i++) {
+                const uint64_t COUNT{h.buckets[i].load(std::memory_order_relaxed)};
+                if (COUNT != h.seen[i]) {
+                    m_window.add(i, COUNT - h.seen[i], 0);
+                    h.seen[i] = COUNT;
+                }
+            }
+            const uint64_t SUM{h.sum.load(std::memory_order_relaxed)};
+            const uint64_t BUSY{SUM - h.seenSum};
+            h.seenSum = SUM;
+            m_window.add(0, 0, h.max.exchange(0, std::memory_order_relaxed));
+            if (0 == m_window.count()) {
+                continue;
+            }
+            sstr << " " << NAMES[s] << ":n=" << m_window.count()
+                 << ",p50=" << static_cast<double>(m_window.percentile(0.5f)) * 1e-3
+                 << ",p99=" << static_cast<double>(m_window.percentile(0.99f)) * 1e-3
+                 << ",max=" << static_cast<double>(m_window.max()) * 1e-3
+                 << ",busy=" << ((0.0 < PERIOD) ? static_cast<double>(BUSY) * 1e-4 / PERIOD : 0.0) << "%";
+        }
+        return sstr.str();
+    }
+
+   private:
+    struct Histogram {
+        alignas(64) std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+        std::array<std::atomic<uint64_t>, LatencyHistogram::NUMBER_OF_BUCKETS> buckets{};
+
+        // Only used by snapshot().
+        std::array<uint64_t, LatencyHistogram::NUMBER_OF_BUCKETS> seen{};
+        uint64_t seenSum{0};
+    };
+
+   private:
+    std::array<Histogram, NUMBER_OF_STAGES> m_stages{};
+    LatencyHistogram m_window{};
+    std::chrono::steady_clock::time_point m_lastSnapshot{std::chrono::steady_clock::now()};
+};
+
+#endif
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNDISTORTION_HPP
+#define UNDISTORTION_HPP
+
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Undistortion removes the lens distortion described by a calibration file
+ * as written by OpenCV's camera calibration (camera_matrix,
+ * distortion_coefficients, and optionally image_width and image_height).
+ *
+ * The result is an ideal pinhole camera with square pixels, the principal
+ * point in the image center and the configured vertical field of view; the
+ * same model that ConeBlobExtractor and GroundPlaneTable assume.
+ *
+ * Remapping whole frames is too expensive to do for every frame; hence,
+ * there are three ways to apply the correction:
+ *
+ *   POINTS: only correct the key points (centroid, top and bottom) of the
+ *           detected cones,
+ *   ROI:    remap the labels inside a rectangle of interest (by default,
+ *           the lower 60% of the frame),
+ *   FRAME:  remap all labels.
+ *
+ * The remap tables for ROI and FRAME are computed once per image size and
+ * kept as packed fixed-point maps (CV_16SC2 integer coordinates plus
+ * CV_16UC1 interpolation indices). Labels are remapped with nearest
+ * neighbour lookups that only need the integer part.
+ */
+class Undistortion {
+   public:
+    enum class Mode {
+        NONE,
+        POINTS,
+        ROI,
+        FRAME,
+    };
+
+   private:
+    Undistortion(const Undistortion &) = delete;
+    Undistortion(Undistortion &&)      = delete;
+    Undistortion &operator=(const Undistortion &) = delete;
+    Undistortion &operator=(Undistortion &&) = delete;
+
+   public:
+    Undistortion(Mode mode, const cv::Rect &roi) noexcept
+        : m_mode(mode)
+        , m_roi(roi) {}
+
+    /**
+     * This method parses the name of a mode; an empty name selects POINTS.
+     *
+     * @return false if the name is none of "points", "roi", "frame", "none".
+     */
+    static bool parseMode(const std::string &name, Mode &mode) noexcept {
+        if ( name.empty() || ("points" == name) ) {
+            mode = Mode::POINTS;
+        }
+        else if ("roi" == name) {
+            mode = Mode::ROI;
+        }
+        else if ("frame" == name) {
+            mode = Mode::FRAME;
+        }
+        else if ("none" == name) {
+            mode = Mode::NONE;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    Mode mode() const noexcept {
+        return (m_cameraMatrix.empty() ? Mode::NONE : m_mode);
+    }
+
+    /**
+     * This method reads the camera matrix and distortion coefficients.
+     *
+     * @return false if the file could not be read.
+     */
+    bool load(const std::string &filename) noexcept {
+        cv::FileStorage fs(filename, cv::FileStorage::READ);
+        if (!fs.isOpened()) {
+            return false;
+        }
+        fs["camera_matrix"] >> m_cameraMatrix;
+        fs["distortion_coefficients"] >> m_distortion;
+        if (!fs["image_width"].empty() && !fs["image_height"].empty()) {
+            fs["image_width"] >> m_calibrationWidth;
+            fs["image_height"] >> m_calibrationHeight;
+        }
+        if (m_cameraMatrix.empty()) {
+            m_distortion = cv::Mat();
+            return false;
+        }
+        m_cameraMatrix.convertTo(m_cameraMatrix, CV_64F);
+        return true;
+    }
+
+    /**
+     * This method prepares the correction for frames of the given size; it
+     * does nothing if nothing changed since the last call.
+     */
+    void prepare(uint32_t width, uint32_t height, float fovy) noexcept {
+        if ( (Mode::NONE == mode()) || ((width == m_width) && (height == m_height)) ) {
+            return;
+        }
+        m_width = width;
+        m_height = height;
+
+        // Scale the calibration to the actual resolution.
+        m_scaledCameraMatrix = m_cameraMatrix.clone();
+        if ( (0 < m_calibrationWidth) && (0 < m_calibrationHeight) ) {
+            const double SX{static_cast<double>(width) / m_calibrationWidth};
+            const double SY{static_cast<double>(height) / m_calibrationHeight};
+            m_scaledCameraMatrix.at<double>(0, 0) *= SX;
+            m_scaledCameraMatrix.at<double>(0, 2) *= SX;
+            m_scaledCameraMatrix.at<double>(1, 1) *= SY;
+            m_scaledCameraMatrix.at<double>(1, 2) *= SY;
+        }
+
+        const double F{0.5 * height / std::tan(0.5 * fovy * 3.14159265358979323846 / 180.0)};
+        m_pinholeMatrix = cv::Mat(cv::Matx33d(F, 0.0, 0.5 * width - 0.5,
+                                              0.0, F, 0.5 * height - 0.5,
+                                              0.0, 0.0, 1.0));
+
+        if ( (Mode::ROI == m_mode) || (Mode::FRAME == m_mode) ) {
+            cv::initUndistortRectifyMap(m_scaledCameraMatrix, m_distortion, cv::Mat(), m_pinholeMatrix,
+                                        cv::Size(static_cast<int>(width), static_cast<int>(height)), CV_16SC2, m_map, m_interpolation);
+            m_remapped.create(static_cast<int>(height), static_cast<int>(width), CV_8UC1);
+        }
+    }
+
+    /**
+     * This method replaces the labels in the ROI (or in the whole frame) by
+     * their undistorted counterparts; does nothing in other modes.
+     */
+    void remapLabels(cv::Mat &labels) noexcept {
+        cv::Rect area{0, 0, labels.cols, labels.rows};
+        if (Mode::ROI == mode()) {
+            // Without a given ROI, the lower 60% of the frame show the track.
+            area = m_roi.empty() ? cv::Rect(0, labels.rows * 2 / 5, labels.cols, labels.rows - labels.rows * 2 / 5) : (area & m_roi);
+        }
+        else if (Mode::FRAME != mode()) {
+            return;
+        }
+        if (area.empty()) {
+            return;
+        }
+        cv::Mat remapped{m_remapped(area)};
+        cv::remap(labels, remapped, m_map(area), cv::Mat(), cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0));
+        remapped.copyTo(labels(area));
+    }
+
+    /**
+     * This method corrects pixel coordinates in place; does nothing unless in POINTS mode.
+     */
+    void undistortPoints(std::vector<cv::Point2f> &points) noexcept {
+        if ( (Mode::POINTS != mode()) || points.empty() ) {
+            return;
+        }
+        cv::undistortPoints(points, m_undistorted, m_scaledCameraMatrix, m_distortion, cv::noArray(), m_pinholeMatrix);
+        points.swap(m_undistorted);
+    }
+
+   private:
+    const Mode m_mode;
+    const cv::Rect m_roi;
+
+    cv::Mat m_cameraMatrix{};
+    cv::Mat m_distortion{};
+    int m_calibrationWidth{0};
+    int m_calibrationHeight{0};
+
+    uint32_t m_width{0};
+    uint32_t m_height{0};
+    cv::Mat m_scaledCameraMatrix{};
+    cv::Mat m_pinholeMatrix{};
+    cv::Mat m_map{};
+    cv::Mat m_interpolation{};
+    cv::Mat m_remapped{};
+    std::vector<cv::Point2f> m_undistorted{};
+};
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORK_STEALING_POOL_HPP
+#define WORK_STEALING_POOL_HPP
+
+#include "pipeline.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * This function parses a list of cores given as "c0,c1,...".
+ *
+ * @return false if an entry is not a core index.
+ */
+inline bool parseCoreList(const std::string &str, std::vector<int32_t> &cores) noexcept {
+    cores.clear();
+    std::stringstream sstr{str};
+    std::string value;
+    while (std::getline(sstr, value, ',')) {
+        if (value.empty() || (std::string::npos != value.find_first_not_of("0123456789"))) {
+            return false;
+        }
+        cores.push_back(std::stoi(value));
+    }
+    return !cores.empty();
+}
+
+/**
+ * WorkStealingPool runs the iterations of a parallel loop on a few worker
+ * threads and the calling thread.
+ *
+ * The iterations of a loop are split into one contiguous range per
+ * participant. Everybody takes iterations from the front of its own range
+ * and, once that is empty, steals single iterations from the back of the
+ * others' ranges; a range is one atomic word, so taking and stealing are a
+ * compare-and-swap each and never block. Workers sleep on a condition
+ * variable between loops.
+ *
+ * parallelFor() must only be called from one thread at a time.
+ */
+class WorkStealingPool {
+   public:
+    static constexpr uint32_t MAX_THREADS{15};
+
+   private:
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool(WorkStealingPool &&)      = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(WorkStealingPool &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param numberOfThreads Worker threads besides the calling thread (at most MAX_THREADS); 0 runs every loop on the caller.
+     * @param cores Cores to pin the workers to in turn; empty leaves them unpinned.
+     */
+    WorkStealingPool(uint32_t numberOfThreads, const std::vector<int32_t> &cores) noexcept
+        : m_participants(std::min(numberOfThreads, MAX_THREADS) + 1) {
+        for (uint32_t i{0}; i + 1 < m_participants; i++) {
+            const int32_t CORE{cores.empty() ? -1 : cores[i % cores.size()]};
+            m_workers.emplace_back([this, i, CORE]() {
+                m_pinned.fetch_add(pinCurrentThreadToCore(CORE) ? 1 : 0);
+                m_started.fetch_add(1);
+                work(i + 1);
+            });
+        }
+        // Let all workers try to pin themselves before pinnedWorkers() is asked.
+        while (m_started.load() < m_workers.size()) {
+            std::this_thread::yield();
+        }
+    }
+
+    ~WorkStealingPool() noexcept {
+        {
+            std::lock_guard<std::mutex> lck(m_mutex);
+            m_running = false;
+        }
+        m_condition.notify_all();
+        for (auto &worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    /**
+     * @return Number of threads that run the iterations, including the caller.
+     */
+    uint32_t size() const noexcept {
+        return m_participants;
+    }
+
+    /**
+     * @return Number of workers that could be pinned as requested.
+     */
+    uint32_t pinnedWorkers() const noexcept {
+        return m_pinned.load();
+    }
+
+    /**
+     * This method calls function(i) for i in [0, count) and returns when all calls are done.
+     */
+    template <typename Function>
+    void parallelFor(uint32_t count, Function &&function) noexcept {
+        if ( (1 == m_participants) || (1 >= count) ) {
+            for (uint32_t i{0}; i < count; i++) {
+                function(i);
+            }
+            return;
+        }
+
+        using Body = typename std::remove_reference<Function>::type;
+        m_context = const_cast<void*>(static_cast<const void*>(&function));
+        m_invoke = [](void *context, uint32_t i) { (*static_cast<Body*>(context))(i); };
+        m_pending.store(count, std::memory_order_relaxed);
+        for (uint32_t p{0}; p < m_participants; p++) {
+            const uint32_t BEGIN{static_cast<uint32_t>(static_cast<uint64_t>(count) * p / m_participants)};
+            const uint32_t END{static_cast<uint32_t>(static_cast<uint64_t>(count) * (p + 1) / m_participants)};
+            m_ranges[p].value.store(pack(BEGIN, END), std::memory_order_release);
+        }
+        {
+            std::lock_guard<std::mutex> lck(m_mutex);
+            m_generation++;
+        }
+        m_condition.notify_all();
+
+        // The caller is participant 0 and waits for stolen iterations to finish.
+        participate(0);
+        while (0 < m_pending.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+   private:
+    struct Range {
+        alignas(64) std::atomic<uint64_t> value{0};  // First iteration in the upper, end in the lower 32 bits.
+    };
+
+    static uint64_t pack(uint32_t begin, uint32_t end) noexcept {
+        return (static_cast<uint64_t>(begin) << 32) | end;
+    }
+
+    void work(uint32_t participant) noexcept {
+        uint64_t generation{0};
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lck(m_mutex);
+                m_condition.wait(lck, [this, generation]() { return !m_running || (generation != m_generation); });
+                if (!m_running) {
+                    return;
+                }
+                generation = m_generation;
+            }
+            participate(participant);
+        }
+    }
+
+    void participate(uint32_t participant) noexcept {
+        uint32_t i{0};
+        while (takeFront(participant, i)) {
+            run(i);
+        }
+        for (uint32_t v{1}; v < m_participants; v++) {
+            const uint32_t VICTIM{(participant + v) % m_participants};
+            while (takeBack(VICTIM, i)) {
+                run(i);
+            }
+        }
+    }
+
+    void run(uint32_t i) noexcept {
+        m_invoke(m_context, i);
+        m_pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    bool takeFront(uint32_t participant, uint32_t &i) noexcept {
+        std::atomic<uint64_t> &range{m_ranges[participant].value};
+        uint64_t current{range.load(std::memory_order_acquire)};
+        while (static_cast<uint32_t>(current >> 32) < static_cast<uint32_t>(current)) {
+            if (range.compare_exchange_weak(current, current + (static_cast<uint64_t>(1) << 32), std::memory_order_acq_rel)) {
+                i = static_cast<uint32_t>(current >> 32);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool takeBack(uint32_t participant, uint32_t &i) noexcept {
+        std::atomic<uint64_t> &range{m_ranges[participant].value};
+        uint64_t current{range.load(std::memory_order_acquire)};
+        while (static_cast<uint32_t>(current >> 32) < static_cast<uint32_t>(current)) {
+            if (range.compare_exchange_weak(current, current - 1, std::memory_order_acq_rel)) {
+                i = static_cast<uint32_t>(current) - 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+   private:
+    const uint32_t m_participants;
+    std::array<Range, MAX_THREADS + 1> m_ranges{};
+    std::atomic<uint32_t> m_pending{0};
+    std::atomic<uint32_t> m_started{0};
+    std::atomic<uint32_t> m_pinned{0};
+
+    // The loop body; set before the ranges are published.
+    void *m_context{nullptr};
+    void (*m_invoke)(void*, uint32_t){nullptr};
+
+    std::mutex m_mutex{};
+    std::condition_variable m_condition{};
+    uint64_t m_generation{0};
+    bool m_running{true};
+    std::vector<std::thread> m_workers{};
+};
+
+#endif